@@ -0,0 +1,407 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <flibc/mem.h>
+#include <flibc/util.h>
+
+#include "accesslog.h"
+#include "fmt.h"
+#include "netaddr.h"
+#include "os.h"
+#include "stats.h"
+#include "sysext.h"
+#include "vdso.h"
+
+/* Must be a power of two. */
+#define ACCESSLOG_RING_SIZE 4096
+
+/* How long the logger sleeps when all rings are empty, in milliseconds. */
+#define ACCESSLOG_IDLE_SLEEP 20
+
+/* How long a worker waits for the logger at most with ALFP_WAIT, in
+   nanoseconds, before dropping the record anyway. */
+#define ACCESSLOG_MAX_WAIT 1000000
+
+/* The longest line that a record can produce: every byte of the fields
+   escaped, plus the time, the address, the status, the duration and the
+   separators. */
+#define ACCESSLOG_MAX_LINE_LEN (ACCESSLOG_FIELDS_MAX * 4 + 128)
+
+/**
+ * A single-producer single-consumer queue of records. The worker that owns it
+ * is the only one that writes the head and the records, and the logger is the
+ * only one that writes the tail. The indices only ever increase and are
+ * reduced modulo the size of the ring when accessing a record.
+ */
+struct accesslog_ring {
+	uint64_t head;
+
+	/**
+	 * The PID of the last worker that used the ring, or 0 if none has, so
+	 * that the logger can tell when all of them have exited.
+	 */
+	int32_t pid;
+
+	/* Keep the indices on separate cache lines so that the worker and the
+	   logger do not fight over the same one. */
+	char head_pad[52];
+
+	uint64_t tail;
+	char tail_pad[56];
+
+	struct accesslog_record records[ACCESSLOG_RING_SIZE];
+};
+
+_Static_assert(sizeof(struct accesslog_record) == 256,
+	       "access log records must be 256 bytes");
+
+static struct accesslog_ring *accesslog_rings;
+static uint32_t accesslog_ring_count;
+static enum accesslog_full_policy accesslog_policy;
+static int accesslog_fd = -1;
+
+/* Worker state */
+static struct accesslog_ring *accesslog_ring;
+/**
+ * The last tail that the worker has read, so that it does not need to read
+ * the logger's cache line unless the ring looks full.
+ */
+static uint64_t accesslog_cached_tail;
+
+/* Logger state */
+static char accesslog_buf[65536];
+static size_t accesslog_buf_len;
+
+static bool accesslog_wait(uint64_t head);
+static uint64_t accesslog_now_ns();
+static bool accesslog_workers_have_exited();
+static bool accesslog_has_exited(pid_t pid);
+static void accesslog_format(const struct accesslog_record *record,
+			     int64_t wall_offset);
+static void accesslog_append(const char *data, size_t len);
+static void accesslog_append_num(uint64_t value, size_t min_digits);
+static void accesslog_append_escaped(const char *data, size_t len);
+static void accesslog_flush();
+static int64_t accesslog_wall_offset();
+
+bool accesslog_init(uint32_t worker_count, const char *path,
+		    enum accesslog_full_policy policy)
+{
+	if (strcmp(path, "-") == 0) {
+		accesslog_fd = 1;
+	} else {
+		accesslog_fd =
+		    sysext_openat(AT_FDCWD, path,
+				  O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+				  0640);
+		if (accesslog_fd < 0) {
+			F_PRINT(2, "open() failed for the access log\n");
+			return false;
+		}
+	}
+
+	/* The mapping is shared with the logger and the workers because it is
+	   created before they are cloned. */
+	void *rings = sysext_mmap(
+	    NULL, worker_count * sizeof(struct accesslog_ring),
+	    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (SYSEXT_IS_ERR(rings)) {
+		F_PRINT(2, "mmap() failed\n");
+		return false;
+	}
+
+	accesslog_rings = rings;
+	accesslog_ring_count = worker_count;
+	accesslog_policy = policy;
+
+	return true;
+}
+
+bool accesslog_is_enabled() { return accesslog_rings != NULL; }
+
+void accesslog_set_worker(uint32_t worker_index)
+{
+	F_ASSERT(worker_index < accesslog_ring_count);
+	accesslog_ring = &accesslog_rings[worker_index];
+
+	/* The ring may have been used by a worker that has retired. */
+	accesslog_cached_tail =
+	    __atomic_load_n(&accesslog_ring->tail, __ATOMIC_ACQUIRE);
+	__atomic_store_n(&accesslog_ring->pid, sysext_getpid(),
+			 __ATOMIC_RELAXED);
+}
+
+struct accesslog_record *accesslog_reserve()
+{
+	uint64_t head = accesslog_ring->head;
+
+	if (head - accesslog_cached_tail == ACCESSLOG_RING_SIZE &&
+	    !accesslog_wait(head)) {
+		stats_inc(SC_ACCESS_LOG_DROPS);
+		return NULL;
+	}
+
+	return &accesslog_ring->records[head & (ACCESSLOG_RING_SIZE - 1)];
+}
+
+void accesslog_commit()
+{
+	/* The release ordering makes the record visible to the logger before
+	   the new head. */
+	__atomic_store_n(&accesslog_ring->head, accesslog_ring->head + 1,
+			 __ATOMIC_RELEASE);
+}
+
+noreturn void accesslog_run()
+{
+	bool idle = false;
+
+	for (;;) {
+		/* The workers are only checked when the rings are empty, and
+		   the rings are drained one last time once they have all
+		   exited. */
+		bool is_last = idle && accesslog_workers_have_exited();
+
+		int64_t wall_offset = accesslog_wall_offset();
+		idle = true;
+
+		for (uint32_t i = 0; i < accesslog_ring_count; i++) {
+			struct accesslog_ring *ring = &accesslog_rings[i];
+
+			uint64_t head =
+			    __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+			uint64_t tail = ring->tail;
+			if (head == tail)
+				continue;
+			idle = false;
+
+			for (; tail != head; tail++) {
+				accesslog_format(
+				    &ring->records[tail &
+						   (ACCESSLOG_RING_SIZE - 1)],
+				    wall_offset);
+			}
+
+			/* The records have been copied to the buffer, so the
+			   worker can reuse them. */
+			__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+		}
+
+		accesslog_flush();
+		if (is_last)
+			sys_exit(0);
+
+		if (idle) {
+			struct timespec duration;
+			duration.tv_sec = 0;
+			duration.tv_nsec = ACCESSLOG_IDLE_SLEEP * 1000000;
+			sysext_nanosleep(&duration);
+		}
+	}
+}
+
+/**
+ * Reads the tail of the ring again and, with ALFP_WAIT, lets the logger run
+ * until it makes space, for at most ACCESSLOG_MAX_WAIT. Returns false if the
+ * ring is still full.
+ */
+static bool accesslog_wait(uint64_t head)
+{
+	uint64_t deadline = 0;
+
+	for (;;) {
+		accesslog_cached_tail =
+		    __atomic_load_n(&accesslog_ring->tail, __ATOMIC_ACQUIRE);
+		if (head - accesslog_cached_tail != ACCESSLOG_RING_SIZE)
+			return true;
+
+		if (accesslog_policy == ALFP_DROP)
+			return false;
+
+		uint64_t now = accesslog_now_ns();
+		if (deadline == 0) {
+			stats_inc(SC_ACCESS_LOG_STALLS);
+			deadline = now + ACCESSLOG_MAX_WAIT;
+		} else if (now >= deadline) {
+			return false;
+		}
+
+		F_ASSERT(os_sched_yield() == 0);
+	}
+}
+
+static uint64_t accesslog_now_ns()
+{
+	struct timespec ts;
+	F_ASSERT(os_clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Returns true if at least one worker has used a ring and none of them is
+ * still running.
+ */
+static bool accesslog_workers_have_exited()
+{
+	bool has_workers = false;
+
+	for (uint32_t i = 0; i < accesslog_ring_count; i++) {
+		pid_t pid = __atomic_load_n(&accesslog_rings[i].pid,
+					    __ATOMIC_RELAXED);
+		if (pid == 0)
+			continue;
+		has_workers = true;
+		if (!accesslog_has_exited(pid))
+			return false;
+	}
+
+	return has_workers;
+}
+
+static bool accesslog_has_exited(pid_t pid)
+{
+	/* A worker that has exited stays a zombie until its parent reaps it,
+	   and its pidfd is then readable. */
+	int pid_fd = sysext_pidfd_open(pid, 0);
+	if (pid_fd < 0)
+		return pid_fd == -ESRCH;
+
+	struct sysext_pollfd poll_fd;
+	poll_fd.fd = pid_fd;
+	poll_fd.events = POLLIN;
+	poll_fd.revents = 0;
+	bool has_exited = sysext_poll(&poll_fd, 1, 0) == 1;
+	sys_close(pid_fd);
+	return has_exited;
+}
+
+static void accesslog_format(const struct accesslog_record *record,
+			     int64_t wall_offset)
+{
+	if (sizeof(accesslog_buf) - accesslog_buf_len < ACCESSLOG_MAX_LINE_LEN)
+		accesslog_flush();
+
+	/* The time, in seconds with a millisecond precision. */
+	uint64_t wall_time = record->time + wall_offset;
+	accesslog_append_num(wall_time / 1000, 1);
+	accesslog_append(".", 1);
+	accesslog_append_num(wall_time % 1000, 3);
+	accesslog_append(" ", 1);
+
+	if (netaddr_is_zero(&record->peer_addr)) {
+		accesslog_append("- ", 2);
+	} else {
+		char addr[NETADDR_MAX_LEN];
+		size_t addr_len = netaddr_format(addr, &record->peer_addr);
+		accesslog_append(addr, addr_len);
+		accesslog_append(" ", 1);
+	}
+
+	size_t fields_len = record->fields_len;
+	F_ASSERT(fields_len <= ACCESSLOG_FIELDS_MAX);
+	size_t path_len = 0;
+	while (path_len < fields_len && record->fields[path_len] != '\0')
+		path_len++;
+	size_t host_start = path_len == fields_len ? path_len : path_len + 1;
+	size_t host_len = fields_len - host_start;
+
+	if (host_len == 0)
+		accesslog_append("-", 1);
+	else
+		accesslog_append_escaped(record->fields + host_start, host_len);
+	accesslog_append(" ", 1);
+
+	if (path_len == 0)
+		accesslog_append("-", 1);
+	else
+		accesslog_append_escaped(record->fields, path_len);
+	accesslog_append(" ", 1);
+
+	accesslog_append_num(record->status, 1);
+	accesslog_append(" ", 1);
+	accesslog_append_num(record->duration, 1);
+	accesslog_append("\n", 1);
+}
+
+static void accesslog_append(const char *data, size_t len)
+{
+	F_ASSERT(accesslog_buf_len + len <= sizeof(accesslog_buf));
+	memcpy(accesslog_buf + accesslog_buf_len, data, len);
+	accesslog_buf_len += len;
+}
+
+static void accesslog_append_num(uint64_t value, size_t min_digits)
+{
+	char num[FMT_U64_MAX_LEN];
+	size_t len = fmt_u64(num, value);
+
+	for (; len < min_digits; min_digits--)
+		accesslog_append("0", 1);
+	accesslog_append(num, len);
+}
+
+static void accesslog_append_escaped(const char *data, size_t len)
+{
+	const char hex[] = "0123456789abcdef";
+
+	/* The fields come straight from the client, so escape anything that
+	   could be used to forge a line or a field. */
+	for (size_t i = 0; i < len; i++) {
+		uint8_t ch = data[i];
+		if (ch > ' ' && ch < 0x7f && ch != '\\') {
+			accesslog_append((const char *)&ch, 1);
+			continue;
+		}
+
+		char escaped[4] = {'\\', 'x', hex[ch >> 4], hex[ch & 0xf]};
+		accesslog_append(escaped, sizeof(escaped));
+	}
+}
+
+static void accesslog_flush()
+{
+	size_t written = 0;
+	while (written < accesslog_buf_len) {
+		ssize_t ret = sys_write(accesslog_fd, accesslog_buf + written,
+					accesslog_buf_len - written);
+		if (ret < 0) {
+			F_PRINT(2, "write() failed for the access log\n");
+			sys_exit(1);
+		}
+		written += ret;
+	}
+
+	accesslog_buf_len = 0;
+}
+
+static int64_t accesslog_wall_offset()
+{
+	struct timespec wall;
+	struct timespec mono;
+	if (vdso_clock_gettime(CLOCK_REALTIME, &wall) != 0 ||
+	    vdso_clock_gettime(CLOCK_MONOTONIC, &mono) != 0) {
+		F_PRINT(2, "clock_gettime() failed\n");
+		sys_exit(1);
+	}
+
+	return (int64_t)(wall.tv_sec * 1000 + wall.tv_nsec / 1000000) -
+	       (int64_t)(mono.tv_sec * 1000 + mono.tv_nsec / 1000000);
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP2SD_ACCESSLOG_H
+#define HTTP2SD_ACCESSLOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdnoreturn.h>
+
+#include "netaddr.h"
+
+/**
+ * The maximum amount of bytes of the request fields (the path, a NULL
+ * character and the host) that are kept in a record. Longer fields are
+ * truncated.
+ */
+#define ACCESSLOG_FIELDS_MAX 224
+
+/**
+ * A request as it is written by a worker into its ring. Its size is precisely
+ * 256 bytes so that records never share a cache line.
+ */
+struct accesslog_record {
+	/**
+	 * The CLOCK_MONOTONIC time at which the request has been answered, in
+	 * milliseconds. The logger converts it to a wall clock time.
+	 */
+	uint64_t time;
+
+	/**
+	 * The client's address, all zeros for the clients of the Unix socket.
+	 */
+	struct netaddr peer_addr;
+
+	/**
+	 * The time between the connection being accepted and the response
+	 * being sent, in milliseconds.
+	 */
+	uint32_t duration;
+
+	uint16_t status;
+	uint16_t fields_len;
+
+	/**
+	 * The request path, a NULL character and then the request host.
+	 */
+	char fields[ACCESSLOG_FIELDS_MAX];
+};
+
+enum accesslog_full_policy {
+	/**
+	 * Discard the record when the ring is full, so that the event loop
+	 * never waits for the logger.
+	 */
+	ALFP_DROP,
+
+	/**
+	 * Wait for the logger to make space when the ring is full, for at most
+	 * a millisecond, so that records are only lost when the logger cannot
+	 * keep up for a while. Every wait is counted in the statistics.
+	 */
+	ALFP_WAIT,
+};
+
+/**
+ * Creates one ring per worker in a shared mapping and opens the log file, or
+ * uses the standard output if path is "-". This must be called before the
+ * logger and the workers are cloned.
+ */
+bool accesslog_init(uint32_t worker_count, const char *path,
+		    enum accesslog_full_policy policy);
+
+/**
+ * Returns true if accesslog_init has been called, meaning that the workers
+ * should log their requests.
+ */
+bool accesslog_is_enabled();
+
+/**
+ * Selects the ring of the current worker.
+ */
+void accesslog_set_worker(uint32_t worker_index);
+
+/**
+ * Returns the next free record in the current worker's ring, or NULL if it is
+ * full and the record must be dropped. The record is not visible to the
+ * logger until accesslog_commit is called.
+ */
+struct accesslog_record *accesslog_reserve();
+
+void accesslog_commit();
+
+/**
+ * The main loop of the logger process, which drains the rings of all the
+ * workers and writes the records to the log file in batches. The logger exits
+ * once all the workers have exited and their last records have been written.
+ */
+noreturn void accesslog_run();
+
+#endif
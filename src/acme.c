@@ -0,0 +1,333 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <flibc/linux.h>
+#include <flibc/mem.h>
+#include <flibc/str.h>
+#include <flibc/util.h>
+
+#include "acme.h"
+#include "fmt.h"
+#include "sysext.h"
+
+#define ACME_PATH_PREFIX "/.well-known/acme-challenge/"
+#define ACME_PATH_PREFIX_LEN (sizeof(ACME_PATH_PREFIX) - 1)
+
+/* Tokens are at least 128 bits encoded in base64url, so 22 characters, and
+   usually 43. */
+#define ACME_TOKEN_MAX 128
+
+#define ACME_MAX_ENTRIES 64
+
+/* Must be a power of two, and at least twice the amount of entries so that the
+   probe sequences stay short. */
+#define ACME_SLOT_COUNT 128
+
+struct acme_entry {
+	uint16_t token_len;
+	uint16_t content_len;
+	char token[ACME_TOKEN_MAX];
+	char content[ACME_CONTENT_MAX];
+};
+
+struct acme_table {
+	struct acme_entry entries[ACME_MAX_ENTRIES];
+	uint32_t entry_count;
+
+	/**
+	 * An open addressing hash table of the entries with linear probing,
+	 * where every slot is the index of an entry or -1 if it is empty.
+	 */
+	int8_t slots[ACME_SLOT_COUNT];
+};
+
+static const char *acme_dir_path;
+
+/* The table is loaded into the one that is not used, and they are only
+   swapped once the whole directory has been read. */
+static struct acme_table acme_tables[2];
+static struct acme_table *acme_table = &acme_tables[0];
+
+static bool acme_reload();
+static void acme_load_file(struct acme_table *table, int dir_fd,
+			   const char *name);
+static const struct acme_entry *acme_find(const char *path);
+static bool acme_is_token(const char *token, size_t len);
+static uint32_t acme_hash(const char *data, size_t len);
+
+bool acme_init(const char *dir_path)
+{
+	acme_dir_path = dir_path;
+
+	int dir_fd = sysext_openat(AT_FDCWD, dir_path,
+				   O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+	if (dir_fd < 0) {
+		F_PRINT(2, "open() failed for the ACME directory\n");
+		return false;
+	}
+	sys_close(dir_fd);
+
+	return acme_reload();
+}
+
+bool acme_is_enabled() { return acme_dir_path != NULL; }
+
+int acme_watch()
+{
+	int fd = sysext_inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0)
+		return fd;
+
+	int ret = sysext_inotify_add_watch(fd, acme_dir_path,
+					   IN_CLOSE_WRITE | IN_MOVED_FROM |
+					       IN_MOVED_TO | IN_DELETE |
+					       IN_ONLYDIR);
+	if (ret < 0) {
+		sys_close(fd);
+		return ret;
+	}
+
+	/* Tokens might have been added between acme_init and now. */
+	if (!acme_reload()) {
+		sys_close(fd);
+		return -EINVAL;
+	}
+
+	return fd;
+}
+
+bool acme_on_watch_event(int fd)
+{
+	/* The events themselves do not matter because the whole directory is
+	   loaded again, which is simpler and cheap since there are only a few
+	   tokens at a time. */
+	char events[1024];
+
+	for (;;) {
+		ssize_t ret = sys_read(fd, events, sizeof(events));
+		if (ret == -EAGAIN)
+			break;
+		if (ret < 0) {
+			F_PRINT(2, "read() failed\n");
+			return false;
+		}
+	}
+
+	/* If the directory cannot be read anymore, the tokens of the last
+	   complete load are still served, which is better than stopping. */
+	acme_reload();
+	return true;
+}
+
+bool acme_copy_challenge(const char *path, char *content, size_t *content_len)
+{
+	const struct acme_entry *entry = acme_find(path);
+	if (entry == NULL)
+		return false;
+
+	memcpy(content, entry->content, entry->content_len);
+	*content_len = entry->content_len;
+	return true;
+}
+
+size_t acme_write_response(const char *content, size_t content_len, char *buf,
+			   size_t capacity)
+{
+	char *cursor = buf;
+
+	const char header[] =
+	    "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: ";
+	size_t header_len = sizeof(header) - 1;
+	F_ASSERT(cursor + header_len + FMT_U64_MAX_LEN <= buf + capacity);
+	memcpy(cursor, header, header_len);
+	cursor += header_len;
+	cursor += fmt_u64(cursor, content_len);
+
+	const char footer[] = "\r\nConnection: close\r\n\r\n";
+	size_t footer_len = sizeof(footer) - 1;
+	F_ASSERT(cursor + footer_len + content_len <= buf + capacity);
+	memcpy(cursor, footer, footer_len);
+	cursor += footer_len;
+
+	memcpy(cursor, content, content_len);
+	cursor += content_len;
+
+	return cursor - buf;
+}
+
+static bool acme_reload()
+{
+	/* The directory is opened again every time, because the workers
+	   share their FD table and the offset of a shared FD would be moved by
+	   all of them. */
+	int dir_fd = sysext_openat(AT_FDCWD, acme_dir_path,
+				   O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+	if (dir_fd < 0) {
+		F_PRINT(2, "open() failed for the ACME directory\n");
+		return false;
+	}
+
+	struct acme_table *table = acme_table == &acme_tables[0]
+				       ? &acme_tables[1]
+				       : &acme_tables[0];
+	table->entry_count = 0;
+	memset(table->slots, -1, sizeof(table->slots));
+
+	char buf[4096];
+	for (;;) {
+		ssize_t len = sysext_getdents64(dir_fd, buf, sizeof(buf));
+		if (len == 0)
+			break;
+		if (len < 0) {
+			F_PRINT(2, "getdents64() failed\n");
+			sys_close(dir_fd);
+			return false;
+		}
+
+		for (ssize_t offset = 0; offset < len;) {
+			const struct sysext_dirent64 *dirent =
+			    (const struct sysext_dirent64 *)(buf + offset);
+			offset += dirent->reclen;
+
+			if (dirent->type != DT_REG &&
+			    dirent->type != DT_UNKNOWN)
+				continue;
+			acme_load_file(table, dir_fd, dirent->name);
+		}
+	}
+
+	sys_close(dir_fd);
+	acme_table = table;
+	return true;
+}
+
+static void acme_load_file(struct acme_table *table, int dir_fd,
+			   const char *name)
+{
+	size_t token_len = strlen(name);
+	if (!acme_is_token(name, token_len))
+		return;
+
+	if (table->entry_count == ACME_MAX_ENTRIES) {
+		F_PRINT(2, "too many ACME challenges, ignoring some\n");
+		return;
+	}
+
+	int fd = sysext_openat(dir_fd, name, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0)
+		return;
+
+	struct acme_entry *entry = &table->entries[table->entry_count];
+
+	/* Read one byte more than the maximum to detect files that are too
+	   big. */
+	char content[ACME_CONTENT_MAX + 1];
+	size_t content_len = 0;
+	for (;;) {
+		ssize_t ret = sys_read(fd, content + content_len,
+				       sizeof(content) - content_len);
+		if (ret < 0) {
+			sys_close(fd);
+			return;
+		}
+		if (ret == 0)
+			break;
+		content_len += ret;
+		if (content_len == sizeof(content))
+			break;
+	}
+	sys_close(fd);
+
+	if (content_len > ACME_CONTENT_MAX) {
+		F_PRINT(2, "ACME challenge file is too big, ignoring it\n");
+		return;
+	}
+
+	/* ACME clients usually write the key authorization followed by a new
+	   line, which is not part of it. */
+	while (content_len != 0 &&
+	       (content[content_len - 1] == '\n' ||
+		content[content_len - 1] == '\r' ||
+		content[content_len - 1] == ' '))
+		content_len--;
+
+	entry->token_len = token_len;
+	memcpy(entry->token, name, token_len);
+	entry->content_len = content_len;
+	memcpy(entry->content, content, content_len);
+
+	uint32_t slot = acme_hash(name, token_len) & (ACME_SLOT_COUNT - 1);
+	while (table->slots[slot] != -1)
+		slot = (slot + 1) & (ACME_SLOT_COUNT - 1);
+	table->slots[slot] = table->entry_count;
+	table->entry_count++;
+}
+
+static const struct acme_entry *acme_find(const char *path)
+{
+	if (memcmp(path, ACME_PATH_PREFIX, ACME_PATH_PREFIX_LEN) != 0)
+		return NULL;
+
+	const char *token = path + ACME_PATH_PREFIX_LEN;
+	size_t token_len = strlen(token);
+	if (!acme_is_token(token, token_len))
+		return NULL;
+
+	uint32_t slot = acme_hash(token, token_len) & (ACME_SLOT_COUNT - 1);
+	while (acme_table->slots[slot] != -1) {
+		const struct acme_entry *entry =
+		    &acme_table->entries[acme_table->slots[slot]];
+		if (entry->token_len == token_len &&
+		    memcmp(entry->token, token, token_len) == 0)
+			return entry;
+		slot = (slot + 1) & (ACME_SLOT_COUNT - 1);
+	}
+
+	return NULL;
+}
+
+static bool acme_is_token(const char *token, size_t len)
+{
+	if (len == 0 || len > ACME_TOKEN_MAX)
+		return false;
+
+	/* The base64url alphabet. This also rejects the names of the hidden
+	   and temporary files of most ACME clients. */
+	for (size_t i = 0; i < len; i++) {
+		char ch = token[i];
+		if (!((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+		      (ch >= '0' && ch <= '9') || ch == '-' || ch == '_'))
+			return false;
+	}
+
+	return true;
+}
+
+static uint32_t acme_hash(const char *data, size_t len)
+{
+	/* FNV-1a */
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (uint8_t)data[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP2SD_ACME_H
+#define HTTP2SD_ACME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Serves the ACME http-01 challenges. Every file of the challenge directory
+ * whose name is a valid token is loaded into an in-memory hash table, and the
+ * requests for /.well-known/acme-challenge/<token> are answered with the
+ * content of the file. The directory is watched with inotify, so the table is
+ * reloaded when the ACME client adds or removes a token, and the filesystem is
+ * never touched to answer a request.
+ */
+
+/**
+ * The maximum size of a challenge file. Bigger files are ignored.
+ */
+#define ACME_CONTENT_MAX 256
+
+/**
+ * Loads the tokens of the directory. This must be called before the workers
+ * are cloned.
+ */
+bool acme_init(const char *dir_path);
+
+/**
+ * Returns true if acme_init has been called.
+ */
+bool acme_is_enabled();
+
+/**
+ * Creates a non-blocking inotify FD that reports the changes to the challenge
+ * directory, and returns it or a negated errno value. It must be created by
+ * every worker because every worker has its own copy of the table.
+ */
+int acme_watch();
+
+/**
+ * Must be called when the FD returned by acme_watch is readable. It reloads
+ * the table.
+ */
+bool acme_on_watch_event(int fd);
+
+/**
+ * If the path is the one of a challenge that is in the table, copies its
+ * content into the buffer, which must hold ACME_CONTENT_MAX bytes, and sets
+ * its length. Returns false otherwise.
+ */
+bool acme_copy_challenge(const char *path, char *content, size_t *content_len);
+
+/**
+ * Writes the response to the request for a challenge with the content that
+ * was copied by acme_copy_challenge, so that it does not change if the table
+ * is reloaded while it is being sent.
+ */
+size_t acme_write_response(const char *content, size_t content_len, char *buf,
+			   size_t capacity);
+
+#endif
@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <flibc/linux.h>
+#include <flibc/mem.h>
+#include <flibc/str.h>
+#include <flibc/util.h>
+
+#include "backlog.h"
+#include "os.h"
+#include "stats.h"
+#include "sysext.h"
+
+#define BACKLOG_NETSTAT_LEN 16384
+
+static int backlog_fd = -1;
+static uint32_t backlog_initial;
+static uint32_t backlog_max;
+
+/**
+ * Whether this worker samples the queue periodically and grows the backlog.
+ */
+static bool backlog_is_sampler;
+
+/* The time of the last sample, the limit of the queue and the overflow
+   counter that it found, and whether somaxconn prevents the backlog from
+   growing any further. */
+static uint64_t backlog_last_sample;
+static uint32_t backlog_last_limit;
+static uint64_t backlog_overflows;
+static bool backlog_has_overflows;
+static bool backlog_capped;
+
+static char backlog_netstat[BACKLOG_NETSTAT_LEN];
+
+static bool backlog_get_info(struct sysext_tcp_info *info);
+static void backlog_grow(uint32_t limit);
+static bool backlog_read_overflows(uint64_t *overflows);
+static const char *backlog_find_line(const char *cursor, const char *end,
+				     const char *prefix);
+static const char *backlog_token(const char **cursor, const char *end,
+				 size_t *len);
+
+void backlog_init(int server_fd, uint32_t backlog, uint32_t max_backlog)
+{
+	backlog_fd = server_fd;
+	backlog_initial = backlog;
+	backlog_max = max_backlog;
+}
+
+bool backlog_is_enabled() { return backlog_fd != -1; }
+
+void backlog_set_worker(uint32_t worker_index)
+{
+	backlog_is_sampler = worker_index == 0;
+}
+
+bool backlog_listen()
+{
+	uint32_t backlog = backlog_initial;
+
+	struct sysext_tcp_info info;
+	if (backlog_get_info(&info) && info.state == TCP_LISTEN &&
+	    info.sacked > backlog)
+		backlog = info.sacked;
+
+	if (os_listen(backlog_fd, backlog) != 0) {
+		F_PRINT(2, "listen() failed\n");
+		return false;
+	}
+
+	return true;
+}
+
+void backlog_tick(uint64_t now)
+{
+	if (!backlog_is_sampler ||
+	    now - backlog_last_sample < BACKLOG_SAMPLE_INTERVAL)
+		return;
+
+	backlog_last_sample = now;
+	backlog_sample();
+}
+
+void backlog_sample()
+{
+	struct sysext_tcp_info info;
+	if (!backlog_get_info(&info))
+		return;
+
+	stats_set(SC_LISTEN_QUEUE, info.unacked);
+	if (info.unacked > stats_get(SC_LISTEN_QUEUE_PEAK))
+		stats_set(SC_LISTEN_QUEUE_PEAK, info.unacked);
+	stats_set(SC_LISTEN_BACKLOG, info.sacked);
+
+	/* Another worker has already grown the backlog for the overflows that
+	   happened since the last sample. */
+	bool grown = info.sacked > backlog_last_limit;
+	backlog_last_limit = info.sacked;
+
+	uint64_t overflows;
+	if (!backlog_read_overflows(&overflows))
+		return;
+
+	bool overflowed =
+	    backlog_has_overflows && overflows > backlog_overflows;
+	backlog_overflows = overflows;
+	backlog_has_overflows = true;
+	stats_set(SC_LISTEN_OVERFLOWS, overflows);
+
+	if (backlog_is_sampler && overflowed && !grown && !backlog_capped &&
+	    backlog_max > backlog_initial)
+		backlog_grow(info.sacked);
+}
+
+static bool backlog_get_info(struct sysext_tcp_info *info)
+{
+	uint32_t info_len = sizeof(*info);
+	return os_getsockopt(backlog_fd, IPPROTO_TCP, TCP_INFO, info,
+			     &info_len) == 0 &&
+	       info_len >= sizeof(*info);
+}
+
+static void backlog_grow(uint32_t limit)
+{
+	uint64_t backlog = (uint64_t)limit * 2;
+	if (backlog > backlog_max)
+		backlog = backlog_max;
+	if (backlog <= limit)
+		return;
+
+	/* Failing to grow the backlog is not a reason to stop serving
+	   requests. */
+	if (os_listen(backlog_fd, backlog) != 0) {
+		F_PRINT(2, "listen() failed\n");
+		return;
+	}
+
+	/* The kernel silently caps the backlog with somaxconn. */
+	struct sysext_tcp_info info;
+	if (!backlog_get_info(&info))
+		return;
+	if (info.sacked <= limit) {
+		backlog_capped = true;
+		return;
+	}
+
+	backlog_last_limit = info.sacked;
+	stats_set(SC_LISTEN_BACKLOG, info.sacked);
+	stats_inc(SC_LISTEN_GROWTHS);
+}
+
+/**
+ * Reads the ListenOverflows counter of the TcpExt section, which is made of a
+ * line with the names of the counters followed by a line with their values.
+ */
+static bool backlog_read_overflows(uint64_t *overflows)
+{
+	int fd = os_openat(AT_FDCWD, "/proc/net/netstat", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	size_t len = 0;
+	while (len < sizeof(backlog_netstat)) {
+		ssize_t ret = os_read(fd, backlog_netstat + len,
+				      sizeof(backlog_netstat) - len);
+		if (ret <= 0)
+			break;
+		len += ret;
+	}
+	os_close(fd);
+
+	const char *end = backlog_netstat + len;
+	const char *names = backlog_find_line(backlog_netstat, end, "TcpExt:");
+	if (names == NULL)
+		return false;
+	const char *values = backlog_find_line(names + 1, end, "TcpExt:");
+	if (values == NULL)
+		return false;
+
+	for (;;) {
+		size_t name_len;
+		const char *name = backlog_token(&names, end, &name_len);
+		size_t value_len;
+		const char *value = backlog_token(&values, end, &value_len);
+		if (name_len == 0 || value_len == 0)
+			return false;
+
+		if (name_len != strlen("ListenOverflows") ||
+		    memcmp(name, "ListenOverflows", name_len) != 0)
+			continue;
+
+		*overflows = 0;
+		for (size_t i = 0; i < value_len; i++) {
+			if (value[i] < '0' || value[i] > '9')
+				return false;
+			*overflows = *overflows * 10 + (value[i] - '0');
+		}
+
+		return true;
+	}
+}
+
+/* Returns the first line from the cursor that starts with the prefix, or NULL
+   if there is none. */
+static const char *backlog_find_line(const char *cursor, const char *end,
+				     const char *prefix)
+{
+	size_t prefix_len = strlen(prefix);
+
+	while (cursor < end) {
+		if ((size_t)(end - cursor) >= prefix_len &&
+		    memcmp(cursor, prefix, prefix_len) == 0)
+			return cursor;
+
+		while (cursor < end && *cursor != '\n')
+			++cursor;
+		++cursor;
+	}
+
+	return NULL;
+}
+
+/* Skips the spaces and the token at the cursor, without going past the end of
+   the line, and returns the start of the token and its length, which is 0 at
+   the end of the line. */
+static const char *backlog_token(const char **cursor, const char *end,
+				 size_t *len)
+{
+	while (*cursor < end && **cursor == ' ')
+		++*cursor;
+
+	const char *token = *cursor;
+	while (*cursor < end && **cursor != ' ' && **cursor != '\n')
+		++*cursor;
+
+	*len = *cursor - token;
+	return token;
+}
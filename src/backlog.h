@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP2SD_BACKLOG_H
+#define HTTP2SD_BACKLOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Watches the accept queue of the TCP server socket. The first worker, which
+ * never retires, samples the length of the queue and its limit with TCP_INFO,
+ * and the ListenOverflows counter of /proc/net/netstat, into its statistics
+ * once per BACKLOG_SAMPLE_INTERVAL. The other workers only sample them when
+ * their statistics are dumped. The kernel does not count the overflows per
+ * socket, so that counter covers every listening socket of the network
+ * namespace.
+ *
+ * When a maximum backlog is given, the first worker doubles the backlog of the
+ * socket up to that maximum when it sees the overflow counter increase, by
+ * calling listen again, which only changes the limit of a socket that is
+ * already listening. The kernel caps it with the net.core.somaxconn sysctl.
+ */
+
+/* The minimum amount of time between two samples, in milliseconds. */
+#define BACKLOG_SAMPLE_INTERVAL 1000
+
+/**
+ * Sets the server socket and the initial and maximum backlogs. The backlog is
+ * never grown if the maximum is not above the initial backlog.
+ */
+void backlog_init(int server_fd, uint32_t backlog, uint32_t max_backlog);
+
+bool backlog_is_enabled();
+
+/**
+ * Sets the index of the current worker. Only the first one samples the queue
+ * periodically.
+ */
+void backlog_set_worker(uint32_t worker_index);
+
+/**
+ * Starts listening on the server socket, or keeps the backlog that it has if
+ * it is already listening with a larger one, so that the workers that are
+ * added under load do not undo the growth.
+ */
+bool backlog_listen();
+
+/**
+ * Samples the accept queue if this is the first worker and if the last sample
+ * is older than BACKLOG_SAMPLE_INTERVAL, and grows the backlog if needed. The
+ * time is in milliseconds.
+ */
+void backlog_tick(uint64_t now);
+
+/**
+ * Samples the accept queue right away, for example before the statistics are
+ * dumped.
+ */
+void backlog_sample();
+
+#endif
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <flibc/linux.h>
+#include <flibc/mem.h>
+#include <flibc/util.h>
+
+#include "capture.h"
+#include "os.h"
+#include "sysext.h"
+
+#define CAPTURE_BUF_LEN 65536
+
+/* The file is shared by the workers and opened with O_APPEND, so that every
+   write of a buffer lands at the end as a whole. */
+static int capture_fd = -1;
+static uint32_t capture_sample;
+
+/* The amount of connections since the last one that was captured by this
+   worker, and the last conn number, which is shared by the workers so that
+   the numbers are unique even when a retired worker is replaced. */
+static uint32_t capture_counter;
+static uint32_t *capture_last_conn;
+
+/* The records that have not been written yet, and the time of the oldest
+   one. */
+static char capture_buf[CAPTURE_BUF_LEN];
+static size_t capture_len;
+static uint64_t capture_oldest;
+
+static uint64_t capture_now();
+
+bool capture_init(const char *path, uint32_t sample)
+{
+	capture_fd = sysext_openat(AT_FDCWD, path,
+				   O_WRONLY | O_CREAT | O_TRUNC | O_APPEND |
+				       O_CLOEXEC,
+				   0640);
+	if (capture_fd < 0) {
+		F_PRINT(2, "open() failed for the capture file\n");
+		return false;
+	}
+
+	uint64_t magic = CAPTURE_MAGIC;
+	if (sys_write(capture_fd, &magic, sizeof(magic)) != sizeof(magic)) {
+		F_PRINT(2, "write() failed for the capture file\n");
+		return false;
+	}
+	capture_sample = sample;
+
+	capture_last_conn = sysext_mmap(NULL, sizeof(*capture_last_conn),
+					PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (SYSEXT_IS_ERR(capture_last_conn)) {
+		F_PRINT(2, "mmap() failed\n");
+		return false;
+	}
+
+	return true;
+}
+
+bool capture_is_enabled() { return capture_fd != -1; }
+
+uint32_t capture_begin()
+{
+	if (++capture_counter < capture_sample)
+		return 0;
+	capture_counter = 0;
+
+	/* 0 means that the connection is not captured. */
+	uint32_t conn;
+	do {
+		conn = __atomic_add_fetch(capture_last_conn, 1,
+					  __ATOMIC_RELAXED);
+	} while (conn == 0);
+
+	return conn;
+}
+
+void capture_chunk(uint32_t conn, const char *data, size_t len)
+{
+	struct capture_record record;
+	record.time = capture_now();
+	record.conn = conn;
+	record.len = len;
+
+	if (CAPTURE_BUF_LEN - capture_len < sizeof(record) + len)
+		capture_flush();
+	if (capture_len == 0)
+		capture_oldest = record.time;
+
+	memcpy(capture_buf + capture_len, &record, sizeof(record));
+	memcpy(capture_buf + capture_len + sizeof(record), data, len);
+	capture_len += sizeof(record) + len;
+}
+
+bool capture_tick()
+{
+	if (capture_len == 0)
+		return false;
+
+	if (capture_now() - capture_oldest >= CAPTURE_FLUSH_DELAY * 1000)
+		capture_flush();
+
+	return capture_len != 0;
+}
+
+void capture_flush()
+{
+	if (capture_len == 0)
+		return;
+
+	/* The records are lost if the write fails, which is better than
+	   stopping the server for a diagnostic. */
+	os_write(capture_fd, capture_buf, capture_len);
+	capture_len = 0;
+}
+
+static uint64_t capture_now()
+{
+	/* This does not enter the kernel when the vDSO is available. */
+	struct timespec ts;
+	if (os_clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		return 0;
+
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP2SD_CAPTURE_H
+#define HTTP2SD_CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The capture file starts with CAPTURE_MAGIC and is followed by records, each
+ * of which is a struct capture_record and the bytes of one chunk of a request,
+ * as it was given to conn_recv. The chunks of a connection share the same
+ * conn number, which is unique in the file. The records of a worker are in
+ * chronological order, but the workers write them in batches, so the records
+ * of different workers are interleaved in blocks.
+ */
+
+/* "H2SDCAP1" read as a little-endian integer. */
+#define CAPTURE_MAGIC 0x3150414344533248ULL
+
+/* The maximum amount of time that a record stays in the buffer of a worker
+   before it is written, in milliseconds. */
+#define CAPTURE_FLUSH_DELAY 1000
+
+struct capture_record {
+	/* CLOCK_MONOTONIC, in microseconds. */
+	uint64_t time;
+	uint32_t conn;
+	uint32_t len;
+};
+
+_Static_assert(sizeof(struct capture_record) == 16,
+	       "the capture records must not have padding");
+
+/**
+ * Creates the capture file and writes its header. One in every sample
+ * connections is captured. This must be called before the workers are created
+ * because they share the file.
+ */
+bool capture_init(const char *path, uint32_t sample);
+
+bool capture_is_enabled();
+
+/**
+ * Decides whether a new connection is captured, and returns the conn number
+ * of its records if so or 0 otherwise.
+ */
+uint32_t capture_begin();
+
+/**
+ * Records a chunk of the request of a connection. It is buffered and only
+ * written when the buffer is full or when capture_tick or capture_flush is
+ * called.
+ */
+void capture_chunk(uint32_t conn, const char *data, size_t len);
+
+/**
+ * Writes the buffered records if the oldest one is older than
+ * CAPTURE_FLUSH_DELAY, and returns true if records are still buffered, in
+ * which case it must be called again within CAPTURE_FLUSH_DELAY.
+ */
+bool capture_tick();
+
+/**
+ * Writes the buffered records, for when the worker stops.
+ */
+void capture_flush();
+
+#endif
@@ -27,6 +27,12 @@ static bool cli_print_usage(int fd, const char *arg0);
 static void cli_print_arg_out_of_range(const char *arg, const char *arg0);
 static bool cli_parse_num(uint32_t *result, uint32_t min, uint32_t max,
 			  const char *arg, const char *arg0);
+static bool cli_parse_path(const char **result, const char *arg,
+			   const char *arg0);
+static bool cli_parse_mode(uint32_t *result, const char *arg,
+			   const char *arg0);
+static bool cli_parse_close_strategy(enum cli_close_strategy *result,
+				     const char *arg, const char *arg0);
 
 enum cli_parse_result cli_parse_args(struct cli_options *options,
 				     char **argv)
@@ -46,18 +52,107 @@ enum cli_parse_result cli_parse_args(struct cli_options *options,
 					   argv[1], arg0))
 				return CPR_ERROR;
 			++argv;
+		} else if (strcmp(*argv, "--no-tcp") == 0) {
+			options->tcp = false;
+		} else if (strcmp(*argv, "--unix-socket") == 0) {
+			if (!cli_parse_path(&options->unix_socket_path, argv[1],
+					    arg0))
+				return CPR_ERROR;
+			++argv;
+		} else if (strcmp(*argv, "--unix-socket-mode") == 0) {
+			if (!cli_parse_mode(&options->unix_socket_mode, argv[1],
+					    arg0))
+				return CPR_ERROR;
+			++argv;
 		} else if (strcmp(*argv, "-t") == 0 ||
 			   strcmp(*argv, "--threads") == 0) {
 			if (!cli_parse_num(&options->threads, 1, 256, argv[1],
 					   arg0))
 				return CPR_ERROR;
 			++argv;
+		} else if (strcmp(*argv, "--max-threads") == 0) {
+			if (!cli_parse_num(&options->max_threads, 1, 256,
+					   argv[1], arg0))
+				return CPR_ERROR;
+			++argv;
 		} else if (strcmp(*argv, "-b") == 0 ||
 			   strcmp(*argv, "--backlog") == 0) {
 			if (!cli_parse_num(&options->socket_backlog, 1, INT_MAX,
 					   argv[1], arg0))
 				return CPR_ERROR;
 			++argv;
+		} else if (strcmp(*argv, "--max-backlog") == 0) {
+			if (!cli_parse_num(&options->max_socket_backlog, 1,
+					   INT_MAX, argv[1], arg0))
+				return CPR_ERROR;
+			++argv;
+		} else if (strcmp(*argv, "--access-log") == 0) {
+			if (!cli_parse_path(&options->access_log_path, argv[1],
+					    arg0))
+				return CPR_ERROR;
+			++argv;
+		} else if (strcmp(*argv, "--access-log-wait") == 0) {
+			options->access_log_wait = true;
+		} else if (strcmp(*argv, "--rate-limit") == 0) {
+			if (!cli_parse_num(&options->rate_limit, 1, UINT32_MAX,
+					   argv[1], arg0))
+				return CPR_ERROR;
+			++argv;
+		} else if (strcmp(*argv, "--rate-limit-burst") == 0) {
+			if (!cli_parse_num(&options->rate_limit_burst, 1,
+					   1000000, argv[1], arg0))
+				return CPR_ERROR;
+			++argv;
+		} else if (strcmp(*argv, "--busy-poll") == 0) {
+			if (!cli_parse_num(&options->busy_poll, 1, 1000000,
+					   argv[1], arg0))
+				return CPR_ERROR;
+			++argv;
+		} else if (strcmp(*argv, "--rx-timestamps") == 0) {
+			options->rx_timestamps = true;
+		} else if (strcmp(*argv, "--close") == 0) {
+			if (!cli_parse_close_strategy(&options->close_strategy,
+						      argv[1], arg0))
+				return CPR_ERROR;
+			++argv;
+		} else if (strcmp(*argv, "--linger") == 0) {
+			if (!cli_parse_num(&options->linger, 1, 60000, argv[1],
+					   arg0))
+				return CPR_ERROR;
+			++argv;
+		} else if (strcmp(*argv, "--acme-dir") == 0) {
+			if (!cli_parse_path(&options->acme_dir, argv[1], arg0))
+				return CPR_ERROR;
+			++argv;
+		} else if (strcmp(*argv, "--allow-hosts") == 0) {
+			if (!cli_parse_path(&options->allow_hosts_path, argv[1],
+					    arg0))
+				return CPR_ERROR;
+			++argv;
+		} else if (strcmp(*argv, "--subnet-targets") == 0) {
+			if (!cli_parse_path(&options->subnet_targets_path,
+					    argv[1], arg0))
+				return CPR_ERROR;
+			++argv;
+		} else if (strcmp(*argv, "--health-path") == 0) {
+			if (!cli_parse_path(&options->health_path, argv[1],
+					    arg0))
+				return CPR_ERROR;
+			++argv;
+		} else if (strcmp(*argv, "--capture") == 0) {
+			if (!cli_parse_path(&options->capture_path, argv[1],
+					    arg0))
+				return CPR_ERROR;
+			++argv;
+		} else if (strcmp(*argv, "--capture-sample") == 0) {
+			if (!cli_parse_num(&options->capture_sample, 1,
+					   UINT32_MAX, argv[1], arg0))
+				return CPR_ERROR;
+			++argv;
+		} else if (strcmp(*argv, "--coarse-clock") == 0) {
+			options->coarse_clock = true;
+		} else if (strcmp(*argv, "--perf-counters") == 0) {
+			options->perf_counters = true;
 		} else if (strcmp(*argv, "--") == 0) {
 			/* Make sure that there is nothing after the double
 			   hyphen because we do not accept any argument. */
@@ -86,11 +181,52 @@ static bool cli_print_usage(int fd, const char *arg0)
 		   "the same URL but with the HTTPS scheme instead, and drops "
 		   "invalid requests.\n\n"
 		   "  -p, --port=PORT       set port to start listening on\n"
+		   "      --no-tcp          do not listen on a TCP port\n"
+		   "      --unix-socket=PATH also listen on a Unix socket at "
+		   "PATH\n"
+		   "      --unix-socket-mode=MODE set the permissions of the "
+		   "Unix socket in octal (defaults to 660)\n"
 		   "  -t, --threads=THREADS set amount of threads to use to "
 		   "handle requests\n"
+		   "      --max-threads=MAX add threads up to MAX under load "
+		   "and remove them when idle\n"
 		   "  -b, --backlog=BACKLOG set maximum amount of connections "
 		   "waiting to "
 		   "be accepted\n"
+		   "      --max-backlog=MAX double the backlog up to MAX when "
+		   "the queue overflows\n"
+		   "      --coarse-clock    use a faster but less precise "
+		   "clock for timeouts\n"
+		   "      --perf-counters   count CPU cycles, instructions and "
+		   "misses per request\n"
+		   "      --access-log=FILE log requests to FILE, or to the "
+		   "standard output if FILE is -\n"
+		   "      --access-log-wait wait up to 1 ms instead of "
+		   "dropping log records when the logger is late\n"
+		   "      --rate-limit=RATE limit every client address to RATE "
+		   "new connections per second\n"
+		   "      --rate-limit-burst=BURST allow bursts of BURST "
+		   "connections (defaults to RATE)\n"
+		   "      --busy-poll=USEC  poll for events for USEC "
+		   "microseconds before sleeping\n"
+		   "      --rx-timestamps   measure how long the requests "
+		   "wait in the kernel\n"
+		   "      --close=STRATEGY  close connections with STRATEGY: "
+		   "close (default), drain, wait-fin or abort\n"
+		   "      --linger=MS       wait at most MS milliseconds for "
+		   "the client to close with drain and wait-fin\n"
+		   "      --acme-dir=DIR    answer the ACME http-01 challenges "
+		   "that are in DIR\n"
+		   "      --allow-hosts=FILE only redirect the hosts listed in "
+		   "FILE\n"
+		   "      --subnet-targets=FILE redirect the clients to the "
+		   "host of their subnet in FILE\n"
+		   "      --health-path=PATH answer the health checks for PATH "
+		   "with 200 or 503 under load\n"
+		   "      --capture=FILE    capture the requests as they are "
+		   "received into FILE\n"
+		   "      --capture-sample=N only capture one in N "
+		   "connections\n"
 		   "  -h, --help       display this help and exit\n");
 }
 
@@ -142,3 +278,86 @@ static bool cli_parse_num(uint32_t *result, uint32_t min, uint32_t max,
 
 	return true;
 }
+
+static bool cli_parse_path(const char **result, const char *arg,
+			   const char *arg0)
+{
+	if (arg == NULL || *arg == '\0') {
+		if (!F_PRINT(2, arg0) ||
+		    !F_PRINT(2, ": missing path for argument\n"))
+			return false;
+
+		return false;
+	}
+
+	*result = arg;
+	return true;
+}
+
+static bool cli_parse_mode(uint32_t *result, const char *arg,
+			   const char *arg0)
+{
+	if (arg == NULL) {
+		if (!F_PRINT(2, arg0) ||
+		    !F_PRINT(2, ": missing mode for argument\n"))
+			return false;
+
+		return false;
+	}
+
+	*result = 0;
+
+	const char *digit = arg;
+	for (; *digit != '\0'; ++digit) {
+		if (*digit < '0' || *digit > '7' || *result > 0777) {
+			if (!F_PRINT(2, arg0) ||
+			    !F_PRINT(2, ": invalid mode: ") ||
+			    !F_PRINT(2, arg) || !F_PRINT(2, "\n"))
+				return false;
+
+			return false;
+		}
+
+		*result = *result * 8 + (*digit - '0');
+	}
+
+	if (digit == arg || *result > 0777) {
+		if (!F_PRINT(2, arg0) || !F_PRINT(2, ": invalid mode: ") ||
+		    !F_PRINT(2, arg) || !F_PRINT(2, "\n"))
+			return false;
+
+		return false;
+	}
+
+	return true;
+}
+
+static bool cli_parse_close_strategy(enum cli_close_strategy *result,
+				     const char *arg, const char *arg0)
+{
+	if (arg == NULL) {
+		if (!F_PRINT(2, arg0) ||
+		    !F_PRINT(2, ": missing strategy for argument\n"))
+			return false;
+
+		return false;
+	}
+
+	if (strcmp(arg, "close") == 0) {
+		*result = CCS_CLOSE;
+	} else if (strcmp(arg, "drain") == 0) {
+		*result = CCS_DRAIN;
+	} else if (strcmp(arg, "wait-fin") == 0) {
+		*result = CCS_WAIT_FIN;
+	} else if (strcmp(arg, "abort") == 0) {
+		*result = CCS_ABORT;
+	} else {
+		if (!F_PRINT(2, arg0) || !F_PRINT(2, ": invalid strategy: ") ||
+		    !F_PRINT(2, arg) || !F_PRINT(2, "\n"))
+			return false;
+
+		return false;
+	}
+
+	return true;
+}
@@ -18,12 +18,165 @@
 #ifndef HTTP2SD_CLI_H
 #define HTTP2SD_CLI_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
+/**
+ * How a connection is closed after its response has been sent.
+ */
+enum cli_close_strategy {
+	/**
+	 * Close the socket right away. If the client has sent more data than
+	 * what has been read, the kernel resets the connection, and the
+	 * server ends up with the TIME_WAIT state.
+	 */
+	CCS_CLOSE,
+
+	/**
+	 * Shut down the writing half of the socket, then read and discard
+	 * what the client sends until it closes the connection, for a limited
+	 * time and amount of bytes.
+	 */
+	CCS_DRAIN,
+
+	/**
+	 * Like CCS_DRAIN but without shutting down the writing half, so that
+	 * the client closes the connection first and keeps the TIME_WAIT
+	 * state.
+	 */
+	CCS_WAIT_FIN,
+
+	/**
+	 * Reset the connection with SO_LINGER set to 0, which does not leave
+	 * any TIME_WAIT state but might make the client lose the response.
+	 */
+	CCS_ABORT,
+};
+
 struct cli_options {
 	uint32_t server_port;
+
+	/**
+	 * Listen on the TCP port. It can only be disabled when a Unix socket is
+	 * given.
+	 */
+	bool tcp;
+
+	/**
+	 * The path of a Unix stream socket to listen on alongside or instead of
+	 * the TCP port, for a local proxy, or NULL to disable it, and the
+	 * permissions of its file.
+	 */
+	const char *unix_socket_path;
+	uint32_t unix_socket_mode;
+
 	uint32_t threads;
+
+	/**
+	 * The maximum amount of workers when it is more than threads, in which
+	 * case threads is the minimum and workers are added and removed
+	 * depending on the load.
+	 */
+	uint32_t max_threads;
 	uint32_t socket_backlog;
+
+	/**
+	 * The backlog up to which the backlog of the TCP server socket is
+	 * doubled when connections overflow the accept queue. It is not grown
+	 * if this is not above socket_backlog.
+	 */
+	uint32_t max_socket_backlog;
+
+	/**
+	 * Use CLOCK_MONOTONIC_COARSE instead of CLOCK_MONOTONIC for the
+	 * timeouts. It is cheaper to read but only has a resolution of a few
+	 * milliseconds.
+	 */
+	bool coarse_clock;
+
+	/**
+	 * Count the CPU cycles, instructions, cache misses and branch misses of
+	 * every worker with the hardware counters.
+	 */
+	bool perf_counters;
+
+	/**
+	 * The file where requests are logged, "-" for the standard output or
+	 * NULL to disable the access log.
+	 */
+	const char *access_log_path;
+
+	/**
+	 * Wait for the logger for a short while instead of dropping records
+	 * right away when a worker's ring is full.
+	 */
+	bool access_log_wait;
+
+	/**
+	 * The maximum amount of new connections per second per client address,
+	 * or 0 to disable rate limiting.
+	 */
+	uint32_t rate_limit;
+
+	/**
+	 * The amount of connections that a client can open at once before the
+	 * rate limit applies, or 0 to use the rate limit.
+	 */
+	uint32_t rate_limit_burst;
+
+	/**
+	 * How long to poll for new events without sleeping before blocking in
+	 * epoll_wait, in microseconds, or 0 to always block.
+	 */
+	uint32_t busy_poll;
+
+	/**
+	 * Ask the kernel to timestamp the packets that it receives, and
+	 * measure how long the first bytes of every request wait before the
+	 * worker reads them.
+	 */
+	bool rx_timestamps;
+
+	enum cli_close_strategy close_strategy;
+
+	/**
+	 * How long to wait for the client to close the connection with the
+	 * CCS_DRAIN and CCS_WAIT_FIN strategies, in milliseconds.
+	 */
+	uint32_t linger;
+
+	/**
+	 * The directory where the ACME client writes the http-01 challenges,
+	 * or NULL to redirect their requests like the others.
+	 */
+	const char *acme_dir;
+
+	/**
+	 * The file that lists the hosts to redirect, or NULL to redirect every
+	 * host.
+	 */
+	const char *allow_hosts_path;
+
+	/**
+	 * The file that maps the client subnets to the hosts that their
+	 * requests are redirected to, or NULL to redirect them to their own
+	 * host.
+	 */
+	const char *subnet_targets_path;
+
+	/**
+	 * The path of the health checks of the load balancers, or NULL to
+	 * redirect their requests like the others.
+	 */
+	const char *health_path;
+
+	/**
+	 * The file where the requests are captured as they are received, or
+	 * NULL to disable the capture, and the ratio of connections that are
+	 * captured (one in capture_sample).
+	 */
+	const char *capture_path;
+	uint32_t capture_sample;
 };
 
 enum cli_parse_result {
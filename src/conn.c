@@ -21,86 +21,204 @@
 #include <flibc/mem.h>
 #include <flibc/util.h>
 
+#include "acme.h"
+#include "capture.h"
 #include "conn.h"
+#include "health.h"
+#include "hostlist.h"
+#include "hostnorm.h"
+#include "netaddr.h"
+#include "os.h"
+#include "probe.h"
 #include "reqparser.h"
+#include "stats.h"
+#include "subnet.h"
 #include "tmp.h"
 
-/* If this becomes greater than 32, then the uint32_t type that is used
-   throughout the code needs to be changed. */
-#define MAX_CONN_COUNT 27
+#ifndef HTTP2SD_MAX_CONN_COUNT
+#	define HTTP2SD_MAX_CONN_COUNT 27
+#endif
+
+#define MAX_CONN_COUNT HTTP2SD_MAX_CONN_COUNT
+
+/* The amount of 64-bit words in the bitmap of valid connections. */
+#define CONN_BITMAP_WORDS ((MAX_CONN_COUNT + 63) / 64)
+
+#define CONN_REQ_FIELDS_LEN 256
 
 /**
  * Custom reqparser_state for RC_BUFFER_TOO_SMALL error, so that we don't need
- * another field in the conn struct.
+ * another field in the conn_state struct.
  */
 #define REQPARSER_CUSTOM_ERR 15
 
 /**
- * Includes the state about a socket connection to the HTTP server socket. Note
- * that the size of this struct is precisely 256 bytes.
+ * Custom reqparser_state for a complete request for an ACME challenge that is
+ * answered instead of being redirected.
  */
-struct conn {
-	/**
-	 * If we haven't received a valid request after the timeout, we will
-	 * close the socket and free the client object.
-	 * This is to prevent potential badly behaving clients that would open
-	 * a connection to the server, not send anything (or not finish the
-	 * request) and never close the connection from taking up space and
-	 * preventing other good clients from connecting.
-	 */
-	uint64_t timeout;
+#define REQPARSER_CUSTOM_ACME 14
+
+/**
+ * Custom reqparser_state for a complete request for a host that is not in the
+ * host list.
+ */
+#define REQPARSER_CUSTOM_REJECT 13
+
+/**
+ * Custom reqparser_states for a health check, which is answered as soon as its
+ * request line has been parsed, with a 200 or a 503 depending on the state of
+ * the worker at that time.
+ */
+#define REQPARSER_CUSTOM_HEALTHY 12
+#define REQPARSER_CUSTOM_UNHEALTHY 11
+
+/*
+ * The state of the connections is split into arrays indexed by the connection
+ * ID. The event loop goes through the timeouts of every connection on every
+ * iteration and looks at the socket FD and the state on every event, so these
+ * are kept in small dense arrays that stay in the L1 cache even with many
+ * connections. The request fields are only touched by the parser and when
+ * writing the response, so they are kept in a separate cold area.
+ */
+
+/**
+ * If we haven't received a valid request after the timeout, we will close the
+ * socket and free the client object.
+ * This is to prevent potential badly behaving clients that would open a
+ * connection to the server, not send anything (or not finish the request) and
+ * never close the connection from taking up space and preventing other good
+ * clients from connecting.
+ */
+static uint64_t conn_timeouts[MAX_CONN_COUNT];
+
+static int conn_socket_fds[MAX_CONN_COUNT];
 
-	int socket_fd;
+enum conn_phase {
+	CP_REQUEST,
+	CP_RESPONSE,
+	CP_LINGER,
+};
 
+struct conn_state {
 	/**
 	 * The write syscall might not write the whole buffer but only a part of
 	 * it, therefore we must keep track of how many bytes we have already
-	 * sent in order to know what to send the next time we get a EPOLLIN
+	 * sent in order to know what to send the next time we get a EPOLLOUT
 	 * event.
 	 */
-	uint16_t res_bytes_sent : 12;
-
-	uint8_t reqparser_state : 4;
+	uint16_t res_bytes_sent : 10;
 
 	/**
-	 * At the end of the parsing, this will contain the request URI, then
-	 * a NULL character, then the request host, then a NULL character or
-	 * no character if it's the end of the array.
+	 * A value of enum conn_phase. The socket is registered for both EPOLLIN
+	 * and EPOLLOUT for its whole life, so we need this to know which events
+	 * matter.
 	 */
-	char req_fields[242];
+	uint8_t phase : 2;
+
+	uint8_t reqparser_state : 4;
 };
 
-static struct conn connections[MAX_CONN_COUNT];
+_Static_assert(sizeof(struct conn_state) == 2,
+	       "the connection state must fit in 2 bytes");
+
+/* The responses are made of the request fields and less than a hundred bytes
+   of headers, and their length must fit in res_bytes_sent. */
+_Static_assert(CONN_REQ_FIELDS_LEN + 128 < 1 << 10 &&
+		   ACME_CONTENT_MAX + 128 < 1 << 10,
+	       "the responses must fit in res_bytes_sent");
+
+static struct conn_state conn_states[MAX_CONN_COUNT];
+
+/**
+ * At the end of the parsing, this will contain the request URI, then a NULL
+ * character, then the request host, then a NULL character or no character if
+ * it's the end of the array.
+ */
+static char conn_req_fields[MAX_CONN_COUNT][CONN_REQ_FIELDS_LEN];
+
+/**
+ * The clients' addresses, for logging and for the targets of their subnets.
+ */
+static struct netaddr conn_peer_addrs[MAX_CONN_COUNT];
+
+/**
+ * The amount of bytes that have been discarded after the response, while
+ * waiting for the client to close the connection.
+ */
+static uint32_t conn_drained_bytes[MAX_CONN_COUNT];
+
+/**
+ * The amount of bytes of the request that have been received, which is
+ * limited so that a client cannot keep the parser busy with endless headers
+ * until its timeout.
+ */
+static uint16_t conn_request_bytes[MAX_CONN_COUNT];
+
+/**
+ * The length of the host that the request is redirected to instead of its own,
+ * which is stored at the end of the request fields, or 0 if there is none.
+ */
+static uint8_t conn_target_lens[MAX_CONN_COUNT];
+
+/**
+ * The content of the ACME challenge that is answered and its length, which
+ * are copied when the request completes because the table can be reloaded
+ * before the response is written. They are only set for the requests whose
+ * state is REQPARSER_CUSTOM_ACME.
+ */
+static char conn_acme_contents[MAX_CONN_COUNT][ACME_CONTENT_MAX];
+static uint16_t conn_acme_content_lens[MAX_CONN_COUNT];
+
+/**
+ * The conn number of the records of the connections that are captured, or 0
+ * for the others.
+ */
+static uint32_t conn_capture_conns[MAX_CONN_COUNT];
+
+_Static_assert(CONN_MAX_REQUEST_BYTES + sizeof(tmp_buf) <= UINT16_MAX,
+	       "the request size must fit in conn_request_bytes");
 
 /**
  * For every connections info object that is currently valid (between a conn_new
  * and conn_free), a bit at the index of the ID is set in this bitmap.
  */
-static uint32_t connections_bitmap;
+static uint64_t conn_bitmap[CONN_BITMAP_WORDS];
+
+/**
+ * The connections marked by conn_set_pending, with the same layout.
+ */
+static uint64_t conn_pending_bitmap[CONN_BITMAP_WORDS];
 
-static bool conn_is_valid(int id);
+static int conn_count;
 
+static const char *conn_get_host(int id, size_t *len);
+static bool conn_normalize_host(int id);
+static bool conn_set_target(int id, const char *target, size_t len);
 static size_t conn_write_redirect_response(int id, char *buf, size_t capacity);
 static size_t conn_write_too_long_response(char *buf, size_t capacity);
+static size_t conn_write_reject_response(char *buf, size_t capacity);
 
-bool conn_is_full()
-{
-	for (int id = 0; id < MAX_CONN_COUNT; id++) {
-		if (!conn_is_valid(id))
-			return false;
-	}
+bool conn_is_full() { return conn_count == MAX_CONN_COUNT; }
 
-	return true;
-}
+uint32_t conn_get_count() { return conn_count; }
+
+uint32_t conn_get_capacity() { return MAX_CONN_COUNT; }
 
 int conn_new(int socket_fd)
 {
-	for (int id = 0; id < MAX_CONN_COUNT; id++) {
-		/* Check if that index is already used. */
-		if (conn_is_valid(id))
+	for (int word = 0; word < CONN_BITMAP_WORDS; word++) {
+		/* Check if there is an unused index in that word. */
+		uint64_t free_bits = ~conn_bitmap[word];
+		if (free_bits == 0)
 			continue;
-		connections_bitmap |= (1 << id);
-		connections[id].socket_fd = socket_fd;
+
+		int id = word * 64 + __builtin_ctzll(free_bits);
+		if (id >= MAX_CONN_COUNT)
+			break;
+
+		conn_bitmap[word] |= 1ULL << (id % 64);
+		conn_count++;
+		conn_socket_fds[id] = socket_fd;
 		return id;
 	}
 
@@ -109,54 +227,219 @@ int conn_new(int socket_fd)
 
 void conn_free(int index)
 {
-	connections_bitmap &= ~(1 << index);
+	conn_bitmap[index / 64] &= ~(1ULL << (index % 64));
+	conn_pending_bitmap[index / 64] &= ~(1ULL << (index % 64));
+	conn_count--;
 
 	/* Reset the fields for later, if the index gets reused. */
-	struct conn *c = &connections[index];
-	c->res_bytes_sent = 0;
-	c->reqparser_state = 0;
-	memset(c->req_fields, 0, sizeof(c->req_fields));
+	struct conn_state *state = &conn_states[index];
+	state->res_bytes_sent = 0;
+	state->phase = CP_REQUEST;
+	state->reqparser_state = 0;
+	conn_drained_bytes[index] = 0;
+	conn_request_bytes[index] = 0;
+	conn_capture_conns[index] = 0;
+	conn_target_lens[index] = 0;
+	conn_acme_content_lens[index] = 0;
+	memset(conn_req_fields[index], 0, CONN_REQ_FIELDS_LEN);
 }
 
 void conn_for_each(void (*cb)(int))
 {
-	for (int id = 0; id < MAX_CONN_COUNT; id++) {
-		if (conn_is_valid(id))
-			cb(id);
+	for (int word = 0; word < CONN_BITMAP_WORDS; word++) {
+		/* Iterate over a copy because the callback may free the
+		   connection. */
+		uint64_t bits = conn_bitmap[word];
+		while (bits != 0) {
+			int bit = __builtin_ctzll(bits);
+			bits &= bits - 1;
+			cb(word * 64 + bit);
+		}
 	}
 }
 
-int conn_get_socket_fd(int id) { return connections[id].socket_fd; }
+int conn_get_socket_fd(int id) { return conn_socket_fds[id]; }
 
-void conn_set_timeout(int id, uint64_t timeout)
+void conn_set_pending(int id, bool pending)
 {
-	connections[id].timeout = timeout;
+	if (pending)
+		conn_pending_bitmap[id / 64] |= 1ULL << (id % 64);
+	else
+		conn_pending_bitmap[id / 64] &= ~(1ULL << (id % 64));
 }
 
-uint64_t conn_get_timeout(int id) { return connections[id].timeout; }
+bool conn_has_pending()
+{
+	for (int word = 0; word < CONN_BITMAP_WORDS; word++) {
+		if (conn_pending_bitmap[word] != 0)
+			return true;
+	}
+
+	return false;
+}
+
+void conn_for_each_pending(void (*cb)(int))
+{
+	for (int word = 0; word < CONN_BITMAP_WORDS; word++) {
+		/* Iterate over a copy because the callback may mark the
+		   connection again, and it must not be called twice. */
+		uint64_t bits = conn_pending_bitmap[word];
+		while (bits != 0) {
+			int bit = __builtin_ctzll(bits);
+			bits &= bits - 1;
+			cb(word * 64 + bit);
+		}
+	}
+}
+
+void conn_set_timeout(int id, uint64_t timeout) { conn_timeouts[id] = timeout; }
+
+uint64_t conn_get_timeout(int id) { return conn_timeouts[id]; }
+
+void conn_set_peer_addr(int id, const struct netaddr *addr)
+{
+	conn_peer_addrs[id] = *addr;
+}
+
+const struct netaddr *conn_get_peer_addr(int id)
+{
+	return &conn_peer_addrs[id];
+}
+
+bool conn_has_received(int id) { return conn_request_bytes[id] != 0; }
+
+bool conn_is_responding(int id)
+{
+	return conn_states[id].phase == CP_RESPONSE;
+}
+
+bool conn_is_lingering(int id) { return conn_states[id].phase == CP_LINGER; }
+
+void conn_start_lingering(int id) { conn_states[id].phase = CP_LINGER; }
+
+uint32_t conn_add_drained(int id, uint32_t bytes)
+{
+	conn_drained_bytes[id] += bytes;
+	return conn_drained_bytes[id];
+}
 
 enum conn_wants_more conn_recv(int id, const char *data, size_t len)
 {
-	struct conn *c = &connections[id];
+	struct conn_state *state = &conn_states[id];
+
+	if (capture_is_enabled()) {
+		if (conn_request_bytes[id] == 0)
+			conn_capture_conns[id] = capture_begin();
+		if (conn_capture_conns[id] != 0)
+			capture_chunk(conn_capture_conns[id], data, len);
+	}
+
+	conn_request_bytes[id] += len;
+	if (conn_request_bytes[id] > CONN_MAX_REQUEST_BYTES) {
+		stats_inc(SC_REQUESTS_TOO_LARGE);
+		return CWM_ERROR;
+	}
+
+	uint8_t old_state = state->reqparser_state;
 
 	struct reqparser_args args;
-	args.state = c->reqparser_state;
+	args.state = state->reqparser_state;
 	args.data = data;
 	args.data_end = data + len;
-	args.req_fields = c->req_fields;
-	args.req_fields_len = sizeof(c->req_fields);
+	args.req_fields = conn_req_fields[id];
+	args.req_fields_len = CONN_REQ_FIELDS_LEN;
 
 	enum reqparser_completion result = reqparser_feed(&args);
+	if (result != PC_NEEDS_MORE_DATA)
+		PROBE4(parse, id, conn_socket_fds[id], len, result);
+
+	/* The path of a health check is only compared once, when the request
+	   line has just been parsed. */
+	if (health_is_enabled() && !reqparser_has_path(old_state) &&
+	    (result == PC_COMPLETE || (result == PC_NEEDS_MORE_DATA &&
+				       reqparser_has_path(args.state))) &&
+	    health_matches(conn_req_fields[id])) {
+		stats_inc(SC_HEALTH_CHECKS);
+		if (health_is_healthy()) {
+			state->reqparser_state = REQPARSER_CUSTOM_HEALTHY;
+		} else {
+			stats_inc(SC_HEALTH_CHECKS_FAILED);
+			state->reqparser_state = REQPARSER_CUSTOM_UNHEALTHY;
+		}
+		state->phase = CP_RESPONSE;
+		return CWM_NO;
+	}
+
 	switch (result) {
 	case PC_COMPLETE:
+		if (!conn_normalize_host(id))
+			return CWM_ERROR;
+
+		if (hostlist_is_enabled()) {
+			size_t host_len;
+			const char *host = conn_get_host(id, &host_len);
+			const char *target;
+			size_t target_len;
+			if (!hostlist_allows(host,
+					     hostnorm_name_len(host, host_len),
+					     &target, &target_len)) {
+				stats_inc(SC_HOSTS_REJECTED);
+				state->reqparser_state =
+				    REQPARSER_CUSTOM_REJECT;
+				state->phase = CP_RESPONSE;
+				return CWM_NO;
+			}
+
+			/* The target is copied because the image can be
+			   replaced before the response is written. */
+			if (target_len != 0 &&
+			    !conn_set_target(id, target, target_len)) {
+				state->reqparser_state = REQPARSER_CUSTOM_ERR;
+				state->phase = CP_RESPONSE;
+				return CWM_NO;
+			}
+		}
+
+		/* The target of the host wins over the one of the client's
+		   subnet. The clients of the Unix socket have no address. */
+		bool has_subnet_target = false;
+		if (subnet_is_enabled() && conn_target_lens[id] == 0 &&
+		    !netaddr_is_zero(&conn_peer_addrs[id])) {
+			size_t target_len;
+			const char *target =
+			    subnet_lookup(&conn_peer_addrs[id], &target_len);
+			if (target != NULL) {
+				if (!conn_set_target(id, target, target_len)) {
+					state->reqparser_state =
+					    REQPARSER_CUSTOM_ERR;
+					state->phase = CP_RESPONSE;
+					return CWM_NO;
+				}
+				has_subnet_target = true;
+			}
+		}
+
+		/* The path comes first in the request fields. */
+		size_t content_len;
+		if (acme_is_enabled() &&
+		    acme_copy_challenge(conn_req_fields[id],
+					conn_acme_contents[id], &content_len)) {
+			conn_acme_content_lens[id] = content_len;
+			state->reqparser_state = REQPARSER_CUSTOM_ACME;
+		} else if (has_subnet_target) {
+			/* Only counted when the response is a redirect. */
+			stats_inc(SC_SUBNET_REDIRECTS);
+		}
+		state->phase = CP_RESPONSE;
 		return CWM_NO;
 	case PC_NEEDS_MORE_DATA:
-		c->reqparser_state = args.state;
+		state->reqparser_state = args.state;
 		return CWM_YES;
 	case PC_BAD_DATA:
 		return CWM_ERROR;
 	case PC_BUFFER_TOO_SMALL:
-		c->reqparser_state = REQPARSER_CUSTOM_ERR;
+		state->reqparser_state = REQPARSER_CUSTOM_ERR;
+		state->phase = CP_RESPONSE;
 		return CWM_NO;
 	}
 
@@ -165,44 +448,156 @@ enum conn_wants_more conn_recv(int id, const char *data, size_t len)
 
 enum conn_wants_more conn_send(int id)
 {
-	struct conn *c = &connections[id];
+	struct conn_state *state = &conn_states[id];
+	int socket_fd = conn_socket_fds[id];
 
-	/* We can afford to rebuild the whole response on every EPOLLIN
+	/* We can afford to rebuild the whole response on every EPOLLOUT
 	   notification because there should only be 1 for a given socket most
 	   of the time so in reality, we're only going to do this once. */
-	size_t total_response_len =
-	    c->reqparser_state == REQPARSER_CUSTOM_ERR
-		? conn_write_too_long_response(tmp_buf,
-					       sizeof(tmp_buf))
-		: conn_write_redirect_response(id, tmp_buf,
-					       sizeof(tmp_buf));
+	size_t total_response_len;
+	switch (state->reqparser_state) {
+	case REQPARSER_CUSTOM_ERR:
+		total_response_len =
+		    conn_write_too_long_response(tmp_buf, sizeof(tmp_buf));
+		break;
+	case REQPARSER_CUSTOM_ACME:
+		total_response_len = acme_write_response(
+		    conn_acme_contents[id], conn_acme_content_lens[id], tmp_buf,
+		    sizeof(tmp_buf));
+		break;
+	case REQPARSER_CUSTOM_REJECT:
+		total_response_len =
+		    conn_write_reject_response(tmp_buf, sizeof(tmp_buf));
+		break;
+	case REQPARSER_CUSTOM_HEALTHY:
+	case REQPARSER_CUSTOM_UNHEALTHY:
+		total_response_len = health_write_response(
+		    state->reqparser_state == REQPARSER_CUSTOM_HEALTHY, tmp_buf,
+		    sizeof(tmp_buf));
+		break;
+	default:
+		total_response_len =
+		    conn_write_redirect_response(id, tmp_buf, sizeof(tmp_buf));
+	}
 
 	for (;;) {
-		size_t remaining = total_response_len - c->res_bytes_sent;
-		if (remaining == 0)
+		size_t remaining = total_response_len - state->res_bytes_sent;
+		if (remaining == 0) {
+			PROBE4(respond, id, socket_fd, total_response_len,
+			       CWM_NO);
 			return CWM_NO;
+		}
 
-		ssize_t written = sys_write(
-		    c->socket_fd, tmp_buf + c->res_bytes_sent, remaining);
+		ssize_t written = os_write(
+		    socket_fd, tmp_buf + state->res_bytes_sent, remaining);
 		if (written < 0) {
 			if (written == -EAGAIN)
 				return CWM_YES;
 
 			F_PRINT(2, "write() failed\n");
+			PROBE4(respond, id, socket_fd, state->res_bytes_sent,
+			       CWM_ERROR);
 			return CWM_ERROR;
 		}
-		c->res_bytes_sent += written;
+		state->res_bytes_sent += written;
+	}
+}
+
+uint16_t conn_get_status(int id)
+{
+	switch (conn_states[id].reqparser_state) {
+	case REQPARSER_CUSTOM_ERR:
+		return 414;
+	case REQPARSER_CUSTOM_ACME:
+		return 200;
+	case REQPARSER_CUSTOM_REJECT:
+		return 421;
+	case REQPARSER_CUSTOM_HEALTHY:
+		return 200;
+	case REQPARSER_CUSTOM_UNHEALTHY:
+		return 503;
+	default:
+		return 301;
 	}
 }
 
-static bool conn_is_valid(int id)
+size_t conn_copy_req_fields(int id, char *buf, size_t capacity)
+{
+	if (conn_states[id].reqparser_state == REQPARSER_CUSTOM_ERR)
+		return 0;
+
+	/* The host ends with a NULL character, unless it fills the end of the
+	   array. The health checks are answered before their host has been
+	   parsed, so they only have a path. */
+	const char *req_fields = conn_req_fields[id];
+	size_t sep_index = strlen(req_fields);
+	size_t len = sep_index + 1;
+	uint8_t parser_state = conn_states[id].reqparser_state;
+	while (parser_state != REQPARSER_CUSTOM_HEALTHY &&
+	       parser_state != REQPARSER_CUSTOM_UNHEALTHY &&
+	       len < CONN_REQ_FIELDS_LEN && req_fields[len] != '\0')
+		len++;
+
+	if (len > capacity)
+		len = capacity;
+	memcpy(buf, req_fields, len);
+	return len;
+}
+
+static const char *conn_get_host(int id, size_t *len)
+{
+	/* Find the index of the NULL character that delimits the request URL
+	   path from the request host. */
+	const char *req_fields = conn_req_fields[id];
+	size_t sep_index = strlen(req_fields);
+
+	const char *host_start = req_fields + sep_index + 1;
+	const char *host_end = host_start;
+	while (host_end != req_fields + CONN_REQ_FIELDS_LEN &&
+	       *host_end != '\0')
+		host_end++;
+
+	*len = host_end - host_start;
+	return host_start;
+}
+
+static bool conn_normalize_host(int id)
 {
-	return (connections_bitmap & (1 << id)) != 0;
+	size_t len;
+	char *host = (char *)conn_get_host(id, &len);
+	size_t new_len = hostnorm_normalize(host, len);
+	if (new_len == 0)
+		return false;
+
+	/* The host is followed by a NULL character unless it fills the
+	   buffer, which it cannot do anymore if it got shorter. */
+	if (new_len != len)
+		host[new_len] = '\0';
+
+	return true;
+}
+
+/**
+ * Stores the target at the end of the request fields, after the NULL character
+ * that must then follow the host. Returns false if it does not fit.
+ */
+static bool conn_set_target(int id, const char *target, size_t len)
+{
+	size_t host_len;
+	const char *host = conn_get_host(id, &host_len);
+	size_t host_end = host + host_len - conn_req_fields[id];
+	if (host_end + 1 + len > CONN_REQ_FIELDS_LEN)
+		return false;
+
+	conn_req_fields[id][host_end] = '\0';
+	memcpy(conn_req_fields[id] + CONN_REQ_FIELDS_LEN - len, target, len);
+	conn_target_lens[id] = len;
+	return true;
 }
 
 static size_t conn_write_redirect_response(int id, char *buf, size_t capacity)
 {
-	struct conn *c = &connections[id];
+	const char *req_fields = conn_req_fields[id];
 	char *cursor = buf;
 
 	const char header[] =
@@ -212,25 +607,22 @@ static size_t conn_write_redirect_response(int id, char *buf, size_t capacity)
 	memcpy(cursor, header, header_len);
 	cursor += header_len;
 
-	/* Find the index of the NULL character that delimits the request URL
-	   path from the request host. */
-	size_t sep_index = strlen(c->req_fields);
-
-	char *host_start = c->req_fields + sep_index + 1;
-	char *host_end = host_start;
-	while (host_end != c->req_fields + sizeof(c->req_fields) &&
-	       *host_end != '\0')
-		host_end++;
-	size_t host_len = host_end - host_start;
+	size_t host_len;
+	const char *host_start = conn_get_host(id, &host_len);
+	size_t sep_index = host_start - req_fields - 1;
 
-	/* URL host */
+	/* URL host, or the target that replaces it */
+	if (conn_target_lens[id] != 0) {
+		host_len = conn_target_lens[id];
+		host_start = req_fields + CONN_REQ_FIELDS_LEN - host_len;
+	}
 	F_ASSERT(cursor + host_len <= buf + capacity);
-	memcpy(cursor, c->req_fields + sep_index + 1, host_len);
+	memcpy(cursor, host_start, host_len);
 	cursor += host_len;
 
 	/* URL path */
 	F_ASSERT(cursor + sep_index <= buf + capacity);
-	memcpy(cursor, c->req_fields, sep_index);
+	memcpy(cursor, req_fields, sep_index);
 	cursor += sep_index;
 
 	const char footer[] =
@@ -254,3 +646,15 @@ static size_t conn_write_too_long_response(char *buf, size_t capacity)
 	memcpy(buf, body, body_len);
 	return body_len;
 }
+
+static size_t conn_write_reject_response(char *buf, size_t capacity)
+{
+	/* The client is not told anything about the hosts that we serve. */
+	const char body[] = "HTTP/1.1 421 Misdirected Request\r\n"
+			    "Content-Length: 0\r\n"
+			    "Connection: close\r\n\r\n";
+	size_t body_len = sizeof(body) - 1;
+	F_ASSERT(body_len <= capacity);
+	memcpy(buf, body, body_len);
+	return body_len;
+}
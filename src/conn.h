@@ -22,12 +22,24 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "netaddr.h"
+
+/* The maximum size of the request line and headers. */
+#define CONN_MAX_REQUEST_BYTES 8192
+
 /**
  * Returns true if the list of connections is full, and therefore future calls
  * to conn_new will return -1.
  */
 bool conn_is_full();
 
+/**
+ * Returns the amount of connections in use and the maximum amount of
+ * connections.
+ */
+uint32_t conn_get_count();
+uint32_t conn_get_capacity();
+
 /**
  * Creates a new connection info object to accompany a socket connection and
  * returns its ID or -1 if there is no more space available.
@@ -49,9 +61,50 @@ void conn_for_each(void (*cb)(int));
 
 int conn_get_socket_fd(int id);
 
+/**
+ * Marks a connection whose socket may still have data to read because its
+ * read budget was exhausted. Its socket is edge-triggered, so no other event
+ * will come for that data. conn_for_each_pending calls the function given as
+ * an argument with the ID of every marked connection, which stays marked until
+ * it is unmarked or freed.
+ */
+void conn_set_pending(int id, bool pending);
+bool conn_has_pending();
+void conn_for_each_pending(void (*cb)(int));
+
 void conn_set_timeout(int id, uint64_t timeout);
 uint64_t conn_get_timeout(int id);
 
+/**
+ * The client's address, which is all zeros for the clients of the Unix socket.
+ */
+void conn_set_peer_addr(int id, const struct netaddr *addr);
+const struct netaddr *conn_get_peer_addr(int id);
+
+/**
+ * Returns true if some bytes of the request have been received.
+ */
+bool conn_has_received(int id);
+
+/**
+ * Returns true if the request has been parsed, meaning that the connection is
+ * now in its write phase.
+ */
+bool conn_is_responding(int id);
+
+/**
+ * Returns true if the response has been sent and the connection is only kept
+ * open until the client closes it, discarding what it sends.
+ */
+bool conn_is_lingering(int id);
+void conn_start_lingering(int id);
+
+/**
+ * Adds to the amount of bytes that have been discarded while lingering and
+ * returns the new total.
+ */
+uint32_t conn_add_drained(int id, uint32_t bytes);
+
 enum conn_wants_more {
 	CWM_YES,
 	CWM_NO,
@@ -60,7 +113,9 @@ enum conn_wants_more {
 
 /**
  * Parses a new chunk of data that has been received. This should only be called
- * during the read phase of a connection.
+ * during the read phase of a connection. The connection must be dropped if the
+ * request is invalid or if the client has sent more than CONN_MAX_REQUEST_BYTES
+ * without finishing it.
  */
 enum conn_wants_more conn_recv(int id, const char *data, size_t len);
 
@@ -71,4 +126,18 @@ enum conn_wants_more conn_recv(int id, const char *data, size_t len);
  */
 enum conn_wants_more conn_send(int id);
 
+/**
+ * Returns the HTTP status code of the response. This should only be called
+ * during the write phase of a connection.
+ */
+uint16_t conn_get_status(int id);
+
+/**
+ * Copies the request path, a NULL character and the request host into the
+ * buffer, truncating them if needed, and returns the amount of bytes copied.
+ * Nothing is copied if the request fields were too large to be parsed. This
+ * should only be called during the write phase of a connection.
+ */
+size_t conn_copy_req_fields(int id, char *buf, size_t capacity);
+
 #endif
@@ -21,90 +21,440 @@
 
 #include <flibc/util.h>
 
+#include "accesslog.h"
+#include "acme.h"
+#include "backlog.h"
+#include "capture.h"
 #include "conn.h"
 #include "epoll.h"
+#include "health.h"
+#include "netaddr.h"
+#include "os.h"
+#include "perf.h"
+#include "probe.h"
+#include "ratelimit.h"
+#include "reload.h"
+#include "scale.h"
+#include "stats.h"
+#include "sysext.h"
 #include "tmp.h"
 
+/* How long a client has to send its request, in milliseconds. */
+#define EPOLL_CONN_TIMEOUT 2000
+
+/* How many reads a connection gets in an iteration of the event loop before
+   the others are served, which bounds the bytes read to 4 times the size of
+   tmp_buf. */
+#define EPOLL_READ_BUDGET 4
+
+/* How many connections a server socket accepts in an iteration of the event
+   loop. It is level-triggered, so the rest is reported again by the next
+   epoll_wait call. */
+#define EPOLL_ACCEPT_BUDGET 16
+
+/* How many bytes a lingering connection can send before being closed. */
+#define EPOLL_LINGER_MAX_BYTES 65536
+
+/* How often a worker that can be retired checks whether it has been, in
+   milliseconds. */
+#define EPOLL_RETIRE_CHECK 1000
+
+/* Values of the epoll events' data that do not refer to a connection.
+   Connections use their ID plus one. */
+#define EPOLL_DATA_SERVER 0
+#define EPOLL_DATA_SIGNAL UINT64_MAX
+#define EPOLL_DATA_ACME (UINT64_MAX - 1)
+#define EPOLL_DATA_RELOAD (UINT64_MAX - 2)
+#define EPOLL_DATA_UNIX_SERVER (UINT64_MAX - 3)
+
+/**
+ * Why a connection is ended. This is given to the close probe.
+ */
+enum epoll_end_reason {
+	/**
+	 * The response has been entirely sent, and the client has closed the
+	 * connection if the close strategy waits for it.
+	 */
+	EER_DONE,
+
+	/**
+	 * The client did not send a valid request before its timeout.
+	 */
+	EER_TIMEOUT,
+
+	/**
+	 * The client sent an invalid request.
+	 */
+	EER_BAD_REQUEST,
+
+	/**
+	 * The client closed the connection before sending a whole request.
+	 */
+	EER_EOF,
+
+	/**
+	 * There was an error on the socket or the client shut it down.
+	 */
+	EER_SOCKET_ERROR,
+
+	/**
+	 * The client did not close the connection in time after the response.
+	 */
+	EER_LINGER_TIMEOUT,
+
+	/**
+	 * The client sent too much data after the response.
+	 */
+	EER_LINGER_OVERFLOW,
+};
+
 static int epoll_fd;
+static int epoll_clock_id;
+/* The listening sockets, or -1 for the ones that are disabled. */
 static int epoll_server_socket_fd;
+static int epoll_unix_socket_fd;
+static int epoll_signal_fd;
+static int epoll_acme_fd;
+static enum cli_close_strategy epoll_close_strategy;
+static uint32_t epoll_linger;
 static bool epoll_server_was_unregistered = false;
 
+/**
+ * The time at which epoll_wait last returned, in milliseconds. It is shared
+ * by everything that happens in an iteration of the event loop so that we
+ * only need to call clock_gettime once per wakeup.
+ */
 static uint64_t epoll_now;
 static int epoll_max_sleep;
 
+/* The busy polling budget in nanoseconds, or 0 if it is disabled. */
+static uint64_t epoll_busy_poll_ns;
+
+/* Whether the client sockets have the kernel receive timestamps, in which case
+   the first read of a connection also measures how long the request waited. */
+static bool epoll_rx_timestamps;
+
+/* The time spent handling the previous batch of events, in milliseconds, which
+   is only measured for the health checks. */
+static uint64_t epoll_lag;
+
+/* Whether the load of this worker is published for the scale module's
+   supervisor, and if so, the time at which epoll_wait last returned and the
+   total time spent handling events, in nanoseconds. */
+static bool epoll_scale;
+static uint64_t epoll_wakeup_ns;
+static uint64_t epoll_busy_ns;
+
+/* Set when the supervisor has asked this worker to retire. It does not accept
+   connections anymore and stops once the last one is closed. */
+static bool epoll_retiring;
+
 struct epoll_event epoll_event_buffer[32];
 
+static int epoll_busy_poll();
+static bool epoll_update_now();
+static bool epoll_measure_lag();
+static bool epoll_read_ns(uint64_t *ns);
+static bool epoll_report_load();
+
 static bool epoll_register_server();
 static bool epoll_unregister_server();
+static bool epoll_register_signal();
+static bool epoll_register_acme();
+static bool epoll_register_reload();
 
 static bool epoll_on_event(const struct epoll_event *event);
-static bool epoll_on_server_in();
-static bool epoll_on_conn_in(int conn_id);
+static bool epoll_on_server_in(int server_fd, bool is_unix);
+static bool epoll_on_signal_in();
+static bool epoll_on_conn_in(int conn_id, bool peer_closed);
+static int epoll_read_timestamped(int socket_fd);
 static bool epoll_on_conn_out(int conn_id);
+static bool epoll_on_conn_drain(int conn_id);
+
+static bool epoll_on_response_sent(int conn_id);
+
+static bool epoll_end_conn(int conn_id, enum epoll_end_reason reason);
 
-static bool epoll_end_conn(int conn_id);
+static void epoll_log_conn(int conn_id);
 
 static void epoll_timeout_helper(int conn_id);
+static void epoll_pending_helper(int conn_id);
 
-bool epoll_init(int server_socket_fd)
+bool epoll_init(int server_socket_fd, int unix_socket_fd,
+		const struct cli_options *options)
 {
 	epoll_server_socket_fd = server_socket_fd;
-
-	epoll_fd = sys_epoll_create1(EPOLL_CLOEXEC);
+	epoll_unix_socket_fd = unix_socket_fd;
+	epoll_clock_id =
+	    options->coarse_clock ? CLOCK_MONOTONIC_COARSE : CLOCK_MONOTONIC;
+	epoll_busy_poll_ns = (uint64_t)options->busy_poll * 1000;
+	epoll_rx_timestamps = options->rx_timestamps;
+	epoll_close_strategy = options->close_strategy;
+	epoll_linger = options->linger;
+	epoll_scale = scale_is_enabled();
+
+	epoll_fd = os_epoll_create1(EPOLL_CLOEXEC);
 	if (epoll_fd < 0) {
 		F_PRINT(2, "epoll_create() failed\n");
 		return false;
 	}
 
-	return epoll_register_server();
+	if (epoll_busy_poll_ns != 0) {
+		/* Ask the kernel to poll the device queues of the sockets in
+		   epoll_wait. Older kernels only do it if the
+		   net.core.busy_poll sysctl is set, and we keep spinning on
+		   our side anyway. */
+		struct sysext_epoll_params params;
+		params.busy_poll_usecs = options->busy_poll;
+		params.busy_poll_budget = 0;
+		params.prefer_busy_poll = 1;
+		params.pad = 0;
+		int ret = os_ioctl(epoll_fd, EPIOCSPARAMS, &params);
+		if (ret != 0 && ret != -ENOTTY && ret != -EINVAL) {
+			F_PRINT(2, "ioctl() failed\n");
+			return false;
+		}
+	}
+
+	if (epoll_scale && !epoll_read_ns(&epoll_wakeup_ns))
+		return false;
+
+	return epoll_update_now() && epoll_register_server() &&
+	       epoll_register_signal() &&
+	       (!acme_is_enabled() || epoll_register_acme()) &&
+	       (!reload_is_enabled() || epoll_register_reload());
 }
 
 bool epoll_wait_and_dispatch()
 {
-	struct timespec now_ts;
-	if (sys_clock_gettime(CLOCK_MONOTONIC, &now_ts) != 0) {
-		F_PRINT(2, "clock_gettime() failed\n");
-		return false;
-	}
-	epoll_now = now_ts.tv_sec * 1000 + now_ts.tv_nsec / 1000000;
+	/* The time was taken when the previous epoll_wait call returned. The
+	   events that were dispatched since then took a negligible amount of
+	   time compared to the millisecond resolution of the timeouts. */
 	epoll_max_sleep = -1;
 	conn_for_each(epoll_timeout_helper);
 
-	int ret = sys_epoll_wait(epoll_fd, epoll_event_buffer,
-				 sizeof(epoll_event_buffer) /
-				     sizeof(*epoll_event_buffer),
-				 epoll_max_sleep);
+	if (health_is_enabled() && !epoll_measure_lag())
+		return false;
+
+	/* The connections that still have data to read cannot wait for an
+	   event, which will not come. */
+	if (conn_has_pending())
+		epoll_max_sleep = 0;
+
+	if (epoll_scale && !epoll_report_load())
+		return false;
+
+	/* The captured requests must reach the file even when the server
+	   becomes idle. */
+	if (capture_is_enabled() && capture_tick() &&
+	    (epoll_max_sleep < 0 || epoll_max_sleep > CAPTURE_FLUSH_DELAY))
+		epoll_max_sleep = CAPTURE_FLUSH_DELAY;
+
+	int ret = epoll_busy_poll_ns != 0 && epoll_max_sleep != 0
+		      ? epoll_busy_poll()
+		      : 0;
 	if (ret == 0) {
-		/* One of the connections has exceeded its timeout, so
-		   we will close it automatically in the next
-		   iteration. */
-		return true;
+		ret = os_epoll_wait(epoll_fd, epoll_event_buffer,
+				    sizeof(epoll_event_buffer) /
+					sizeof(*epoll_event_buffer),
+				    epoll_max_sleep);
 	}
 	if (ret < 0) {
 		F_PRINT(2, "epoll_wait() failed\n");
 		return false;
 	}
 
+	if (!epoll_update_now())
+		return false;
+	if (backlog_is_enabled())
+		backlog_tick(epoll_now);
+	if (health_is_enabled())
+		health_update(conn_get_count(), conn_get_capacity(),
+			      !epoll_server_was_unregistered, epoll_lag);
+	if (epoll_scale && !epoll_read_ns(&epoll_wakeup_ns))
+		return false;
+
+	/* The connections that are already there are served first, then those
+	   that were left with data to read in the previous iteration, and the
+	   new connections are accepted last, so that a burst of new clients
+	   does not delay the requests and the responses that are ready. */
+	bool server_in = false;
+	bool unix_server_in = false;
 	for (int i = 0; i < ret; i++) {
-		if (!epoll_on_event(&epoll_event_buffer[i]))
+		uint64_t data = epoll_event_buffer[i].data.u64;
+		if (data == EPOLL_DATA_SERVER)
+			server_in = true;
+		else if (data == EPOLL_DATA_UNIX_SERVER)
+			unix_server_in = true;
+		else if (!epoll_on_event(&epoll_event_buffer[i]))
+			return false;
+	}
+
+	conn_for_each_pending(epoll_pending_helper);
+
+	/* The server sockets may have been unregistered after the table was
+	   filled, in which case the connections wait in the backlog. */
+	if (server_in && !epoll_server_was_unregistered &&
+	    !epoll_on_server_in(epoll_server_socket_fd, false))
+		return false;
+	if (unix_server_in && !epoll_server_was_unregistered &&
+	    !epoll_on_server_in(epoll_unix_socket_fd, true))
+		return false;
+
+	return true;
+}
+
+bool epoll_has_retired() { return epoll_retiring && conn_get_count() == 0; }
+
+void epoll_close()
+{
+	/* The FD table is shared with the other workers, so the FDs would stay
+	   open after this worker exits. */
+	F_ASSERT(os_close(epoll_signal_fd) == 0);
+	if (acme_is_enabled())
+		F_ASSERT(os_close(epoll_acme_fd) == 0);
+	F_ASSERT(os_close(epoll_fd) == 0);
+
+	if (capture_is_enabled())
+		capture_flush();
+}
+
+static int epoll_busy_poll()
+{
+	/* Poll without sleeping until an event arrives or the budget is
+	   exhausted, so that the events that come soon after the previous ones
+	   do not pay the cost of a wakeup. The precise clock is always used
+	   here because the budget is usually much shorter than the resolution
+	   of the coarse one. It is read through the vDSO. */
+	struct timespec ts;
+	if (os_clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		return -1;
+	uint64_t start = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	uint64_t budget = epoll_busy_poll_ns;
+	if (epoll_max_sleep > 0 &&
+	    (uint64_t)epoll_max_sleep * 1000000 < budget)
+		budget = (uint64_t)epoll_max_sleep * 1000000;
+
+	for (;;) {
+		int ret = os_epoll_wait(epoll_fd, epoll_event_buffer,
+					sizeof(epoll_event_buffer) /
+					    sizeof(*epoll_event_buffer),
+					0);
+		if (ret != 0) {
+			if (ret > 0)
+				stats_inc(SC_BUSY_POLL_HITS);
+			return ret;
+		}
+
+		if (os_clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+			return -1;
+		uint64_t now = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+		if (now - start >= budget)
+			break;
+
+		__builtin_ia32_pause();
+	}
+
+	/* The sleep that follows must not go past the first timeout. */
+	stats_inc(SC_BUSY_POLL_MISSES);
+	if (epoll_max_sleep > 0)
+		epoll_max_sleep -= budget / 1000000;
+
+	return 0;
+}
+
+static bool epoll_update_now()
+{
+	/* This does not enter the kernel when the vDSO is available. */
+	struct timespec now_ts;
+	if (os_clock_gettime(epoll_clock_id, &now_ts) != 0) {
+		F_PRINT(2, "clock_gettime() failed\n");
+		return false;
+	}
+	epoll_now = now_ts.tv_sec * 1000 + now_ts.tv_nsec / 1000000;
+
+	return true;
+}
+
+static bool epoll_measure_lag()
+{
+	/* The events that arrived while the previous batch was handled had to
+	   wait for the next epoll_wait, so the time spent since the wakeup is
+	   how late the event loop is. */
+	struct timespec now_ts;
+	if (os_clock_gettime(epoll_clock_id, &now_ts) != 0) {
+		F_PRINT(2, "clock_gettime() failed\n");
+		return false;
+	}
+	epoll_lag = now_ts.tv_sec * 1000 + now_ts.tv_nsec / 1000000 - epoll_now;
+
+	return true;
+}
+
+static bool epoll_read_ns(uint64_t *ns)
+{
+	struct timespec ts;
+	if (os_clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+		F_PRINT(2, "clock_gettime() failed\n");
+		return false;
+	}
+	*ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+	return true;
+}
+
+static bool epoll_report_load()
+{
+	/* The time spent handling events is the time since the wakeup,
+	   without the sleep and the busy polling that come next. */
+	uint64_t now_ns;
+	if (!epoll_read_ns(&now_ns))
+		return false;
+	epoll_busy_ns += now_ns - epoll_wakeup_ns;
+	scale_report(epoll_busy_ns, conn_get_count(), conn_get_capacity());
+
+	if (!scale_can_retire())
+		return true;
+
+	if (!epoll_retiring && scale_should_retire()) {
+		epoll_retiring = true;
+		if (!epoll_server_was_unregistered &&
+		    !epoll_unregister_server())
 			return false;
 	}
 
+	/* Wake up regularly to notice the request to retire, even when there
+	   is nothing else to do. */
+	if (epoll_max_sleep < 0 || epoll_max_sleep > EPOLL_RETIRE_CHECK)
+		epoll_max_sleep = EPOLL_RETIRE_CHECK;
+
 	return true;
 }
 
 static bool epoll_register_server()
 {
 	struct epoll_event server_epoll_event;
-	server_epoll_event.data.u64 = 0;
 	/* We want to be notified when the server socket is ready to accept a
 	   client socket. */
 	server_epoll_event.events = EPOLLIN | EPOLLEXCLUSIVE | EPOLLWAKEUP;
 
-	if (sys_epoll_ctl(epoll_fd, EPOLL_CTL_ADD, epoll_server_socket_fd,
-			  &server_epoll_event) != 0) {
-		F_PRINT(2, "epoll_ctl() failed\n");
-		return false;
+	if (epoll_server_socket_fd != -1) {
+		server_epoll_event.data.u64 = EPOLL_DATA_SERVER;
+		if (os_epoll_ctl(epoll_fd, EPOLL_CTL_ADD,
+				 epoll_server_socket_fd,
+				 &server_epoll_event) != 0) {
+			F_PRINT(2, "epoll_ctl() failed\n");
+			return false;
+		}
+	}
+
+	if (epoll_unix_socket_fd != -1) {
+		server_epoll_event.data.u64 = EPOLL_DATA_UNIX_SERVER;
+		if (os_epoll_ctl(epoll_fd, EPOLL_CTL_ADD, epoll_unix_socket_fd,
+				 &server_epoll_event) != 0) {
+			F_PRINT(2, "epoll_ctl() failed\n");
+			return false;
+		}
 	}
 	epoll_server_was_unregistered = false;
 
@@ -113,8 +463,12 @@ static bool epoll_register_server()
 
 static bool epoll_unregister_server()
 {
-	if (sys_epoll_ctl(epoll_fd, EPOLL_CTL_DEL, epoll_server_socket_fd,
-			  NULL) != 0) {
+	if ((epoll_server_socket_fd != -1 &&
+	     os_epoll_ctl(epoll_fd, EPOLL_CTL_DEL, epoll_server_socket_fd,
+			  NULL) != 0) ||
+	    (epoll_unix_socket_fd != -1 &&
+	     os_epoll_ctl(epoll_fd, EPOLL_CTL_DEL, epoll_unix_socket_fd,
+			  NULL) != 0)) {
 		F_PRINT(2, "epoll_ctl() failed");
 		return false;
 	}
@@ -123,6 +477,73 @@ static bool epoll_unregister_server()
 	return true;
 }
 
+static bool epoll_register_signal()
+{
+	/* The signals have been blocked by the main function, so that they
+	   can be received through this FD instead. It must be created by every
+	   worker because a signalfd only reports the signals that are pending
+	   for the process that reads it. */
+	uint64_t mask = SYSEXT_SIGBIT(SIGUSR1) | SYSEXT_SIGBIT(SIGHUP) |
+			SYSEXT_SIGBIT(SIGCHLD);
+	epoll_signal_fd = os_signalfd(&mask);
+	if (epoll_signal_fd < 0) {
+		F_PRINT(2, "signalfd() failed\n");
+		return false;
+	}
+
+	struct epoll_event signal_epoll_event;
+	signal_epoll_event.data.u64 = EPOLL_DATA_SIGNAL;
+	signal_epoll_event.events = EPOLLIN;
+
+	if (os_epoll_ctl(epoll_fd, EPOLL_CTL_ADD, epoll_signal_fd,
+			 &signal_epoll_event) != 0) {
+		F_PRINT(2, "epoll_ctl() failed\n");
+		return false;
+	}
+
+	return true;
+}
+
+static bool epoll_register_acme()
+{
+	epoll_acme_fd = acme_watch();
+	if (epoll_acme_fd < 0) {
+		F_PRINT(2, "inotify() failed\n");
+		return false;
+	}
+
+	struct epoll_event acme_epoll_event;
+	acme_epoll_event.data.u64 = EPOLL_DATA_ACME;
+	acme_epoll_event.events = EPOLLIN;
+
+	if (os_epoll_ctl(epoll_fd, EPOLL_CTL_ADD, epoll_acme_fd,
+			 &acme_epoll_event) != 0) {
+		F_PRINT(2, "epoll_ctl() failed\n");
+		return false;
+	}
+
+	return true;
+}
+
+static bool epoll_register_reload()
+{
+	/* Edge-triggered because the eventfd is shared by the workers and
+	   never read. */
+	struct epoll_event reload_epoll_event;
+	reload_epoll_event.data.u64 = EPOLL_DATA_RELOAD;
+	reload_epoll_event.events = EPOLLIN | EPOLLET;
+
+	if (os_epoll_ctl(epoll_fd, EPOLL_CTL_ADD, reload_get_event_fd(),
+			 &reload_epoll_event) != 0) {
+		F_PRINT(2, "epoll_ctl() failed\n");
+		return false;
+	}
+
+	/* An image may have been published between the start of the server
+	   and the registration. */
+	return reload_adopt();
+}
+
 static bool epoll_on_event(const struct epoll_event *event)
 {
 	bool in = (event->events & EPOLLIN) != 0;
@@ -130,51 +551,60 @@ static bool epoll_on_event(const struct epoll_event *event)
 	bool rdhup = (event->events & EPOLLRDHUP) != 0;
 	bool err = (event->events & EPOLLERR) != 0;
 
-	if (event->data.u64 == 0) {
-		if (!epoll_on_server_in())
-			return false;
-	} else {
-		int conn_id = (int)(event->data.u64 - 1);
-
-		if (rdhup || err) {
-			/* We haven't finished handling this request but there
-			   was an error or the writing half has been closed so
-			   now we will drop it because we can't do anything with
-			   it. */
-
-			sys_close(conn_get_socket_fd(conn_id));
-			conn_free(conn_id);
+	if (event->data.u64 == EPOLL_DATA_SIGNAL)
+		return epoll_on_signal_in();
+	if (event->data.u64 == EPOLL_DATA_ACME)
+		return acme_on_watch_event(epoll_acme_fd);
+	if (event->data.u64 == EPOLL_DATA_RELOAD)
+		return reload_adopt();
 
-			return true;
-		}
+	int conn_id = (int)(event->data.u64 - 1);
 
-		/* This should never fail because we first register for EPOLLIN
-		   and then we register for just EPOLLOUT as soon as we want to
-		   send the response, so we should never have both of them at
-		   the same time. */
-		F_ASSERT(in != out);
-
-		if (in && !epoll_on_conn_in(conn_id))
-			return false;
-		if (out && !epoll_on_conn_out(conn_id))
-			return false;
+	if (err) {
+		/* We haven't finished handling this request but there was an
+		   error so now we will drop it because we can't do anything
+		   with it. */
+		return epoll_end_conn(conn_id, EER_SOCKET_ERROR);
 	}
 
-	return true;
+	/* The socket is registered for both EPOLLIN and EPOLLOUT from the
+	   start, so only the events that matter for the current phase of the
+	   connection are handled. The initial EPOLLOUT edge that is reported
+	   while we are still reading the request is ignored. */
+	if (conn_is_responding(conn_id))
+		return !out || epoll_on_conn_out(conn_id);
+	if (conn_is_lingering(conn_id))
+		return !(in || rdhup) || epoll_on_conn_drain(conn_id);
+
+	/* If the client has closed its writing half, the rest of the request
+	   (if any) is already there, so we must read until the end of the
+	   stream because no other event will come. */
+	return !(in || rdhup) || epoll_on_conn_in(conn_id, rdhup);
 }
 
-static bool epoll_on_server_in()
+static bool epoll_on_server_in(int server_fd, bool is_unix)
 {
 	/*
 	 * The server socket is ready to accept one or more connection(s).
 	 */
 
-	/* Cache timeout because clock_gettime can be expensive. */
-	uint64_t new_client_timeout = 0;
+	/* The time of the wakeup is recent enough to compute the timeout. */
+	uint64_t new_client_timeout = epoll_now + EPOLL_CONN_TIMEOUT;
 
-	while (!conn_is_full()) {
-		int client_fd = sys_accept4(epoll_server_socket_fd, NULL, NULL,
-					    SOCK_CLOEXEC | SOCK_NONBLOCK);
+	for (int accepted = 0; !conn_is_full(); accepted++) {
+		if (accepted == EPOLL_ACCEPT_BUDGET) {
+			stats_inc(SC_ACCEPT_BUDGET_EXHAUSTED);
+			return true;
+		}
+
+		/* The clients of the Unix socket are a local proxy, which has
+		   no address and must not be rate limited. */
+		struct sysext_sockaddr_in6 peer;
+		socklen_t peer_len = sizeof(peer);
+		peer.sin6_family = AF_UNIX;
+		int client_fd = os_accept4(
+		    server_fd, is_unix ? NULL : (struct sockaddr *)&peer,
+		    is_unix ? NULL : &peer_len, SOCK_CLOEXEC | SOCK_NONBLOCK);
 		if (client_fd < 0) {
 			if (client_fd == -EAGAIN) {
 				/* We have already accepted all connections. */
@@ -185,47 +615,66 @@ static bool epoll_on_server_in()
 			return false;
 		}
 
+		/* Reject abusive clients before spending anything else on
+		   them. */
+		struct netaddr peer_addr;
+		netaddr_from_sockaddr(&peer_addr, (struct sockaddr *)&peer);
+		if (ratelimit_is_enabled() && !is_unix &&
+		    !ratelimit_allow(&peer_addr, epoll_now)) {
+			PROBE2(rate_limited, client_fd, peer_addr.bytes);
+			stats_inc(SC_RATE_LIMITED);
+			F_ASSERT(os_close(client_fd) == 0);
+			continue;
+		}
+
 		int conn_id = conn_new(client_fd);
 		F_ASSERT(conn_id != -1);
+		PROBE2(accept, conn_id, client_fd);
+		conn_set_peer_addr(conn_id, &peer_addr);
 
-		/* Setup the timeout */
-		if (new_client_timeout == 0) {
-			struct timespec now;
-			if (sys_clock_gettime(CLOCK_MONOTONIC, &now) != 0) {
-				F_PRINT(2, "clock_gettime() failed\n");
-				return false;
-			}
-			new_client_timeout =
-			    now.tv_sec * 1000 + now.tv_nsec / 1000000 + 2000;
-		}
 		conn_set_timeout(conn_id, new_client_timeout);
 
 		struct epoll_event client_epoll_event;
 		client_epoll_event.data.u64 = conn_id + 1;
-		/* For now, we only care about reading the request. Later, when
-		   we want to know when we can write to the socket to respond to
-		   the request, we will call epoll_ctl to modify the events. */
-		client_epoll_event.events = EPOLLIN | EPOLLET | EPOLLWAKEUP;
-
-		if (sys_epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd,
-				  &client_epoll_event) != 0) {
+		/* Register for both reading the request and writing the
+		   response right away, so that we never have to call epoll_ctl
+		   again for this socket. Because it is edge-triggered, we will
+		   not be woken up repeatedly while the socket stays
+		   writable. */
+		client_epoll_event.events =
+		    EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET | EPOLLWAKEUP;
+
+		if (os_epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd,
+				 &client_epoll_event) != 0) {
 			F_PRINT(2, "epoll_ctl() failed\n");
 			return false;
 		}
 	}
 
 	/* Stop listening for incoming connections until the connections
-	   array is not full anymore. */
-	return epoll_unregister_server();
+	   array is not full anymore. Both server sockets may have been ready,
+	   in which case the first one has already done it. */
+	return epoll_server_was_unregistered || epoll_unregister_server();
 }
 
-static bool epoll_on_conn_in(int conn_id)
+static bool epoll_on_conn_in(int conn_id, bool peer_closed)
 {
 	int socket_fd = conn_get_socket_fd(conn_id);
+	conn_set_pending(conn_id, false);
+
+	for (int reads = 0;; reads++) {
+		if (reads == EPOLL_READ_BUDGET) {
+			/* Let the other connections go first and come back to
+			   this one in the next iteration. */
+			stats_inc(SC_READ_BUDGET_EXHAUSTED);
+			conn_set_pending(conn_id, true);
+			return true;
+		}
 
-	for (;;) {
 		int bytes_read =
-		    sys_read(socket_fd, tmp_buf, sizeof(tmp_buf));
+		    epoll_rx_timestamps && !conn_has_received(conn_id)
+			? epoll_read_timestamped(socket_fd)
+			: os_read(socket_fd, tmp_buf, sizeof(tmp_buf));
 		if (bytes_read < 0) {
 			if (bytes_read == -EAGAIN) {
 				/* We have already read everything. */
@@ -239,39 +688,36 @@ static bool epoll_on_conn_in(int conn_id)
 			/* EOS before we finished parsing, so this is an invalid
 			   request. We will close the client's socket and forget
 			   about it. */
-			sys_close(socket_fd);
-			conn_free(conn_id);
-			return true;
+			return epoll_end_conn(conn_id, EER_EOF);
 		}
 
 		enum conn_wants_more wants_more =
 		    conn_recv(conn_id, tmp_buf, bytes_read);
 		switch (wants_more) {
 		case CWM_YES:
+			/* A short read means that the socket's receive buffer
+			   has been drained, so the next read would fail with
+			   EAGAIN. Since the socket is edge-triggered, we will
+			   be notified when more data arrives. This does not
+			   hold once the client has closed its writing half,
+			   because the end of the stream does not trigger a
+			   new edge if it was already there. */
+			if ((size_t)bytes_read < sizeof(tmp_buf) &&
+			    !peer_closed)
+				return true;
 			continue;
 		case CWM_NO:
 			/* Now, we know what to put in the HTTP response and we
 			   might even be able to send it because the socket
 			   might already be writable, so let's try it. */
 			switch (conn_send(conn_id)) {
-			case CWM_YES: {
-				struct epoll_event new_client_epoll;
-				new_client_epoll.data.u64 = conn_id + 1;
-				/* We need to wait until we can write to the
-				   socket again. */
-				new_client_epoll.events =
-				    EPOLLOUT | EPOLLET | EPOLLWAKEUP;
-				if (sys_epoll_ctl(epoll_fd, EPOLL_CTL_MOD,
-						  socket_fd,
-						  &new_client_epoll) != 0) {
-					F_PRINT(2, "epoll_ctl() failed\n");
-					return false;
-				}
+			case CWM_YES:
+				/* We will be notified by an EPOLLOUT event when
+				   we can write to the socket again. */
 				return true;
-			}
 			case CWM_NO:
 				/* We're already done! */
-				return epoll_end_conn(conn_id);
+				return epoll_on_response_sent(conn_id);
 			case CWM_ERROR:
 				return false;
 			}
@@ -279,14 +725,77 @@ static bool epoll_on_conn_in(int conn_id)
 			F_ASSERT_UNREACHABLE();
 		case CWM_ERROR:
 			/* The socket FD will be removed from the epoll when it
-			   is closed. */
-			return epoll_end_conn(conn_id);
+			   is closed. This also covers the requests that are too
+			   large. */
+			return epoll_end_conn(conn_id, EER_BAD_REQUEST);
 		}
 	}
 
 	return true;
 }
 
+/**
+ * Reads into tmp_buf like os_read, and records the time between the arrival of
+ * the first byte that was read and now, which covers the wait in the accept
+ * queue and for the wakeup of the worker.
+ */
+static int epoll_read_timestamped(int socket_fd)
+{
+	struct sysext_iovec iov;
+	iov.base = tmp_buf;
+	iov.len = sizeof(tmp_buf);
+
+	/* The timestamps come in a control message with three timespecs, of
+	   which only the first one is set for software timestamps. */
+	uint64_t control[16];
+	struct sysext_msghdr msg;
+	msg.name = NULL;
+	msg.name_len = 0;
+	msg.iov = &iov;
+	msg.iov_len = 1;
+	msg.control = control;
+	msg.control_len = sizeof(control);
+	msg.flags = 0;
+
+	int bytes_read = os_recvmsg(socket_fd, &msg, 0);
+	if (bytes_read <= 0)
+		return bytes_read;
+
+	const char *cursor = (const char *)control;
+	const char *end = cursor + msg.control_len;
+	while ((size_t)(end - cursor) >= sizeof(struct sysext_cmsghdr)) {
+		const struct sysext_cmsghdr *cmsg = (const void *)cursor;
+		if (cmsg->len < sizeof(*cmsg) ||
+		    cmsg->len > (size_t)(end - cursor))
+			break;
+
+		if (cmsg->level == SOL_SOCKET &&
+		    cmsg->type == SO_TIMESTAMPING &&
+		    cmsg->len >= sizeof(*cmsg) + sizeof(struct timespec)) {
+			/* The timestamp is taken from the same clock as
+			   CLOCK_REALTIME, and is zero if it is missing. */
+			const struct timespec *arrival =
+			    (const void *)(cmsg + 1);
+			struct timespec now;
+			if ((arrival->tv_sec == 0 && arrival->tv_nsec == 0) ||
+			    os_clock_gettime(CLOCK_REALTIME, &now) != 0)
+				break;
+
+			int64_t delay =
+			    (int64_t)(now.tv_sec - arrival->tv_sec) *
+				1000000000 +
+			    (now.tv_nsec - arrival->tv_nsec);
+			stats_record_rx_delay(delay > 0 ? delay : 0);
+			break;
+		}
+
+		/* The control messages are aligned on 8 bytes. */
+		cursor += (cmsg->len + 7) & ~(size_t)7;
+	}
+
+	return bytes_read;
+}
+
 static bool epoll_on_conn_out(int conn_id)
 {
 	switch (conn_send(conn_id)) {
@@ -294,7 +803,7 @@ static bool epoll_on_conn_out(int conn_id)
 		return true;
 	case CWM_NO:
 		/* We're done. */
-		return epoll_end_conn(conn_id);
+		return epoll_on_response_sent(conn_id);
 	case CWM_ERROR:
 		return false;
 	}
@@ -302,12 +811,142 @@ static bool epoll_on_conn_out(int conn_id)
 	F_ASSERT_UNREACHABLE();
 }
 
-static bool epoll_end_conn(int conn_id)
+static bool epoll_on_conn_drain(int conn_id)
+{
+	int socket_fd = conn_get_socket_fd(conn_id);
+
+	for (;;) {
+		int bytes_read = os_read(socket_fd, tmp_buf, sizeof(tmp_buf));
+		if (bytes_read == -EAGAIN)
+			return true;
+		if (bytes_read < 0) {
+			/* The client has probably reset the connection, which
+			   does not matter anymore. */
+			return epoll_end_conn(conn_id, EER_SOCKET_ERROR);
+		}
+		if (bytes_read == 0) {
+			stats_inc(SC_LINGER_FINS);
+			return epoll_end_conn(conn_id, EER_DONE);
+		}
+
+		stats_add(SC_LINGER_BYTES, bytes_read);
+		if (conn_add_drained(conn_id, bytes_read) >
+		    EPOLL_LINGER_MAX_BYTES) {
+			stats_inc(SC_LINGER_OVERFLOWS);
+			return epoll_end_conn(conn_id, EER_LINGER_OVERFLOW);
+		}
+	}
+}
+
+static bool epoll_on_response_sent(int conn_id)
 {
-	F_ASSERT(sys_close(conn_get_socket_fd(conn_id)) == 0);
+	/* The other responses are constant, so they would make the ratios per
+	   request look better than they are. */
+	stats_inc(conn_get_status(conn_id) == 301 ? SC_REQUESTS
+						  : SC_OTHER_RESPONSES);
+	if (accesslog_is_enabled())
+		epoll_log_conn(conn_id);
+
+	int socket_fd = conn_get_socket_fd(conn_id);
+
+	switch (epoll_close_strategy) {
+	case CCS_CLOSE:
+		break;
+	case CCS_ABORT: {
+		/* l_onoff = 1 and l_linger = 0. This fails if the client has
+		   already reset the connection. */
+		int linger[2] = {1, 0};
+		if (os_setsockopt(socket_fd, SOL_SOCKET, SO_LINGER, linger,
+				  sizeof(linger)) != 0)
+			return epoll_end_conn(conn_id, EER_SOCKET_ERROR);
+		stats_inc(SC_CLOSE_ABORTS);
+		break;
+	}
+	case CCS_DRAIN:
+		/* Send our FIN right after the response, so that a client
+		   that waits for the end of the stream does not have to wait
+		   for the lingering to end. This fails if the client has
+		   already reset the connection. */
+		if (os_shutdown(socket_fd, SHUT_WR) != 0)
+			return epoll_end_conn(conn_id, EER_SOCKET_ERROR);
+		__attribute__((fallthrough));
+	case CCS_WAIT_FIN:
+		/* Closing the socket while there is unread data would reset
+		   the connection, and the client could lose the response if
+		   it has not read it yet, so we keep reading until the client
+		   closes. The events that came while we were writing the
+		   response have been ignored, so we must read right away. */
+		conn_start_lingering(conn_id);
+		conn_set_timeout(conn_id, epoll_now + epoll_linger);
+		return epoll_on_conn_drain(conn_id);
+	}
+
+	return epoll_end_conn(conn_id, EER_DONE);
+}
+
+static bool epoll_on_signal_in()
+{
+	/* A signalfd_siginfo structure is 128 bytes long and starts with the
+	   signal number. */
+	uint32_t info[32];
+	bool dump_stats = false;
+	bool reload = false;
+	bool reap = false;
+
+	for (;;) {
+		ssize_t ret = os_read(epoll_signal_fd, info, sizeof(info));
+		if (ret == -EAGAIN)
+			break;
+		if (ret < 0) {
+			F_PRINT(2, "read() failed\n");
+			return false;
+		}
+
+		if (info[0] == SIGHUP)
+			reload = true;
+		else if (info[0] == SIGCHLD)
+			reap = true;
+		else
+			dump_stats = true;
+	}
+
+	/* Failing to write the statistics is not a reason to stop serving
+	   requests. */
+	if (dump_stats) {
+		/* The counters keep their previous values if they cannot be
+		   read. */
+		if (perf_is_enabled())
+			perf_collect();
+		if (backlog_is_enabled())
+			backlog_sample();
+		stats_dump(2);
+	}
+
+	/* Only the builder of the lists is a child of a worker. */
+	if (reap && reload_is_enabled())
+		reload_reap();
+
+	if (reload) {
+		if (reload_is_enabled())
+			return reload_start();
+		F_PRINT(2, "nothing to reload without --allow-hosts or "
+			   "--subnet-targets\n");
+	}
+
+	return true;
+}
+
+static bool epoll_end_conn(int conn_id, enum epoll_end_reason reason)
+{
+	int socket_fd = conn_get_socket_fd(conn_id);
+	PROBE3(close, conn_id, socket_fd, reason);
+
+	/* Closing the socket removes it from the epoll, so there is no need to
+	   call epoll_ctl with EPOLL_CTL_DEL. */
+	F_ASSERT(os_close(socket_fd) == 0);
 	conn_free(conn_id);
 
-	if (epoll_server_was_unregistered) {
+	if (epoll_server_was_unregistered && !epoll_retiring) {
 		F_ASSERT(!conn_is_full());
 
 		/* Now, we have new space, so re-register the server socket. */
@@ -318,13 +957,41 @@ static bool epoll_end_conn(int conn_id)
 	return true;
 }
 
+static void epoll_log_conn(int conn_id)
+{
+	/* The record is written directly into the ring, which does not
+	   require any syscall. */
+	struct accesslog_record *record = accesslog_reserve();
+	if (record == NULL)
+		return;
+
+	record->time = epoll_now;
+	record->peer_addr = *conn_get_peer_addr(conn_id);
+	record->duration =
+	    epoll_now - (conn_get_timeout(conn_id) - EPOLL_CONN_TIMEOUT);
+	record->status = conn_get_status(conn_id);
+	record->fields_len = conn_copy_req_fields(conn_id, record->fields,
+						  sizeof(record->fields));
+
+	accesslog_commit();
+}
+
 static void epoll_timeout_helper(int conn_id)
 {
 	uint64_t conn_timeout = conn_get_timeout(conn_id);
 
 	if (epoll_now >= conn_timeout) {
-		if (!epoll_end_conn(conn_id))
+		enum epoll_end_reason reason = EER_TIMEOUT;
+		if (conn_is_lingering(conn_id)) {
+			stats_inc(SC_LINGER_TIMEOUTS);
+			reason = EER_LINGER_TIMEOUT;
+		} else {
+			PROBE3(timeout, conn_id, conn_get_socket_fd(conn_id),
+			       epoll_now - conn_timeout);
+		}
+		if (!epoll_end_conn(conn_id, reason))
 			sys_exit(1);
+		return;
 	}
 
 	if (conn_timeout - epoll_now > INT_MAX)
@@ -338,3 +1005,12 @@ static void epoll_timeout_helper(int conn_id)
 	if (epoll_max_sleep == -1 || tmp < epoll_max_sleep)
 		epoll_max_sleep = tmp;
 }
+
+static void epoll_pending_helper(int conn_id)
+{
+	/* The end of the stream may already be there without any edge left to
+	   report it, so the short reads do not prove that the socket has been
+	   drained and it is read until EAGAIN. */
+	if (!epoll_on_conn_in(conn_id, true))
+		sys_exit(1);
+}
@@ -20,15 +20,32 @@
 
 #include <stdbool.h>
 
+#include "cli.h"
+
 /**
- * Initializes the epoll module. Takes the HTTP server socket's FD as an
- * argument.
+ * Initializes the epoll module. Takes the FDs of the TCP and Unix server
+ * sockets, either of which can be -1 if it is disabled, and the command line
+ * options as arguments. The options must stay valid for as long as the event
+ * loop runs.
  */
-bool epoll_init(int server_socket_fd);
+bool epoll_init(int server_socket_fd, int unix_socket_fd,
+		const struct cli_options *options);
 
 /**
  * Blocks until something is worth doing and does it.
  */
 bool epoll_wait_and_dispatch();
 
+/**
+ * Returns true if the worker has been asked to retire by the scale module and
+ * has closed its last connection, meaning that it can exit.
+ */
+bool epoll_has_retired();
+
+/**
+ * Closes the FDs of the event loop. It must be called before a retired worker
+ * exits.
+ */
+void epoll_close();
+
 #endif
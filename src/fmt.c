@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <flibc/util.h>
+
+#include "fmt.h"
+
+size_t fmt_u64(char *buf, uint64_t value)
+{
+	char *cursor = buf;
+
+	do {
+		*cursor = '0' + value % 10;
+		cursor++;
+		value /= 10;
+	} while (value != 0);
+
+	/* The digits were written from the least significant one. */
+	util_reverse(buf, cursor - 1);
+
+	return cursor - buf;
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP2SD_FMT_H
+#define HTTP2SD_FMT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The maximum amount of characters written by fmt_u64.
+ */
+#define FMT_U64_MAX_LEN 20
+
+/**
+ * Writes the decimal representation of a number into the buffer, which must
+ * have space for at least FMT_U64_MAX_LEN characters, and returns the amount
+ * of characters written. No NULL character is written.
+ */
+size_t fmt_u64(char *buf, uint64_t value);
+
+#endif
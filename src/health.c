@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <flibc/mem.h>
+#include <flibc/str.h>
+#include <flibc/util.h>
+
+#include "health.h"
+
+static const char health_ok_response[] = "HTTP/1.1 200 OK\r\n"
+					 "Content-Length: 3\r\n"
+					 "Content-Type: text/plain\r\n"
+					 "Cache-Control: no-store\r\n"
+					 "Connection: close\r\n\r\n"
+					 "OK\n";
+
+static const char health_busy_response[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Content-Length: 5\r\n"
+    "Content-Type: text/plain\r\n"
+    "Cache-Control: no-store\r\n"
+    "Connection: close\r\n\r\n"
+    "Busy\n";
+
+static const char *health_path;
+static bool health_healthy = true;
+
+bool health_init(const char *path)
+{
+	if (*path != '/') {
+		F_PRINT(2, "the health check path must start with /\n");
+		return false;
+	}
+
+	health_path = path;
+	return true;
+}
+
+bool health_is_enabled() { return health_path != NULL; }
+
+bool health_matches(const char *path) { return strcmp(path, health_path) == 0; }
+
+void health_update(uint32_t conn_count, uint32_t conn_capacity,
+		   bool accepting, uint64_t lag)
+{
+	health_healthy = accepting &&
+			 conn_count * 100 <
+			     conn_capacity * HEALTH_MAX_OCCUPANCY &&
+			 lag < HEALTH_MAX_LAG;
+}
+
+bool health_is_healthy() { return health_healthy; }
+
+size_t health_write_response(bool healthy, char *buf, size_t capacity)
+{
+	const char *response =
+	    healthy ? health_ok_response : health_busy_response;
+	size_t len = healthy ? sizeof(health_ok_response) - 1
+			     : sizeof(health_busy_response) - 1;
+	F_ASSERT(len <= capacity);
+	memcpy(buf, response, len);
+	return len;
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP2SD_HEALTH_H
+#define HTTP2SD_HEALTH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Answers the health checks of the load balancers. The requests for the health
+ * path are answered as soon as their request line has been parsed, whatever
+ * their host and headers, with a 200 when the worker that accepted them has
+ * room for more work and a 503 when it is saturated, so that the load balancer
+ * steers the traffic away before the server has to drop connections. Both
+ * responses are constant.
+ *
+ * Every worker only knows its own state, so with several workers the answer
+ * depends on the worker that accepted the health check.
+ */
+
+/**
+ * The share of the connection table, in percent, above which the worker is
+ * saturated.
+ */
+#define HEALTH_MAX_OCCUPANCY 90
+
+/**
+ * The time that the worker can spend handling a batch of events, in
+ * milliseconds, above which it is saturated, because the new events had to
+ * wait that long to be noticed.
+ */
+#define HEALTH_MAX_LAG 100
+
+/**
+ * Sets the path of the health checks, which must start with a slash.
+ */
+bool health_init(const char *path);
+
+/**
+ * Returns true if health_init has been called.
+ */
+bool health_is_enabled();
+
+/**
+ * Returns true if the path is the one of the health checks.
+ */
+bool health_matches(const char *path);
+
+/**
+ * Updates the state of the worker from its connection table, whether it
+ * accepts new connections, and the time that it spent handling the previous
+ * batch of events in milliseconds.
+ */
+void health_update(uint32_t conn_count, uint32_t conn_capacity,
+		   bool accepting, uint64_t lag);
+
+bool health_is_healthy();
+
+/**
+ * Writes the response to a health check, a 200 if healthy is true and a 503
+ * otherwise.
+ */
+size_t health_write_response(bool healthy, char *buf, size_t capacity);
+
+#endif
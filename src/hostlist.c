@@ -0,0 +1,706 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <flibc/linux.h>
+#include <flibc/mem.h>
+#include <flibc/util.h>
+
+#include "hostlist.h"
+#include "listfile.h"
+#include "sysext.h"
+
+#define HOSTLIST_EXACT 1
+#define HOSTLIST_WILDCARD 2
+
+/* The longest valid host name. */
+#define HOSTLIST_MAX_LEN 253
+
+/* How many displacements are tried for a bucket before giving up. With as
+   many buckets as keys, a few hundred are usually enough for the last ones. */
+#define HOSTLIST_MAX_DISPLACEMENT (1 << 24)
+
+/* "H2HL" */
+#define HOSTLIST_MAGIC 0x4c483248
+#define HOSTLIST_VERSION 2
+
+/*
+ * The table is built with the "hash and displace" method. Every key is hashed
+ * once into 64 bits. The high bits select a bucket, and every bucket has a
+ * displacement that, mixed with the hash, gives the slot of the keys of that
+ * bucket. The displacements are chosen when compiling, starting with the
+ * biggest buckets, so that every key gets its own slot and there are exactly
+ * as many slots as keys. The buckets with a single key directly store the
+ * index of a free slot instead, as a negative number.
+ *
+ * A lookup therefore hashes the host once and reads one displacement and one
+ * slot, and a host that is not in the list is rejected by comparing its hash
+ * with the one of the slot, which almost never requires comparing the names.
+ */
+
+struct hostlist_key {
+	uint64_t hash;
+
+	/**
+	 * The offset of the name in the text of the list while compiling, then
+	 * in the names of the image. The target, if any, follows the name.
+	 */
+	uint32_t offset;
+
+	/**
+	 * The length of the name, or 0 for a free slot.
+	 */
+	uint8_t len;
+
+	uint8_t flags;
+
+	/**
+	 * The length of the target, or 0 to redirect to the host of the
+	 * request.
+	 */
+	uint8_t target_len;
+};
+
+_Static_assert(sizeof(struct hostlist_key) == 16,
+	       "the slots must stay small with huge lists");
+
+/**
+ * The start of an image. It is followed by the slots, the displacements and
+ * then the names and the targets, which are not separated.
+ */
+struct hostlist_image {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t generation;
+	uint64_t size;
+	uint32_t count;
+	uint32_t names_len;
+};
+
+_Static_assert(sizeof(struct hostlist_image) % 8 == 0,
+	       "the slots that follow the image header must be aligned");
+
+/* The current image of this worker */
+static const struct hostlist_image *hostlist_image;
+static const struct hostlist_key *hostlist_slots;
+static const int32_t *hostlist_displacements;
+static const char *hostlist_names;
+
+static bool hostlist_write(char *text, size_t text_len,
+			   struct hostlist_key *keys, int out_fd,
+			   uint64_t generation);
+static bool hostlist_parse(char *text, size_t text_len,
+			   struct hostlist_key *keys, uint32_t *count);
+static bool hostlist_dedup(const char *text, struct hostlist_key *keys,
+			   uint32_t *count);
+static bool hostlist_build(const struct hostlist_key *keys, uint32_t count,
+			   struct hostlist_key *slots, int32_t *displacements);
+static bool hostlist_displace(const struct hostlist_key *keys,
+			      const uint32_t *members, uint32_t member_count,
+			      uint32_t count, struct hostlist_key *slots,
+			      int32_t *displacement);
+static uint32_t *hostlist_bucket(const struct hostlist_key *keys,
+				 uint32_t count, uint32_t *starts);
+static uint32_t *hostlist_sort_by_size(const uint32_t *starts, uint32_t count);
+static size_t hostlist_image_size(uint32_t count, uint32_t names_len);
+static bool hostlist_is_valid(const struct hostlist_image *image);
+static const struct hostlist_key *hostlist_lookup(const char *host, size_t len,
+						 uint8_t flag);
+static uint64_t hostlist_hash(const char *data, size_t len);
+static uint64_t hostlist_mix(uint64_t x);
+static uint32_t hostlist_bucket_of(uint64_t hash, uint32_t count);
+static uint32_t hostlist_slot_of(uint64_t hash, uint32_t displacement,
+				 uint32_t count);
+
+bool hostlist_compile(const char *path, int out_fd, uint64_t generation)
+{
+	int fd = sysext_openat(AT_FDCWD, path, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0) {
+		F_PRINT(2, "open() failed for the host list\n");
+		return false;
+	}
+
+	int64_t text_len = sysext_lseek(fd, 0, SEEK_END);
+	if (text_len < 0 || text_len > UINT32_MAX) {
+		F_PRINT(2, "the host list is not a regular file or too big\n");
+		sys_close(fd);
+		return false;
+	}
+
+	/* The mapping is private, so that the names can be converted to lower
+	   case in place without changing the file. An empty list rejects every
+	   host. */
+	char *text = NULL;
+	if (text_len != 0) {
+		text = sysext_mmap(NULL, text_len, PROT_READ | PROT_WRITE,
+				   MAP_PRIVATE, fd, 0);
+		if (SYSEXT_IS_ERR(text)) {
+			F_PRINT(2, "mmap() failed\n");
+			sys_close(fd);
+			return false;
+		}
+	}
+	sys_close(fd);
+
+	/* There cannot be more names than lines. */
+	uint32_t max_count = 1;
+	for (int64_t i = 0; i < text_len; i++) {
+		if (text[i] == '\n')
+			max_count++;
+	}
+
+	size_t keys_size = max_count * sizeof(struct hostlist_key);
+	struct hostlist_key *keys = listfile_alloc(keys_size);
+	bool ok = keys != NULL &&
+		  hostlist_write(text, text_len, keys, out_fd, generation);
+
+	if (keys != NULL)
+		listfile_free(keys, keys_size);
+	if (text != NULL)
+		F_ASSERT(sysext_munmap(text, text_len) == 0);
+
+	return ok;
+}
+
+bool hostlist_open_image(const char *path, int *fd)
+{
+	*fd = sysext_openat(AT_FDCWD, path, O_RDONLY | O_CLOEXEC, 0);
+	if (*fd < 0) {
+		/* Compiling the list reports the error. */
+		*fd = -1;
+		return true;
+	}
+
+	struct hostlist_image header;
+	ssize_t ret = sys_read(*fd, &header, sizeof(header));
+	if (ret != sizeof(header) || header.magic != HOSTLIST_MAGIC) {
+		sys_close(*fd);
+		*fd = -1;
+		return true;
+	}
+
+	if (header.version != HOSTLIST_VERSION) {
+		F_PRINT(2, "the host list image has an unsupported version\n");
+		sys_close(*fd);
+		return false;
+	}
+
+	return true;
+}
+
+bool hostlist_map(int fd, uint64_t generation)
+{
+	int64_t size = sysext_lseek(fd, 0, SEEK_END);
+	if (size < (int64_t)sizeof(struct hostlist_image))
+		return false;
+
+	const struct hostlist_image *image =
+	    sysext_mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (SYSEXT_IS_ERR(image))
+		return false;
+
+	if (image->magic != HOSTLIST_MAGIC ||
+	    image->version != HOSTLIST_VERSION ||
+	    (image->generation != generation && image->generation != 0) ||
+	    image->size != (uint64_t)size ||
+	    hostlist_image_size(image->count, image->names_len) !=
+		(uint64_t)size ||
+	    !hostlist_is_valid(image)) {
+		F_ASSERT(sysext_munmap((void *)image, size) == 0);
+		return false;
+	}
+
+	/* This worker does not look at the previous image anymore, because
+	   the requests are checked in one go. */
+	if (hostlist_image != NULL) {
+		F_ASSERT(sysext_munmap((void *)hostlist_image,
+				       hostlist_image->size) == 0);
+	}
+
+	hostlist_image = image;
+	hostlist_slots = (const struct hostlist_key *)(image + 1);
+	hostlist_displacements =
+	    (const int32_t *)(hostlist_slots + image->count);
+	hostlist_names = (const char *)(hostlist_displacements + image->count);
+
+	return true;
+}
+
+bool hostlist_is_enabled() { return hostlist_image != NULL; }
+
+bool hostlist_allows(const char *host, size_t len, const char **target,
+		     size_t *target_len)
+{
+	*target_len = 0;
+
+	const struct hostlist_key *key =
+	    hostlist_lookup(host, len, HOSTLIST_EXACT);
+
+	/* Try every parent domain against the wildcard entries. */
+	for (size_t i = 0; key == NULL && i + 1 < len; i++) {
+		if (host[i] == '.')
+			key = hostlist_lookup(host + i + 1, len - i - 1,
+					      HOSTLIST_WILDCARD);
+	}
+
+	if (key == NULL)
+		return false;
+
+	*target = hostlist_names + key->offset + key->len;
+	*target_len = key->target_len;
+	return true;
+}
+
+/**
+ * Parses the text of the list into the keys, which must have room for one key
+ * per line, and writes the image into the file.
+ */
+static bool hostlist_write(char *text, size_t text_len,
+			   struct hostlist_key *keys, int out_fd,
+			   uint64_t generation)
+{
+	uint32_t count;
+	if (!hostlist_parse(text, text_len, keys, &count) ||
+	    !hostlist_dedup(text, keys, &count))
+		return false;
+
+	uint32_t names_len = 0;
+	for (uint32_t i = 0; i < count; i++)
+		names_len += keys[i].len + keys[i].target_len;
+
+	size_t size = hostlist_image_size(count, names_len);
+	if (sysext_ftruncate(out_fd, size) != 0) {
+		F_PRINT(2, "ftruncate() failed\n");
+		return false;
+	}
+	struct hostlist_image *image = sysext_mmap(
+	    NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, out_fd, 0);
+	if (SYSEXT_IS_ERR(image)) {
+		F_PRINT(2, "mmap() failed\n");
+		return false;
+	}
+
+	struct hostlist_key *slots = (struct hostlist_key *)(image + 1);
+	int32_t *displacements = (int32_t *)(slots + count);
+	char *names = (char *)(displacements + count);
+
+	/* Copy the names and their targets next to each other. */
+	uint32_t names_offset = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		size_t len = keys[i].len + keys[i].target_len;
+		memcpy(names + names_offset, text + keys[i].offset, len);
+		keys[i].offset = names_offset;
+		names_offset += len;
+	}
+
+	bool ok = hostlist_build(keys, count, slots, displacements);
+	if (ok) {
+		image->magic = HOSTLIST_MAGIC;
+		image->version = HOSTLIST_VERSION;
+		image->generation = generation;
+		image->size = size;
+		image->count = count;
+		image->names_len = names_len;
+	} else {
+		F_PRINT(2, "failed to build the host table\n");
+	}
+
+	F_ASSERT(sysext_munmap(image, size) == 0);
+	return ok;
+}
+
+static bool hostlist_parse(char *text, size_t text_len,
+			   struct hostlist_key *keys, uint32_t *count)
+{
+	*count = 0;
+
+	size_t line_start = 0;
+	while (line_start < text_len) {
+		size_t line_end = line_start;
+		while (line_end < text_len && text[line_end] != '\n')
+			line_end++;
+
+		size_t start = line_start;
+		size_t end = line_end;
+		line_start = line_end + 1;
+
+		while (start < end &&
+		       (text[start] == ' ' || text[start] == '\t'))
+			start++;
+		while (start < end &&
+		       (text[end - 1] == ' ' || text[end - 1] == '\t' ||
+			text[end - 1] == '\r'))
+			end--;
+
+		/* Empty lines and comments */
+		if (start == end || text[start] == '#')
+			continue;
+
+		/* The name can be followed by a target. */
+		size_t target = start;
+		while (target < end && text[target] != ' ' &&
+		       text[target] != '\t')
+			target++;
+		size_t target_end = end;
+		end = target;
+		while (target < target_end &&
+		       (text[target] == ' ' || text[target] == '\t'))
+			target++;
+
+		if (!listfile_check_target(text + target,
+					   target_end - target)) {
+			F_PRINT(2, "invalid target in the host list\n");
+			return false;
+		}
+
+		uint8_t flags = HOSTLIST_EXACT;
+		if (end - start >= 2 && text[start] == '*' &&
+		    text[start + 1] == '.') {
+			flags = HOSTLIST_WILDCARD;
+			start += 2;
+		}
+		if (start != end && text[end - 1] == '.')
+			end--;
+
+		if (start == end || end - start > HOSTLIST_MAX_LEN) {
+			F_PRINT(2, "invalid host in the host list\n");
+			return false;
+		}
+
+		for (size_t i = start; i < end; i++)
+			text[i] = listfile_lower(text[i]);
+
+		/* Move the target against the name, so that both can be
+		   copied at once into the image. */
+		memmove(text + end, text + target, target_end - target);
+
+		struct hostlist_key *key = &keys[*count];
+		key->hash = hostlist_hash(text + start, end - start);
+		key->offset = start;
+		key->len = end - start;
+		key->flags = flags;
+		key->target_len = target_end - target;
+		(*count)++;
+	}
+
+	return true;
+}
+
+static bool hostlist_dedup(const char *text, struct hostlist_key *keys,
+			   uint32_t *count)
+{
+	uint32_t n = *count;
+	if (n == 0)
+		return true;
+
+	/* The same name can appear twice, or both as an exact and a wildcard
+	   entry, but every name must have a single slot. The duplicates have
+	   the same hash, so they end up in the same bucket. */
+	size_t starts_size = (n + 1) * sizeof(uint32_t);
+	uint32_t *starts = listfile_alloc(starts_size);
+	if (starts == NULL)
+		return false;
+	uint32_t *order = hostlist_bucket(keys, n, starts);
+	if (order == NULL) {
+		listfile_free(starts, starts_size);
+		return false;
+	}
+
+	bool ok = true;
+	for (uint32_t bucket = 0; bucket < n && ok; bucket++) {
+		for (uint32_t i = starts[bucket];
+		     i < starts[bucket + 1] && ok; i++) {
+			struct hostlist_key *a = &keys[order[i]];
+			for (uint32_t j = i + 1; j < starts[bucket + 1]; j++) {
+				struct hostlist_key *b = &keys[order[j]];
+				if (b->len == 0 || a->hash != b->hash ||
+				    a->len != b->len ||
+				    memcmp(text + a->offset, text + b->offset,
+					   a->len) != 0)
+					continue;
+
+				if (a->target_len != b->target_len ||
+				    memcmp(text + a->offset + a->len,
+					   text + b->offset + b->len,
+					   a->target_len) != 0) {
+					F_PRINT(2, "conflicting targets in the "
+						   "host list\n");
+					ok = false;
+					break;
+				}
+
+				a->flags |= b->flags;
+				b->len = 0;
+			}
+		}
+	}
+	listfile_free(order, n * sizeof(uint32_t));
+	listfile_free(starts, starts_size);
+	if (!ok)
+		return false;
+
+	*count = 0;
+	for (uint32_t i = 0; i < n; i++) {
+		if (keys[i].len != 0)
+			keys[(*count)++] = keys[i];
+	}
+
+	return true;
+}
+
+static bool hostlist_build(const struct hostlist_key *keys, uint32_t count,
+			   struct hostlist_key *slots, int32_t *displacements)
+{
+	if (count == 0)
+		return true;
+
+	/* There are as many buckets as keys. */
+	size_t starts_size = (count + 1) * sizeof(uint32_t);
+	uint32_t *starts = listfile_alloc(starts_size);
+	if (starts == NULL)
+		return false;
+	uint32_t *order = hostlist_bucket(keys, count, starts);
+	if (order == NULL) {
+		listfile_free(starts, starts_size);
+		return false;
+	}
+
+	/* The image comes from ftruncate, so every slot is free. */
+	uint32_t *by_size = hostlist_sort_by_size(starts, count);
+	bool ok = by_size != NULL;
+	uint32_t free_slot = 0;
+	for (uint32_t i = 0; i < count && ok; i++) {
+		uint32_t bucket = by_size[i];
+		uint32_t size = starts[bucket + 1] - starts[bucket];
+		const uint32_t *members = order + starts[bucket];
+
+		if (size >= 2) {
+			ok = hostlist_displace(keys, members, size, count,
+					       slots, &displacements[bucket]);
+		} else if (size == 1) {
+			while (slots[free_slot].len != 0)
+				free_slot++;
+			slots[free_slot] = keys[members[0]];
+			displacements[bucket] = -(int32_t)free_slot - 1;
+		} else {
+			displacements[bucket] = 0;
+		}
+	}
+
+	if (by_size != NULL)
+		listfile_free(by_size, count * sizeof(uint32_t));
+	listfile_free(order, count * sizeof(uint32_t));
+	listfile_free(starts, starts_size);
+
+	return ok;
+}
+
+static bool hostlist_displace(const struct hostlist_key *keys,
+			      const uint32_t *members, uint32_t member_count,
+			      uint32_t count, struct hostlist_key *slots,
+			      int32_t *displacement)
+{
+	for (uint32_t d = 1; d < HOSTLIST_MAX_DISPLACEMENT; d++) {
+		uint32_t placed = 0;
+		for (; placed < member_count; placed++) {
+			const struct hostlist_key *key = &keys[members[placed]];
+			uint32_t slot = hostlist_slot_of(key->hash, d, count);
+			if (slots[slot].len != 0)
+				break;
+			slots[slot] = *key;
+		}
+
+		if (placed == member_count) {
+			*displacement = d;
+			return true;
+		}
+
+		/* Free the slots of the keys that have been placed. */
+		for (uint32_t i = 0; i < placed; i++) {
+			const struct hostlist_key *key = &keys[members[i]];
+			slots[hostlist_slot_of(key->hash, d, count)].len = 0;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Sorts the keys by bucket, with as many buckets as keys, with a counting
+ * sort. Returns an array of the indices of the keys, where the keys of a
+ * bucket start at the index given by starts, which must have room for count +
+ * 1 elements.
+ */
+static uint32_t *hostlist_bucket(const struct hostlist_key *keys,
+				 uint32_t count, uint32_t *starts)
+{
+	uint32_t *order = listfile_alloc(count * sizeof(uint32_t));
+	if (order == NULL)
+		return NULL;
+
+	memset(starts, 0, (count + 1) * sizeof(uint32_t));
+	for (uint32_t i = 0; i < count; i++)
+		starts[hostlist_bucket_of(keys[i].hash, count) + 1]++;
+	for (uint32_t bucket = 0; bucket < count; bucket++)
+		starts[bucket + 1] += starts[bucket];
+
+	/* Use the start of the next bucket as a cursor, which makes it the end
+	   of the bucket once it has been filled, then move everything back. */
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t bucket = hostlist_bucket_of(keys[i].hash, count);
+		order[starts[bucket + 1] - 1] = i;
+		starts[bucket + 1]--;
+	}
+	for (uint32_t bucket = 0; bucket < count; bucket++)
+		starts[bucket] = starts[bucket + 1];
+	starts[count] = count;
+
+	return order;
+}
+
+/**
+ * Sorts the buckets by decreasing size with a counting sort, because the
+ * biggest ones are the hardest to place. Returns an array of the buckets.
+ */
+static uint32_t *hostlist_sort_by_size(const uint32_t *starts, uint32_t count)
+{
+	uint32_t max_size = 0;
+	for (uint32_t bucket = 0; bucket < count; bucket++) {
+		uint32_t size = starts[bucket + 1] - starts[bucket];
+		if (size > max_size)
+			max_size = size;
+	}
+
+	size_t size_starts_size = (max_size + 2) * sizeof(uint32_t);
+	uint32_t *size_starts = listfile_alloc(size_starts_size);
+	if (size_starts == NULL)
+		return NULL;
+	uint32_t *by_size = listfile_alloc(count * sizeof(uint32_t));
+	if (by_size == NULL) {
+		listfile_free(size_starts, size_starts_size);
+		return NULL;
+	}
+
+	for (uint32_t bucket = 0; bucket < count; bucket++)
+		size_starts[max_size - (starts[bucket + 1] - starts[bucket])]++;
+	uint32_t total = 0;
+	for (uint32_t i = 0; i <= max_size; i++) {
+		uint32_t n = size_starts[i];
+		size_starts[i] = total;
+		total += n;
+	}
+	for (uint32_t bucket = 0; bucket < count; bucket++) {
+		uint32_t size = starts[bucket + 1] - starts[bucket];
+		by_size[size_starts[max_size - size]++] = bucket;
+	}
+
+	listfile_free(size_starts, size_starts_size);
+	return by_size;
+}
+
+static size_t hostlist_image_size(uint32_t count, uint32_t names_len)
+{
+	return sizeof(struct hostlist_image) +
+	       (size_t)count * (sizeof(struct hostlist_key) + sizeof(int32_t)) +
+	       names_len;
+}
+
+static bool hostlist_is_valid(const struct hostlist_image *image)
+{
+	/* An image compiled offline is an arbitrary file, so every offset that
+	   a lookup can follow is checked once here instead of on every
+	   request. */
+	const struct hostlist_key *slots =
+	    (const struct hostlist_key *)(image + 1);
+	const int32_t *displacements = (const int32_t *)(slots + image->count);
+
+	for (uint32_t i = 0; i < image->count; i++) {
+		const struct hostlist_key *key = &slots[i];
+		if (key->len > HOSTLIST_MAX_LEN ||
+		    (uint64_t)key->offset + key->len + key->target_len >
+			image->names_len)
+			return false;
+
+		int32_t d = displacements[i];
+		if (d < 0 && -((int64_t)d + 1) >= image->count)
+			return false;
+	}
+
+	return true;
+}
+
+static const struct hostlist_key *hostlist_lookup(const char *host, size_t len,
+						 uint8_t flag)
+{
+	uint32_t count = hostlist_image->count;
+	if (count == 0)
+		return NULL;
+
+	uint64_t hash = hostlist_hash(host, len);
+	int32_t d = hostlist_displacements[hostlist_bucket_of(hash, count)];
+	uint32_t slot =
+	    d < 0 ? (uint32_t)(-d - 1) : hostlist_slot_of(hash, d, count);
+
+	const struct hostlist_key *key = &hostlist_slots[slot];
+	if (key->hash != hash || key->len != len || (key->flags & flag) == 0)
+		return NULL;
+
+	if (memcmp(hostlist_names + key->offset, host, len) != 0)
+		return NULL;
+
+	return key;
+}
+
+static uint64_t hostlist_hash(const char *data, size_t len)
+{
+	/* FNV-1a, with a final mix because the buckets and the slots are taken
+	   from the high bits. The names are already in lower case. */
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (uint8_t)data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hostlist_mix(hash);
+}
+
+static uint64_t hostlist_mix(uint64_t x)
+{
+	/* The finalizer of SplitMix64 */
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
+
+static uint32_t hostlist_bucket_of(uint64_t hash, uint32_t count)
+{
+	/* Maps the high 32 bits to [0, count) without a division. */
+	return (uint32_t)(((hash >> 32) * count) >> 32);
+}
+
+static uint32_t hostlist_slot_of(uint64_t hash, uint32_t displacement,
+				 uint32_t count)
+{
+	uint64_t mixed =
+	    hostlist_mix(hash + displacement * 0x9e3779b97f4a7c15ULL);
+	return (uint32_t)(((mixed >> 32) * count) >> 32);
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP2SD_HOSTLIST_H
+#define HTTP2SD_HOSTLIST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The list of the hosts that the server redirects. It is read from a file with
+ * one host per line, where a line that starts with "*." allows every subdomain
+ * of the rest of the line, and compiled into a minimal perfect hash table, so
+ * that checking a host takes one lookup per label whatever the size of the
+ * list. A host can be followed by a target, the host that its requests are
+ * redirected to instead of their own. The exact and the wildcard entries of a
+ * name share the same target.
+ *
+ * The compiled table is an image that does not contain any pointer, so that
+ * it can be written to a file or a memfd and mapped by every worker. An image
+ * can also be compiled offline with tools/hostc, in which case its generation
+ * is 0 and the server maps the file itself, so that huge lists do not have to
+ * be compiled at startup and the workers share its pages in the page cache.
+ */
+
+/**
+ * Compiles the list of the file at path into an image written to out_fd, which
+ * is resized to the size of the image. The image records the generation, so
+ * that a reader can check that it maps the image that it expects.
+ */
+bool hostlist_compile(const char *path, int out_fd, uint64_t generation);
+
+/**
+ * Opens the file at path if it is an image that was compiled offline and sets
+ * fd to its FD, or to -1 if it is a list that must be compiled. Returns false
+ * if the file is an image of an unsupported version.
+ */
+bool hostlist_open_image(const char *path, int *fd);
+
+/**
+ * Maps the image of the FD and makes it the current list of this worker,
+ * unmapping the previous one. Returns false if the FD does not contain an
+ * image of the given generation or compiled offline, or if one of its slots
+ * points outside of the image, in which case the current list is kept.
+ *
+ * The file is mapped as it is, so an image compiled offline must be replaced
+ * by renaming a new file over it and never be rewritten in place.
+ */
+bool hostlist_map(int fd, uint64_t generation);
+
+/**
+ * Returns true if an image has been mapped, meaning that the requests for the
+ * other hosts must be rejected.
+ */
+bool hostlist_is_enabled();
+
+/**
+ * Returns true if the host, which must have been normalized by
+ * hostnorm_normalize and whose port must have been removed with
+ * hostnorm_name_len, is in the list or is a subdomain of a wildcard entry. The
+ * target of the entry is returned in target and target_len, which is set
+ * to 0 if it has none. It points into the image, so it is only valid until
+ * the next image is mapped.
+ */
+bool hostlist_allows(const char *host, size_t len, const char **target,
+		     size_t *target_len);
+
+#endif
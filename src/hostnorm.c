@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <flibc/mem.h>
+
+#include "hostnorm.h"
+
+/* The host is processed in blocks of 16 bytes, which is the size of the SSE2
+   registers that every x86_64 CPU has. */
+#define HOSTNORM_BLOCK_SIZE 16
+
+typedef uint8_t hostnorm_vec __attribute__((vector_size(HOSTNORM_BLOCK_SIZE)));
+
+/* Flags returned by hostnorm_block. */
+#define HOSTNORM_INVALID 1
+#define HOSTNORM_SPECIAL 2
+
+static unsigned int hostnorm_block(char *block);
+static bool hostnorm_any(hostnorm_vec mask);
+static size_t hostnorm_split(const char *host, size_t len);
+
+size_t hostnorm_normalize(char *host, size_t len)
+{
+	unsigned int flags = 0;
+
+	size_t i = 0;
+	for (; i + HOSTNORM_BLOCK_SIZE <= len; i += HOSTNORM_BLOCK_SIZE)
+		flags |= hostnorm_block(host + i);
+
+	if (i != len) {
+		/* Pad the last block with a valid character. */
+		char block[HOSTNORM_BLOCK_SIZE];
+		memset(block, 'a', sizeof(block));
+		memcpy(block, host + i, len - i);
+		flags |= hostnorm_block(block);
+		memcpy(host + i, block, len - i);
+	}
+
+	if ((flags & HOSTNORM_INVALID) != 0)
+		return 0;
+
+	/* Almost every host is a plain domain name, which only needs the
+	   trailing dot to be removed. */
+	if ((flags & HOSTNORM_SPECIAL) == 0) {
+		if (host[len - 1] == '.')
+			len--;
+		return len;
+	}
+
+	size_t name_len = hostnorm_split(host, len);
+	if (name_len == 0)
+		return 0;
+
+	if (host[0] == '[') {
+		/* An IPv6 address, which can contain colons but not another
+		   bracket. */
+		if (name_len < 3 || host[name_len - 1] != ']')
+			return 0;
+		for (size_t j = 1; j < name_len - 1; j++) {
+			if (host[j] == '[' || host[j] == ']')
+				return 0;
+		}
+	} else {
+		for (size_t j = 0; j < name_len; j++) {
+			if (host[j] == ':' || host[j] == '[' || host[j] == ']')
+				return 0;
+		}
+	}
+
+	/* The port starts with the colon. */
+	size_t port_len = len - name_len;
+	if (port_len == 1)
+		return 0;
+	if (port_len == 3 && host[name_len + 1] == '8' &&
+	    host[name_len + 2] == '0')
+		port_len = 0;
+
+	size_t new_name_len = name_len;
+	if (host[0] != '[' && host[name_len - 1] == '.') {
+		new_name_len--;
+		if (new_name_len == 0)
+			return 0;
+	}
+
+	if (port_len != 0 && new_name_len != name_len)
+		memmove(host + new_name_len, host + name_len, port_len);
+
+	return new_name_len + port_len;
+}
+
+size_t hostnorm_name_len(const char *host, size_t len)
+{
+	/* A normalized host always has a name before its port. */
+	return hostnorm_split(host, len);
+}
+
+/**
+ * Converts the block to lower case in place and returns HOSTNORM_INVALID if it
+ * contains a byte that cannot be in a host, and HOSTNORM_SPECIAL if it
+ * contains a colon or a bracket, which are only found in ports and IPv6
+ * addresses.
+ */
+static unsigned int hostnorm_block(char *block)
+{
+	hostnorm_vec c;
+	memcpy(&c, block, sizeof(c));
+
+	hostnorm_vec upper = (hostnorm_vec)((c >= 'A') & (c <= 'Z'));
+	c |= upper & 0x20;
+	memcpy(block, &c, sizeof(c));
+
+	hostnorm_vec special =
+	    (hostnorm_vec)((c == ':') | (c == '[') | (c == ']'));
+	hostnorm_vec valid =
+	    (hostnorm_vec)(((c >= 'a') & (c <= 'z')) |
+			   ((c >= '0') & (c <= '9')) | (c == '-') |
+			   (c == '.') | (c == '_')) |
+	    special;
+
+	unsigned int flags = 0;
+	if (hostnorm_any(~valid))
+		flags |= HOSTNORM_INVALID;
+	if (hostnorm_any(special))
+		flags |= HOSTNORM_SPECIAL;
+
+	return flags;
+}
+
+static bool hostnorm_any(hostnorm_vec mask)
+{
+	uint64_t words[2];
+	memcpy(words, &mask, sizeof(words));
+	return (words[0] | words[1]) != 0;
+}
+
+/**
+ * Returns the length of the host without the port, or 0 if the host only
+ * contains a port.
+ */
+static size_t hostnorm_split(const char *host, size_t len)
+{
+	size_t port_start = len;
+	while (port_start != 0 && host[port_start - 1] >= '0' &&
+	       host[port_start - 1] <= '9')
+		port_start--;
+
+	/* The last group of an IPv6 address looks like a port unless it is
+	   followed by the closing bracket. */
+	if (port_start != 0 && host[port_start - 1] == ':' &&
+	    (host[0] != '[' ||
+	     (port_start >= 2 && host[port_start - 2] == ']')))
+		return port_start - 1;
+
+	return len;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP2SD_HOSTNORM_H
+#define HTTP2SD_HOSTNORM_H
+
+#include <stddef.h>
+
+/*
+ * Normalizes the Host header, so that the hosts that only differ in their
+ * spelling are the same key for the lookups and the Location header never
+ * contains a byte that does not belong in a host.
+ */
+
+/**
+ * Normalizes the host in place: converts it to lower case, removes the
+ * default port (80) and a trailing dot, and checks that it only contains the
+ * characters of a domain name, of an IPv4 address or of an IPv6 address
+ * between brackets, followed by an optional port. Returns the new length,
+ * which is never greater than the old one, or 0 if the host is invalid.
+ */
+size_t hostnorm_normalize(char *host, size_t len);
+
+/**
+ * Returns the length of a normalized host without its port.
+ */
+size_t hostnorm_name_len(const char *host, size_t len);
+
+#endif
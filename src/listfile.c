@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <flibc/linux.h>
+#include <flibc/util.h>
+
+#include "listfile.h"
+#include "sysext.h"
+
+/* The longest valid host name. */
+#define LISTFILE_MAX_TARGET_LEN 253
+
+static bool listfile_is_target_char(char ch);
+
+bool listfile_check_target(char *target, size_t len)
+{
+	if (len > LISTFILE_MAX_TARGET_LEN)
+		return false;
+
+	for (size_t i = 0; i < len; i++) {
+		if (!listfile_is_target_char(target[i]))
+			return false;
+		target[i] = listfile_lower(target[i]);
+	}
+
+	return true;
+}
+
+char listfile_lower(char ch)
+{
+	return ch >= 'A' && ch <= 'Z' ? ch - 'A' + 'a' : ch;
+}
+
+void *listfile_alloc(size_t size)
+{
+	/* Anonymous mappings are zeroed. */
+	void *ptr = sysext_mmap(NULL, size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (SYSEXT_IS_ERR(ptr)) {
+		F_PRINT(2, "mmap() failed\n");
+		return NULL;
+	}
+	return ptr;
+}
+
+void listfile_free(void *ptr, size_t size)
+{
+	F_ASSERT(sysext_munmap(ptr, size) == 0);
+}
+
+static bool listfile_is_target_char(char ch)
+{
+	return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+	       (ch >= '0' && ch <= '9') || ch == '.' || ch == '-' ||
+	       ch == ':' || ch == '[' || ch == ']';
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP2SD_LISTFILE_H
+#define HTTP2SD_LISTFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Helpers shared by the modules that read a list of redirects from a file: the
+ * host list and the subnet list.
+ */
+
+/**
+ * Returns true if the target of a line is valid, after converting it to lower
+ * case in place. The targets are written as they are in the Location header,
+ * so they are limited to the characters of a host name, an IPv6 address and a
+ * port, and to the length of a host name.
+ */
+bool listfile_check_target(char *target, size_t len);
+
+char listfile_lower(char ch);
+
+/**
+ * Returns a zeroed private mapping of the given size, or NULL after printing
+ * an error.
+ */
+void *listfile_alloc(size_t size);
+
+void listfile_free(void *ptr, size_t size);
+
+#endif
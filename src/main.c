@@ -15,24 +15,63 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <stddef.h>
 #include <stdnoreturn.h>
 
 #include <flibc/linux.h>
+#include <flibc/mem.h>
 #include <flibc/util.h>
 
+#include "accesslog.h"
+#include "acme.h"
+#include "backlog.h"
+#include "capture.h"
 #include "cli.h"
 #include "epoll.h"
+#include "health.h"
+#include "perf.h"
+#include "ratelimit.h"
+#include "reload.h"
+#include "scale.h"
+#include "sysext.h"
+#include "vdso.h"
 
-static bool create_more_threads(uint32_t count);
+static int create_tcp_socket(const struct cli_options *options);
+static int create_unix_socket(const struct cli_options *options);
+static bool start_logger();
+static bool create_more_threads(uint32_t count, uint32_t *worker_index);
 
 int main(int argc, char **argv)
 {
 	F_UNUSED(argc);
 
+	vdso_init(argv);
+
 	struct cli_options options;
 	options.server_port = 80;
+	options.tcp = true;
+	options.unix_socket_path = NULL;
+	options.unix_socket_mode = 0660;
 	options.threads = 1;
+	options.max_threads = 0;
 	options.socket_backlog = 32;
+	options.max_socket_backlog = 0;
+	options.coarse_clock = false;
+	options.perf_counters = false;
+	options.access_log_path = NULL;
+	options.access_log_wait = false;
+	options.rate_limit = 0;
+	options.rate_limit_burst = 0;
+	options.busy_poll = 0;
+	options.rx_timestamps = false;
+	options.close_strategy = CCS_CLOSE;
+	options.linger = 1000;
+	options.acme_dir = NULL;
+	options.allow_hosts_path = NULL;
+	options.subnet_targets_path = NULL;
+	options.health_path = NULL;
+	options.capture_path = NULL;
+	options.capture_sample = 1;
 
 	switch (cli_parse_args(&options, argv)) {
 	case CPR_SUCCESS:
@@ -44,42 +83,282 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
-	int server_fd =
-	    sys_socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
-	if (server_fd < 0) {
-		F_PRINT(2, "socket() failed\n");
+	if (!options.tcp && options.unix_socket_path == NULL) {
+		F_PRINT(2, "--no-tcp requires --unix-socket\n");
 		return 1;
 	}
 
-	struct sockaddr_in addr;
-	addr.sin_addr = INADDR_ANY;
-	addr.sin_family = AF_INET;
-	addr.sin_port = htons(options.server_port);
+	if (options.max_threads != 0 &&
+	    options.max_threads <= options.threads) {
+		F_PRINT(2, "--max-threads must be greater than --threads\n");
+		return 1;
+	}
 
-	if (sys_bind(server_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
-		F_PRINT(2, "bind() failed\n");
+	int server_fd = -1;
+	if (options.tcp) {
+		server_fd = create_tcp_socket(&options);
+		if (server_fd < 0)
+			return 1;
+	}
+
+	int unix_fd = -1;
+	if (options.unix_socket_path != NULL) {
+		unix_fd = create_unix_socket(&options);
+		if (unix_fd < 0)
+			return 1;
+	}
+
+	/* Block the signals that are handled by the event loop through a
+	   signalfd. This is done before cloning so that every worker inherits
+	   the signal mask. */
+	uint64_t mask = SYSEXT_SIGBIT(SIGUSR1) | SYSEXT_SIGBIT(SIGHUP) |
+			SYSEXT_SIGBIT(SIGCHLD);
+	if (sysext_rt_sigprocmask(SIG_BLOCK, &mask, NULL) != 0) {
+		F_PRINT(2, "rt_sigprocmask() failed\n");
+		return 1;
+	}
+
+	if (options.rate_limit != 0) {
+		uint32_t burst = options.rate_limit_burst != 0
+				     ? options.rate_limit_burst
+				     : options.rate_limit;
+		if (burst > 1000000)
+			burst = 1000000;
+		if (!ratelimit_init(options.rate_limit, burst))
+			return 1;
+	}
+
+	if (options.acme_dir != NULL && !acme_init(options.acme_dir))
+		return 1;
+
+	if (options.health_path != NULL && !health_init(options.health_path))
 		return 1;
+
+	if ((options.allow_hosts_path != NULL ||
+	     options.subnet_targets_path != NULL) &&
+	    !reload_init(options.allow_hosts_path, options.subnet_targets_path))
+		return 1;
+
+	if (server_fd != -1)
+		backlog_init(server_fd, options.socket_backlog,
+			     options.max_socket_backlog);
+
+	if (options.capture_path != NULL &&
+	    !capture_init(options.capture_path, options.capture_sample))
+		return 1;
+
+	/* The workers that are added under load need their own ring in the
+	   access log. */
+	uint32_t max_workers = options.threads;
+	if (options.max_threads != 0) {
+		max_workers = options.max_threads;
+		if (!scale_init(options.threads, options.max_threads))
+			return 1;
+	}
+
+	if (options.access_log_path != NULL) {
+		if (!accesslog_init(max_workers, options.access_log_path,
+				    options.access_log_wait ? ALFP_WAIT
+							    : ALFP_DROP))
+			return 1;
+		if (!start_logger())
+			return 1;
 	}
 
-	if (!create_more_threads(options.threads - 1))
+	uint32_t worker_index;
+	if (!create_more_threads(options.threads - 1, &worker_index))
 		return 1;
 
-	if (!epoll_init(server_fd))
+	/* The supervisor is cloned before the first worker initializes its
+	   event loop, so that the workers that it clones start afresh. */
+	if (scale_is_enabled()) {
+		if (worker_index == 0 && !scale_start(&worker_index))
+			return 1;
+		scale_set_worker(worker_index);
+	}
+
+	if (accesslog_is_enabled())
+		accesslog_set_worker(worker_index);
+	if (backlog_is_enabled())
+		backlog_set_worker(worker_index);
+
+	if (options.perf_counters && !perf_init())
+		return 1;
+
+	if (!epoll_init(server_fd, unix_fd, &options))
 		return 1;
 
-	if (sys_listen(server_fd, options.socket_backlog) != 0) {
-		F_PRINT(2, "listen() failed");
+	if (server_fd != -1 && !backlog_listen())
+		return 1;
+	if (unix_fd != -1 &&
+	    sys_listen(unix_fd, options.socket_backlog) != 0) {
+		F_PRINT(2, "listen() failed\n");
 		return 1;
 	}
 
-	for (;;) {
+	while (!epoll_has_retired()) {
 		if (!epoll_wait_and_dispatch())
 			return 1;
 	}
+
+	epoll_close();
+	if (perf_is_enabled())
+		perf_close();
+	return 0;
+}
+
+static int create_tcp_socket(const struct cli_options *options)
+{
+	/* The socket is dual-stack, so that it accepts both the IPv4 and the
+	   IPv6 clients, unless IPv6 is disabled on this machine. */
+	bool is_ipv6 = true;
+	int server_fd =
+	    sys_socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (server_fd == -EAFNOSUPPORT) {
+		is_ipv6 = false;
+		server_fd = sys_socket(
+		    AF_INET, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	}
+	if (server_fd < 0) {
+		F_PRINT(2, "socket() failed\n");
+		return -1;
+	}
+
+	if (is_ipv6) {
+		int v6_only = 0;
+		if (sysext_setsockopt(server_fd, IPPROTO_IPV6, IPV6_V6ONLY,
+				      &v6_only, sizeof(v6_only)) != 0) {
+			F_PRINT(2, "setsockopt() failed\n");
+			return -1;
+		}
+	}
+
+	/* The client sockets inherit these options from the server socket.
+	   Setting them requires CAP_NET_ADMIN and SO_PREFER_BUSY_POLL only
+	   exists since Linux 5.11, but the workers still spin on epoll
+	   without them. */
+	if (options->busy_poll != 0) {
+		int busy_poll = options->busy_poll;
+		int prefer_busy_poll = 1;
+		int ret = sysext_setsockopt(server_fd, SOL_SOCKET, SO_BUSY_POLL,
+					    &busy_poll, sizeof(busy_poll));
+		if (ret == 0) {
+			ret = sysext_setsockopt(
+			    server_fd, SOL_SOCKET, SO_PREFER_BUSY_POLL,
+			    &prefer_busy_poll, sizeof(prefer_busy_poll));
+		}
+		if (ret == -EPERM || ret == -ENOPROTOOPT) {
+			F_PRINT(2, "busy polling in the kernel is not "
+				   "available, only polling epoll\n");
+		} else if (ret != 0) {
+			F_PRINT(2, "setsockopt() failed\n");
+			return -1;
+		}
+	}
+
+	if (options->rx_timestamps) {
+		int flags =
+		    SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+		if (sysext_setsockopt(server_fd, SOL_SOCKET, SO_TIMESTAMPING,
+				      &flags, sizeof(flags)) != 0) {
+			F_PRINT(2, "setsockopt() failed\n");
+			return -1;
+		}
+	}
+
+	int ret;
+	if (is_ipv6) {
+		/* The address is in6addr_any. */
+		struct sysext_sockaddr_in6 addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin6_family = AF_INET6;
+		addr.sin6_port = htons(options->server_port);
+		ret = sys_bind(server_fd, (struct sockaddr *)&addr,
+			       sizeof(addr));
+	} else {
+		struct sockaddr_in addr;
+		addr.sin_addr = INADDR_ANY;
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(options->server_port);
+		ret = sys_bind(server_fd, (struct sockaddr *)&addr,
+			       sizeof(addr));
+	}
+	if (ret != 0) {
+		F_PRINT(2, "bind() failed\n");
+		return -1;
+	}
+
+	return server_fd;
+}
+
+static int create_unix_socket(const struct cli_options *options)
+{
+	struct sysext_sockaddr_un addr;
+	size_t path_len = strlen(options->unix_socket_path);
+	if (path_len >= sizeof(addr.sun_path)) {
+		F_PRINT(2, "the Unix socket path is too long\n");
+		return -1;
+	}
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path, options->unix_socket_path, path_len + 1);
+
+	int unix_fd =
+	    sys_socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (unix_fd < 0) {
+		F_PRINT(2, "socket() failed\n");
+		return -1;
+	}
+
+	/* The socket of a previous run stays on the filesystem after it has
+	   stopped, and makes bind fail. Anything else at that path is left
+	   alone. */
+	struct sysext_stat st;
+	if (sysext_newfstatat(AT_FDCWD, addr.sun_path, &st,
+			      AT_SYMLINK_NOFOLLOW) == 0 &&
+	    (st.mode & S_IFMT) == S_IFSOCK &&
+	    sysext_unlinkat(AT_FDCWD, addr.sun_path, 0) != 0) {
+		F_PRINT(2, "unlink() failed for the Unix socket\n");
+		return -1;
+	}
+
+	if (sys_bind(unix_fd, (struct sockaddr *)&addr,
+		     offsetof(struct sysext_sockaddr_un, sun_path) + path_len +
+			 1) != 0) {
+		F_PRINT(2, "bind() failed for the Unix socket\n");
+		return -1;
+	}
+
+	/* Nobody can connect before listen is called, so the socket is never
+	   reachable with the permissions given by the umask. */
+	if (sysext_fchmodat(AT_FDCWD, addr.sun_path,
+			    options->unix_socket_mode) != 0) {
+		F_PRINT(2, "chmod() failed for the Unix socket\n");
+		return -1;
+	}
+
+	return unix_fd;
+}
+
+static bool start_logger()
+{
+	pid_t child =
+	    sys_clone(CLONE_FILES | CLONE_FS | CLONE_IO | CLONE_PARENT, NULL,
+		      NULL, NULL, 0);
+	if (child < 0) {
+		F_PRINT(2, "clone() failed\n");
+		return false;
+	} else if (child == 0) {
+		accesslog_run();
+	}
+
+	return true;
 }
 
-static bool create_more_threads(uint32_t count)
+static bool create_more_threads(uint32_t count, uint32_t *worker_index)
 {
+	/* The parent is the first worker. */
+	*worker_index = 0;
+
 	if (count == 0)
 		return true;
 
@@ -104,6 +383,7 @@ static bool create_more_threads(uint32_t count)
 		} else if (child == 0) {
 			/* Only the parent must clone itself, to prevent having
 			   1 + (N - 1)! threads instead of just N threads. */
+			*worker_index = i + 1;
 			break;
 		}
 
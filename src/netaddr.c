@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <flibc/linux.h>
+#include <flibc/mem.h>
+
+#include "fmt.h"
+#include "netaddr.h"
+#include "sysext.h"
+
+/* The first 12 bytes of an IPv4-mapped address */
+static const uint8_t netaddr_ipv4_prefix[12] = {0, 0, 0, 0, 0,    0,
+						0, 0, 0, 0, 0xff, 0xff};
+
+static size_t netaddr_format_ipv4(char *buf, const uint8_t *bytes);
+static size_t netaddr_format_group(char *buf, uint16_t group);
+
+void netaddr_from_sockaddr(struct netaddr *addr, const struct sockaddr *sa)
+{
+	memset(addr->bytes, 0, sizeof(addr->bytes));
+
+	if (sa->sa_family == AF_INET6) {
+		const struct sysext_sockaddr_in6 *in6 = (const void *)sa;
+		memcpy(addr->bytes, in6->sin6_addr, sizeof(addr->bytes));
+	} else if (sa->sa_family == AF_INET) {
+		const struct sockaddr_in *in = (const void *)sa;
+		memcpy(addr->bytes, netaddr_ipv4_prefix,
+		       sizeof(netaddr_ipv4_prefix));
+		memcpy(addr->bytes + sizeof(netaddr_ipv4_prefix),
+		       &in->sin_addr, sizeof(in->sin_addr));
+	}
+}
+
+bool netaddr_is_zero(const struct netaddr *addr)
+{
+	for (size_t i = 0; i < sizeof(addr->bytes); i++) {
+		if (addr->bytes[i] != 0)
+			return false;
+	}
+	return true;
+}
+
+bool netaddr_is_ipv4(const struct netaddr *addr)
+{
+	return memcmp(addr->bytes, netaddr_ipv4_prefix,
+		      sizeof(netaddr_ipv4_prefix)) == 0;
+}
+
+size_t netaddr_format(char *buf, const struct netaddr *addr)
+{
+	if (netaddr_is_ipv4(addr))
+		return netaddr_format_ipv4(buf, addr->bytes + 12);
+
+	uint16_t groups[8];
+	for (int i = 0; i < 8; i++)
+		groups[i] = addr->bytes[2 * i] << 8 | addr->bytes[2 * i + 1];
+
+	/* The longest run of at least two zero groups is replaced with "::",
+	   the first one if there are several. */
+	int run_start = -1;
+	int run_len = 1;
+	for (int i = 0; i < 8;) {
+		int j = i;
+		while (j < 8 && groups[j] == 0)
+			j++;
+		if (j - i > run_len) {
+			run_start = i;
+			run_len = j - i;
+		}
+		i = j == i ? i + 1 : j;
+	}
+
+	size_t len = 0;
+	for (int i = 0; i < 8; i++) {
+		if (i == run_start) {
+			buf[len++] = ':';
+			buf[len++] = ':';
+			i += run_len - 1;
+			continue;
+		}
+		if (i != 0 && i != run_start + run_len)
+			buf[len++] = ':';
+		len += netaddr_format_group(buf + len, groups[i]);
+	}
+	return len;
+}
+
+static size_t netaddr_format_ipv4(char *buf, const uint8_t *bytes)
+{
+	size_t len = 0;
+	for (int i = 0; i < 4; i++) {
+		if (i != 0)
+			buf[len++] = '.';
+		len += fmt_u64(buf + len, bytes[i]);
+	}
+	return len;
+}
+
+static size_t netaddr_format_group(char *buf, uint16_t group)
+{
+	/* Without the leading zeros */
+	size_t len = 0;
+	for (int shift = 12; shift >= 0; shift -= 4) {
+		uint8_t digit = (group >> shift) & 0xf;
+		if (len == 0 && digit == 0 && shift != 0)
+			continue;
+		buf[len++] = "0123456789abcdef"[digit];
+	}
+	return len;
+}
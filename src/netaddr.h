@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP2SD_NETADDR_H
+#define HTTP2SD_NETADDR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <flibc/linux.h>
+
+/**
+ * The maximum amount of characters written by netaddr_format.
+ */
+#define NETADDR_MAX_LEN 39
+
+/**
+ * The address of a client, as an IPv6 address in network byte order. The TCP
+ * socket is dual-stack, so the IPv4 clients have an IPv4-mapped address
+ * (::ffff:a.b.c.d). The clients of the Unix socket have an address of all
+ * zeros.
+ */
+struct netaddr {
+	uint8_t bytes[16];
+};
+
+/**
+ * Sets addr to the address of an AF_INET6 or AF_INET socket address, or to all
+ * zeros for any other family.
+ */
+void netaddr_from_sockaddr(struct netaddr *addr, const struct sockaddr *sa);
+
+bool netaddr_is_zero(const struct netaddr *addr);
+
+/**
+ * Returns true if the address is an IPv4-mapped one, whose IPv4 address is then
+ * the last 4 bytes.
+ */
+bool netaddr_is_ipv4(const struct netaddr *addr);
+
+/**
+ * Writes the text representation of the address into the buffer, which must
+ * have space for at least NETADDR_MAX_LEN characters, and returns the amount of
+ * characters written. IPv4-mapped addresses are written as IPv4 addresses and
+ * the others as recommended by RFC 5952. No NULL character is written.
+ */
+size_t netaddr_format(char *buf, const struct netaddr *addr);
+
+#endif
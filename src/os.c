@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <flibc/linux.h>
+
+#include "os.h"
+#include "stats.h"
+#include "sysext.h"
+#include "vdso.h"
+
+int os_epoll_create1(int flags)
+{
+	stats_inc(SC_SYSCALLS);
+	return sys_epoll_create1(flags);
+}
+
+int os_epoll_ctl(int epoll_fd, int op, int fd, struct epoll_event *event)
+{
+	stats_inc(SC_SYSCALLS);
+	return sys_epoll_ctl(epoll_fd, op, fd, event);
+}
+
+int os_epoll_wait(int epoll_fd, struct epoll_event *events, int max_events,
+		  int timeout)
+{
+	stats_inc(SC_SYSCALLS);
+	return sys_epoll_wait(epoll_fd, events, max_events, timeout);
+}
+
+int os_signalfd(const uint64_t *mask)
+{
+	stats_inc(SC_SYSCALLS);
+	return sysext_signalfd4(-1, mask, SFD_CLOEXEC | SFD_NONBLOCK);
+}
+
+int os_openat(int dir_fd, const char *path, int flags)
+{
+	stats_inc(SC_SYSCALLS);
+	return sysext_openat(dir_fd, path, flags, 0);
+}
+
+int os_listen(int fd, int backlog)
+{
+	stats_inc(SC_SYSCALLS);
+	return sys_listen(fd, backlog);
+}
+
+int os_accept4(int fd, struct sockaddr *addr, socklen_t *addr_len, int flags)
+{
+	stats_inc(SC_SYSCALLS);
+	return sys_accept4(fd, addr, addr_len, flags);
+}
+
+ssize_t os_read(int fd, void *buf, size_t len)
+{
+	stats_inc(SC_SYSCALLS);
+	return sys_read(fd, buf, len);
+}
+
+ssize_t os_recvmsg(int fd, struct sysext_msghdr *msg, int flags)
+{
+	stats_inc(SC_SYSCALLS);
+	return sysext_recvmsg(fd, msg, flags);
+}
+
+ssize_t os_write(int fd, const void *buf, size_t len)
+{
+	stats_inc(SC_SYSCALLS);
+	return sys_write(fd, buf, len);
+}
+
+int os_close(int fd)
+{
+	stats_inc(SC_SYSCALLS);
+	return sys_close(fd);
+}
+
+int os_shutdown(int fd, int how)
+{
+	stats_inc(SC_SYSCALLS);
+	return sysext_shutdown(fd, how);
+}
+
+int os_setsockopt(int fd, int level, int name, const void *value,
+		  uint32_t value_len)
+{
+	stats_inc(SC_SYSCALLS);
+	return sysext_setsockopt(fd, level, name, value, value_len);
+}
+
+int os_getsockopt(int fd, int level, int name, void *value,
+		  uint32_t *value_len)
+{
+	stats_inc(SC_SYSCALLS);
+	return sysext_getsockopt(fd, level, name, value, value_len);
+}
+
+int os_ioctl(int fd, unsigned long request, void *arg)
+{
+	stats_inc(SC_SYSCALLS);
+	return sysext_ioctl(fd, request, arg);
+}
+
+int os_sched_yield()
+{
+	stats_inc(SC_SYSCALLS);
+	return sysext_sched_yield();
+}
+
+int os_clock_gettime(int clock_id, struct timespec *ts)
+{
+	/* The vDSO counts the syscall itself if it has to fall back to it. */
+	return vdso_clock_gettime(clock_id, ts);
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP2SD_OS_H
+#define HTTP2SD_OS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <flibc/linux.h>
+
+#include "sysext.h"
+
+/*
+ * The syscalls made by the event loop and the connections. They all go through
+ * this module so that the simulation harness can replace it with a fake
+ * implementation at link time (see tools/simos.c), and so that they are all
+ * counted in the syscalls statistic. The functions have the same semantics as
+ * the syscalls of the same name.
+ */
+
+int os_epoll_create1(int flags);
+int os_epoll_ctl(int epoll_fd, int op, int fd, struct epoll_event *event);
+int os_epoll_wait(int epoll_fd, struct epoll_event *events, int max_events,
+		  int timeout);
+
+/**
+ * Creates a non-blocking signalfd that receives the signals in the mask.
+ */
+int os_signalfd(const uint64_t *mask);
+
+int os_openat(int dir_fd, const char *path, int flags);
+int os_listen(int fd, int backlog);
+int os_accept4(int fd, struct sockaddr *addr, socklen_t *addr_len, int flags);
+ssize_t os_read(int fd, void *buf, size_t len);
+ssize_t os_recvmsg(int fd, struct sysext_msghdr *msg, int flags);
+ssize_t os_write(int fd, const void *buf, size_t len);
+int os_close(int fd);
+int os_shutdown(int fd, int how);
+int os_setsockopt(int fd, int level, int name, const void *value,
+		  uint32_t value_len);
+int os_getsockopt(int fd, int level, int name, void *value,
+		  uint32_t *value_len);
+int os_ioctl(int fd, unsigned long request, void *arg);
+int os_sched_yield();
+
+/**
+ * Reads the clock, which is not counted as a syscall when it goes through the
+ * vDSO.
+ */
+int os_clock_gettime(int clock_id, struct timespec *ts);
+
+#endif
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <flibc/linux.h>
+#include <flibc/mem.h>
+#include <flibc/util.h>
+
+#include "perf.h"
+#include "stats.h"
+#include "sysext.h"
+
+#define PERF_EVENT_COUNT 4
+
+struct perf_event {
+	uint64_t config;
+	enum stats_counter counter;
+};
+
+static const struct perf_event perf_events[PERF_EVENT_COUNT] = {
+    {PERF_COUNT_HW_CPU_CYCLES, SC_CYCLES},
+    {PERF_COUNT_HW_INSTRUCTIONS, SC_INSTRUCTIONS},
+    {PERF_COUNT_HW_CACHE_MISSES, SC_CACHE_MISSES},
+    {PERF_COUNT_HW_BRANCH_MISSES, SC_BRANCH_MISSES},
+};
+
+/* The FDs of the events that could be opened, in the order in which they were
+   added to the group, which is also the order of their values when the group
+   is read. The first one is the leader. */
+static int perf_fds[PERF_EVENT_COUNT];
+static enum stats_counter perf_counters[PERF_EVENT_COUNT];
+static uint32_t perf_count;
+
+static int perf_open(uint64_t config, int group_fd, uint64_t flags);
+
+bool perf_init()
+{
+	/* Counting the kernel requires a perf_event_paranoid setting of 1 or
+	   less, or the CAP_PERFMON capability. */
+	uint64_t flags = SYSEXT_PERF_EXCLUDE_HV;
+	int leader = perf_open(perf_events[0].config, -1, flags);
+	if (leader == -EACCES || leader == -EPERM) {
+		flags |= SYSEXT_PERF_EXCLUDE_KERNEL;
+		leader = perf_open(perf_events[0].config, -1, flags);
+	}
+	if (leader < 0) {
+		F_PRINT(2, "perf_event_open() failed\n");
+		return false;
+	}
+
+	perf_fds[0] = leader;
+	perf_counters[0] = perf_events[0].counter;
+	perf_count = 1;
+
+	for (uint32_t i = 1; i < PERF_EVENT_COUNT; i++) {
+		int fd = perf_open(perf_events[i].config, leader, flags);
+		if (fd < 0)
+			continue;
+
+		perf_fds[perf_count] = fd;
+		perf_counters[perf_count] = perf_events[i].counter;
+		perf_count++;
+	}
+
+	return true;
+}
+
+bool perf_is_enabled() { return perf_count != 0; }
+
+bool perf_collect()
+{
+	/* The values are preceded by their amount and by the times during
+	   which the group was enabled and actually counting, which differ when
+	   the kernel has to share the hardware counters between groups. */
+	uint64_t values[3 + PERF_EVENT_COUNT];
+	size_t len = (3 + perf_count) * sizeof(*values);
+	if (sys_read(perf_fds[0], values, len) != (ssize_t)len) {
+		F_PRINT(2, "read() failed for the performance counters\n");
+		return false;
+	}
+
+	uint64_t enabled = values[1];
+	uint64_t running = values[2];
+	for (uint32_t i = 0; i < perf_count; i++) {
+		uint64_t value = values[3 + i];
+		if (running != 0 && running < enabled)
+			value = (unsigned __int128)value * enabled / running;
+		stats_set(perf_counters[i], value);
+	}
+
+	return true;
+}
+
+void perf_close()
+{
+	for (uint32_t i = perf_count; i > 0; i--)
+		F_ASSERT(sys_close(perf_fds[i - 1]) == 0);
+	perf_count = 0;
+}
+
+static int perf_open(uint64_t config, int group_fd, uint64_t flags)
+{
+	struct sysext_perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = config;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+			   PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attr.flags = flags;
+
+	/* Only this worker is counted, on whatever CPU it runs. */
+	return sysext_perf_event_open(&attr, 0, -1, group_fd,
+				      PERF_FLAG_FD_CLOEXEC);
+}
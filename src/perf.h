@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP2SD_PERF_H
+#define HTTP2SD_PERF_H
+
+#include <stdbool.h>
+
+/*
+ * Counts the CPU cycles, instructions, cache misses and branch misses of the
+ * current worker with the hardware counters, through perf_event_open. The
+ * kernel counts while the worker runs and the counters are only read when the
+ * statistics are dumped, so the event loop does not do anything more.
+ */
+
+/**
+ * Opens the counters of the current worker. The kernel is counted too if the
+ * worker is allowed to, and only user space otherwise. The events that the
+ * CPU does not support are skipped.
+ */
+bool perf_init();
+
+/**
+ * Returns true if perf_init has been called.
+ */
+bool perf_is_enabled();
+
+/**
+ * Reads the counters into the statistics of the current worker. Returns false
+ * and leaves the statistics unchanged if they cannot be read.
+ */
+bool perf_collect();
+
+/**
+ * Closes the counters. It must be called before a retired worker exits,
+ * because the FD table is shared with the other workers.
+ */
+void perf_close();
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP2SD_PROBE_H
+#define HTTP2SD_PROBE_H
+
+#include <stdint.h>
+
+/*
+ * USDT (SystemTap SDT) probes that can be attached to with perf, bpftrace or
+ * any other tool that understands the .note.stapsdt ELF notes, e.g.:
+ *
+ *   bpftrace -e 'usdt:/usr/bin/http2sd:http2sd:close { @[arg2] = count(); }'
+ *
+ * A probe is a single nop instruction in the code, and a note that tells the
+ * tracer where it is and where its arguments can be found. The tracer replaces
+ * the nop with a breakpoint when it is attached. The arguments are always
+ * passed as signed 64-bit integers.
+ *
+ * Define HTTP2SD_NO_PROBES to remove the probes from the executable.
+ */
+
+#ifdef HTTP2SD_NO_PROBES
+
+#	define PROBE2(name, a1, a2)                                           \
+		do {                                                           \
+		} while (0)
+#	define PROBE3(name, a1, a2, a3)                                       \
+		do {                                                           \
+		} while (0)
+#	define PROBE4(name, a1, a2, a3, a4)                                   \
+		do {                                                           \
+		} while (0)
+
+#else
+
+#	define PROBE_ASM(name, args)                                          \
+		"990:	nop\n"                                               \
+		".pushsection .note.stapsdt,\"?\",\"note\"\n"                 \
+		".balign 4\n"                                                  \
+		".4byte 992f-991f, 994f-993f, 3\n"                             \
+		"991:	.asciz \"stapsdt\"\n"                                \
+		"992:	.balign 4\n"                                         \
+		"993:	.8byte 990b\n"                                       \
+		".8byte _.stapsdt.base\n"                                      \
+		".8byte 0\n"                                                   \
+		".asciz \"http2sd\"\n"                                         \
+		".asciz \"" #name "\"\n"                                       \
+		".asciz \"" args "\"\n"                                        \
+		"994:	.balign 4\n"                                         \
+		".popsection\n"                                                \
+		".ifndef _.stapsdt.base\n"                                     \
+		".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base," \
+		"comdat\n"                                                     \
+		".weak _.stapsdt.base\n"                                       \
+		".hidden _.stapsdt.base\n"                                     \
+		"_.stapsdt.base: .space 1\n"                                   \
+		".size _.stapsdt.base, 1\n"                                    \
+		".popsection\n"                                                \
+		".endif\n"
+
+#	define PROBE2(name, a1, a2)                                           \
+		__asm__ volatile(PROBE_ASM(name, "-8@%0 -8@%1")                \
+				 :                                             \
+				 : "nor"((int64_t)(a1)), "nor"((int64_t)(a2)))
+
+#	define PROBE3(name, a1, a2, a3)                                       \
+		__asm__ volatile(PROBE_ASM(name, "-8@%0 -8@%1 -8@%2")          \
+				 :                                             \
+				 : "nor"((int64_t)(a1)), "nor"((int64_t)(a2)), \
+				   "nor"((int64_t)(a3)))
+
+#	define PROBE4(name, a1, a2, a3, a4)                                   \
+		__asm__ volatile(PROBE_ASM(name, "-8@%0 -8@%1 -8@%2 -8@%3")    \
+				 :                                             \
+				 : "nor"((int64_t)(a1)), "nor"((int64_t)(a2)), \
+				   "nor"((int64_t)(a3)), "nor"((int64_t)(a4)))
+
+#endif
+
+#endif
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <flibc/mem.h>
+#include <flibc/util.h>
+
+#include "netaddr.h"
+#include "ratelimit.h"
+#include "sysext.h"
+
+/*
+ * The limits are enforced with token buckets, but instead of having one bucket
+ * per address, which would need an unbounded amount of memory, the addresses
+ * are hashed into a fixed amount of buckets, like in a count-min sketch. Every
+ * address maps to one bucket in each row, with an independent hash function
+ * per row. A connection is allowed if any of its buckets has a token left, and
+ * then a token is taken from all of them. An address is therefore only limited
+ * by mistake if it collides with an abusive one in every row.
+ */
+
+#define RATELIMIT_ROWS 2
+#define RATELIMIT_BUCKETS_LOG2 12
+#define RATELIMIT_BUCKETS (1 << RATELIMIT_BUCKETS_LOG2)
+
+/* The amount of tokens is stored in thousandths of a token, so that buckets
+   can be refilled every millisecond without losing precision. */
+#define RATELIMIT_TOKEN 1000
+
+struct ratelimit_bucket {
+	/**
+	 * The lower 32 bits of the time of the last refill in milliseconds.
+	 */
+	uint32_t last_refill;
+
+	uint32_t tokens;
+};
+
+static struct ratelimit_bucket ratelimit_buckets[RATELIMIT_ROWS]
+						[RATELIMIT_BUCKETS];
+
+/**
+ * Random keys for the hash functions, so that a client cannot choose
+ * addresses that collide with someone else's.
+ */
+static uint64_t ratelimit_keys[RATELIMIT_ROWS];
+
+static uint32_t ratelimit_rate;
+static uint32_t ratelimit_burst;
+
+static uint32_t ratelimit_hash(int row, uint64_t addr);
+static uint32_t ratelimit_refill(struct ratelimit_bucket *bucket,
+				 uint32_t now);
+
+bool ratelimit_init(uint32_t rate, uint32_t burst)
+{
+	F_ASSERT(rate != 0 && burst != 0);
+	F_ASSERT(burst <= UINT32_MAX / RATELIMIT_TOKEN);
+
+	if (sysext_getrandom(ratelimit_keys, sizeof(ratelimit_keys), 0) !=
+	    sizeof(ratelimit_keys)) {
+		F_PRINT(2, "getrandom() failed\n");
+		return false;
+	}
+
+	ratelimit_rate = rate;
+	ratelimit_burst = burst;
+
+	return true;
+}
+
+bool ratelimit_is_enabled() { return ratelimit_rate != 0; }
+
+bool ratelimit_allow(const struct netaddr *addr, uint64_t now)
+{
+	/* The IPv4 address is in the last 64 bits of an IPv4-mapped
+	   address. */
+	uint64_t key;
+	memcpy(&key, addr->bytes + (netaddr_is_ipv4(addr) ? 8 : 0),
+	       sizeof(key));
+
+	struct ratelimit_bucket *buckets[RATELIMIT_ROWS];
+	uint32_t max_tokens = 0;
+
+	for (int row = 0; row < RATELIMIT_ROWS; row++) {
+		buckets[row] =
+		    &ratelimit_buckets[row][ratelimit_hash(row, key)];
+
+		uint32_t tokens = ratelimit_refill(buckets[row], now);
+		if (tokens > max_tokens)
+			max_tokens = tokens;
+	}
+
+	if (max_tokens < RATELIMIT_TOKEN)
+		return false;
+
+	for (int row = 0; row < RATELIMIT_ROWS; row++) {
+		if (buckets[row]->tokens >= RATELIMIT_TOKEN)
+			buckets[row]->tokens -= RATELIMIT_TOKEN;
+		else
+			buckets[row]->tokens = 0;
+	}
+
+	return true;
+}
+
+static uint32_t ratelimit_hash(int row, uint64_t addr)
+{
+	/* Multiply-shift hashing, which keeps the upper bits of the product
+	   because they depend on all the bits of the input. */
+	uint64_t x = (addr ^ ratelimit_keys[row]) * 0x9e3779b97f4a7c15ULL;
+	x ^= x >> 29;
+	x *= ratelimit_keys[row] | 1;
+	return x >> (64 - RATELIMIT_BUCKETS_LOG2);
+}
+
+static uint32_t ratelimit_refill(struct ratelimit_bucket *bucket,
+				 uint32_t now)
+{
+	/* The subtraction wraps around correctly as long as a bucket is
+	   touched at least every 49 days. Otherwise, it just gets fewer tokens
+	   than it should. */
+	uint32_t elapsed = now - bucket->last_refill;
+	uint64_t tokens =
+	    bucket->tokens + (uint64_t)elapsed * ratelimit_rate;
+	uint32_t max = ratelimit_burst * RATELIMIT_TOKEN;
+
+	bucket->tokens = tokens > max ? max : tokens;
+	bucket->last_refill = now;
+
+	return bucket->tokens;
+}
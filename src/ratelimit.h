@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP2SD_RATELIMIT_H
+#define HTTP2SD_RATELIMIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "netaddr.h"
+
+/**
+ * Enables the rate limiting of new connections per client address. Every
+ * address can open up to rate connections per second, with bursts of up to
+ * burst connections. This must be called before the workers are cloned, and
+ * every worker then enforces the limit on the connections that it accepts.
+ */
+bool ratelimit_init(uint32_t rate, uint32_t burst);
+
+bool ratelimit_is_enabled();
+
+/**
+ * Returns true if a new connection from the given address is allowed at the
+ * given time in milliseconds, and takes it into account for the next ones. An
+ * IPv6 client usually has a whole /64, so only the first 64 bits of its address
+ * are taken into account.
+ */
+bool ratelimit_allow(const struct netaddr *addr, uint64_t now);
+
+#endif
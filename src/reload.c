@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdnoreturn.h>
+
+#include <flibc/linux.h>
+#include <flibc/util.h>
+
+#include "hostlist.h"
+#include "reload.h"
+#include "subnet.h"
+#include "sysext.h"
+
+/**
+ * The lists that can be reloaded. Each one has its own image and generation,
+ * so that a list that fails to compile does not keep the other from being
+ * reloaded.
+ */
+enum reload_list {
+	RELOAD_HOSTS,
+	RELOAD_SUBNETS,
+	RELOAD_LIST_COUNT,
+};
+
+/**
+ * The state that is shared by the workers and the builder processes.
+ */
+struct reload_control {
+	/**
+	 * For every list, the generation of the current image in the upper
+	 * half and its FD in the lower half, so that both can be read and
+	 * replaced at once.
+	 */
+	uint64_t current[RELOAD_LIST_COUNT];
+};
+
+static const char *const reload_names[RELOAD_LIST_COUNT] = {
+    [RELOAD_HOSTS] = "host list",
+    [RELOAD_SUBNETS] = "subnet list",
+};
+
+/* The paths of the lists, or NULL for the lists that are not used. */
+static const char *reload_paths[RELOAD_LIST_COUNT];
+
+static struct reload_control *reload_control;
+static int reload_event_fd = -1;
+
+/* The generation of the image of every list that this worker has mapped. */
+static uint32_t reload_generations[RELOAD_LIST_COUNT];
+
+/* The builder process started by this worker, or 0 if there is none. */
+static pid_t reload_builder;
+
+static bool reload_adopt_list(enum reload_list list);
+static bool reload_compile(enum reload_list list, uint32_t generation,
+			   int *fd);
+static bool reload_map(enum reload_list list, int fd, uint32_t generation);
+static noreturn void reload_run_builder(const uint64_t *current);
+static bool reload_publish(enum reload_list list, uint64_t current);
+static uint64_t reload_pack(uint32_t generation, int fd);
+
+bool reload_init(const char *hosts_path, const char *subnets_path)
+{
+	reload_paths[RELOAD_HOSTS] = hosts_path;
+	reload_paths[RELOAD_SUBNETS] = subnets_path;
+
+	reload_control =
+	    sysext_mmap(NULL, sizeof(*reload_control), PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (SYSEXT_IS_ERR(reload_control)) {
+		F_PRINT(2, "mmap() failed\n");
+		return false;
+	}
+
+	reload_event_fd = sysext_eventfd2(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (reload_event_fd < 0) {
+		F_PRINT(2, "eventfd() failed\n");
+		return false;
+	}
+
+	for (int i = 0; i < RELOAD_LIST_COUNT; i++) {
+		if (reload_paths[i] == NULL)
+			continue;
+
+		int fd;
+		if (!reload_compile(i, 1, &fd))
+			return false;
+		reload_control->current[i] = reload_pack(1, fd);
+	}
+
+	return true;
+}
+
+bool reload_is_enabled() { return reload_control != NULL; }
+
+int reload_get_event_fd() { return reload_event_fd; }
+
+bool reload_adopt()
+{
+	bool ok = true;
+	for (int i = 0; i < RELOAD_LIST_COUNT; i++) {
+		if (reload_paths[i] != NULL && !reload_adopt_list(i))
+			ok = false;
+	}
+	return ok;
+}
+
+bool reload_start()
+{
+	reload_reap();
+	if (reload_builder != 0) {
+		F_PRINT(2, "the lists are already being reloaded\n");
+		return true;
+	}
+
+	uint64_t current[RELOAD_LIST_COUNT];
+	for (int i = 0; i < RELOAD_LIST_COUNT; i++) {
+		current[i] = __atomic_load_n(&reload_control->current[i],
+					     __ATOMIC_ACQUIRE);
+	}
+
+	/* The builder shares the FD table, so that the memfds it creates are
+	   valid in every worker, but not the memory, so that compiling the
+	   lists does not touch the memory of the workers. */
+	pid_t child =
+	    sys_clone(CLONE_FILES | CLONE_FS | CLONE_IO | SIGCHLD, NULL, NULL,
+		      NULL, 0);
+	if (child < 0) {
+		F_PRINT(2, "clone() failed\n");
+		return true;
+	} else if (child == 0) {
+		reload_run_builder(current);
+	}
+
+	reload_builder = child;
+	return true;
+}
+
+void reload_reap()
+{
+	if (reload_builder == 0)
+		return;
+
+	int status;
+	if (sysext_wait4(reload_builder, &status, WNOHANG) == reload_builder)
+		reload_builder = 0;
+}
+
+static bool reload_adopt_list(enum reload_list list)
+{
+	for (;;) {
+		uint64_t current = __atomic_load_n(
+		    &reload_control->current[list], __ATOMIC_ACQUIRE);
+		uint32_t generation = current >> 32;
+		if (generation == reload_generations[list])
+			return true;
+
+		/* The image fails to map if it has been replaced, and its FD
+		   closed or reused, after the word was read, or if an image
+		   compiled offline is invalid. The images compiled offline do
+		   not carry the generation, so an image that did map is only
+		   adopted if it has not been replaced in the meantime
+		   either. */
+		bool mapped =
+		    reload_map(list, (int)(uint32_t)current, generation);
+		bool replaced = __atomic_load_n(&reload_control->current[list],
+						__ATOMIC_ACQUIRE) != current;
+		if (mapped && !replaced) {
+			reload_generations[list] = generation;
+			return true;
+		}
+		if (!mapped && !replaced) {
+			/* The previous image is still mapped, so it keeps
+			   being used until the next reload. */
+			if (reload_generations[list] != 0) {
+				F_PRINT(2, "failed to map the ");
+				F_PRINT(2, reload_names[list]);
+				F_PRINT(2, ", keeping the previous one\n");
+				return true;
+			}
+			F_PRINT(2, "failed to map the ");
+			F_PRINT(2, reload_names[list]);
+			F_PRINT(2, "\n");
+			return false;
+		}
+	}
+}
+
+static bool reload_compile(enum reload_list list, uint32_t generation,
+			   int *fd)
+{
+	const char *path = reload_paths[list];
+
+	/* An image of the host list that was compiled offline is published as
+	   it is, and the workers share its pages in the page cache. */
+	if (list == RELOAD_HOSTS) {
+		if (!hostlist_open_image(path, fd))
+			return false;
+		if (*fd >= 0)
+			return true;
+	}
+
+	*fd = sysext_memfd_create(list == RELOAD_HOSTS ? "http2sd-hosts"
+						       : "http2sd-subnets",
+				  MFD_CLOEXEC);
+	if (*fd < 0) {
+		F_PRINT(2, "memfd_create() failed\n");
+		return false;
+	}
+
+	bool ok = list == RELOAD_HOSTS
+		      ? hostlist_compile(path, *fd, generation)
+		      : subnet_compile(path, *fd, generation);
+	if (!ok) {
+		sys_close(*fd);
+		return false;
+	}
+
+	return true;
+}
+
+static bool reload_map(enum reload_list list, int fd, uint32_t generation)
+{
+	if (list == RELOAD_HOSTS)
+		return hostlist_map(fd, generation);
+	return subnet_map(fd, generation);
+}
+
+static noreturn void reload_run_builder(const uint64_t *current)
+{
+	bool published = false;
+	bool ok = true;
+	for (int i = 0; i < RELOAD_LIST_COUNT; i++) {
+		if (reload_paths[i] == NULL)
+			continue;
+
+		if (reload_publish(i, current[i]))
+			published = true;
+		else
+			ok = false;
+	}
+
+	/* The eventfd is never read, so every write is a new edge that wakes
+	   up every worker. */
+	uint64_t one = 1;
+	if (published &&
+	    sys_write(reload_event_fd, &one, sizeof(one)) != sizeof(one)) {
+		F_PRINT(2, "write() failed\n");
+		sys_exit(1);
+	}
+
+	sys_exit(ok ? 0 : 1);
+}
+
+/**
+ * Compiles a new image of the list and publishes it in place of the one of
+ * the given current word. Returns false if the previous image is kept.
+ */
+static bool reload_publish(enum reload_list list, uint64_t current)
+{
+	uint32_t generation = (current >> 32) + 1;
+	int fd;
+	if (!reload_compile(list, generation, &fd)) {
+		F_PRINT(2, "keeping the previous ");
+		F_PRINT(2, reload_names[list]);
+		F_PRINT(2, "\n");
+		return false;
+	}
+
+	/* Another worker's builder may have published an image of the same
+	   generation in the meantime, in which case this one is dropped. */
+	if (!__atomic_compare_exchange_n(&reload_control->current[list],
+					 &current, reload_pack(generation, fd),
+					 false, __ATOMIC_RELEASE,
+					 __ATOMIC_RELAXED)) {
+		sys_close(fd);
+		return false;
+	}
+
+	/* The workers keep their mapping of the previous image until they
+	   adopt the new one, so its FD is not needed anymore. */
+	sys_close((int)(uint32_t)current);
+	return true;
+}
+
+static uint64_t reload_pack(uint32_t generation, int fd)
+{
+	return (uint64_t)generation << 32 | (uint32_t)fd;
+}
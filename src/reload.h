@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP2SD_RELOAD_H
+#define HTTP2SD_RELOAD_H
+
+#include <stdbool.h>
+
+/*
+ * Reloads the host list and the subnet list without restarting the workers.
+ * Every list is compiled into an immutable image in a memfd, and its current
+ * image is published to every worker through a word in a shared mapping that
+ * holds its generation and its FD, which the FD table shared by the workers
+ * makes valid in all of them. On SIGHUP, a builder process compiles every list
+ * again into a new memfd and replaces its word with a compare-and-swap, then
+ * wakes up the workers with an eventfd. A worker maps the new images between
+ * two events and unmaps the previous ones, so a request is always checked
+ * against whole images and the event loop never takes a lock or waits for the
+ * builder. A list that fails to compile keeps its previous image without
+ * holding back the other one. A host list file that holds an image compiled
+ * offline is opened and published as it is instead, so it can be replaced by
+ * renaming a new image over it before SIGHUP.
+ */
+
+/**
+ * Compiles the first image of the lists of the files at the given paths, which
+ * can be NULL for a list that is not used, and creates the shared state. This
+ * must be called before the workers are cloned.
+ */
+bool reload_init(const char *hosts_path, const char *subnets_path);
+
+/**
+ * Returns true if reload_init has been called.
+ */
+bool reload_is_enabled();
+
+/**
+ * Returns the eventfd that becomes readable when a new image is published.
+ * It is never read, so it must be watched in edge-triggered mode.
+ */
+int reload_get_event_fd();
+
+/**
+ * Maps the current image of every list if this worker does not use it yet. It
+ * must be called once by every worker before serving requests and then every
+ * time the eventfd is signaled. If an image cannot be mapped, the previous one
+ * keeps being used, and false is only returned if there is none.
+ */
+bool reload_adopt();
+
+/**
+ * Reaps the builder process if it has exited. Must be called when SIGCHLD is
+ * received, which the builder sends whether it published an image or not.
+ */
+void reload_reap();
+
+/**
+ * Starts a builder process that compiles the lists again, unless the previous
+ * one is still running. Must be called when SIGHUP is received.
+ */
+bool reload_start();
+
+#endif
@@ -74,8 +74,17 @@ static enum reqparser_sub reqparser_host(struct reqparser_args *args);
 static void reqparser_fix_req_fields(struct reqparser_args *args,
 				     size_t old_host_index);
 
+static bool reqparser_single_shot(struct reqparser_args *args);
+static const char *reqparser_find(const char *data, const char *data_end,
+				  char ch);
+
 enum reqparser_completion reqparser_feed(struct reqparser_args *args)
 {
+	/* Almost every request arrives in one piece, so try to parse it in one
+	   pass before going through the resumable parser. */
+	if (args->state == RT_METHOD && reqparser_single_shot(args))
+		return PC_COMPLETE;
+
 	for (;;) {
 		F_ASSERT(args->data < args->data_end);
 
@@ -127,6 +136,11 @@ enum reqparser_completion reqparser_feed(struct reqparser_args *args)
 	}
 }
 
+bool reqparser_has_path(uint8_t state)
+{
+	return state >= RT_SKIP_LINE && state <= RT_HOST;
+}
+
 static enum reqparser_sub reqparser_method(struct reqparser_args *args)
 {
 	for (;;) {
@@ -285,6 +299,11 @@ static enum reqparser_sub reqparser_host(struct reqparser_args *args)
 			return RS_COMPLETE;
 		}
 
+		/* Like in the path, the NULL character would be taken for the
+		   end of the host when the parsing is resumed. */
+		if (ch == '\0')
+			return RS_ERROR;
+
 		/* We need at least one NULL character before the request Host
 		   header's value to delimit it from path. */
 		if (fill_index == 0 || args->req_fields[fill_index - 1] != '\0')
@@ -294,7 +313,6 @@ static enum reqparser_sub reqparser_host(struct reqparser_args *args)
 		fill_index--;
 
 		args->data++;
-		args->state++;
 
 		if (args->data == args->data_end)
 			return RS_EOF;
@@ -326,3 +344,91 @@ static void reqparser_fix_req_fields(struct reqparser_args *args,
 	if ((sep_index + 1) + host_len != args->req_fields_len)
 		args->req_fields[(sep_index + 1) + host_len] = '\0';
 }
+
+/**
+ * Parses a request whose request line and Host header are entirely in the
+ * data, and copies the path and the host into the request fields once they
+ * have been found, in the same layout as the resumable parser. Returns false
+ * without changing anything in any other case, including invalid requests,
+ * which are then left to the resumable parser so that they are reported in
+ * the same way whether they arrived in one piece or not.
+ */
+static bool reqparser_single_shot(struct reqparser_args *args)
+{
+	const char host_str[] = "Host: ";
+	const size_t host_str_len = sizeof(host_str) - 1;
+
+	const char *data_end = args->data_end;
+
+	const char *path = reqparser_find(args->data, data_end, ' ');
+	if (path == NULL)
+		return false;
+	path++;
+
+	const char *path_end = reqparser_find(path, data_end, ' ');
+	if (path_end == NULL || path_end == path || *path != '/')
+		return false;
+	size_t path_len = path_end - path;
+	for (size_t i = 0; i < path_len; i++) {
+		if (path[i] == '\0')
+			return false;
+	}
+
+	/* Skip the end of the request line and the headers until the Host
+	   header. Like the resumable parser, a line is skipped from the first
+	   character that does not match "Host: ". */
+	const char *line = path_end;
+	for (;;) {
+		line = reqparser_find(line, data_end, '\r');
+		if (line == NULL || line + 1 == data_end || line[1] != '\n')
+			return false;
+		line += 2;
+
+		size_t i = 0;
+		while (i < host_str_len && line + i != data_end &&
+		       line[i] == host_str[i])
+			i++;
+		if (i == host_str_len)
+			break;
+		if (line + i == data_end)
+			return false;
+		line += i + 1;
+	}
+
+	const char *host = line + host_str_len;
+	const char *host_end = reqparser_find(host, data_end, '\r');
+	if (host_end == NULL || host_end == host)
+		return false;
+	size_t host_len = host_end - host;
+	for (size_t i = 0; i < host_len; i++) {
+		if (host[i] == '\0')
+			return false;
+	}
+
+	/* The path and the host are separated by a NULL character, and the
+	   host is followed by another one unless it fills the buffer. */
+	if (path_len + 1 + host_len > args->req_fields_len)
+		return false;
+
+	memcpy(args->req_fields, path, path_len);
+	args->req_fields[path_len] = '\0';
+	memcpy(args->req_fields + path_len + 1, host, host_len);
+	if (path_len + 1 + host_len != args->req_fields_len)
+		args->req_fields[path_len + 1 + host_len] = '\0';
+
+	args->state = RT_HOST;
+	args->data = host_end;
+
+	return true;
+}
+
+static const char *reqparser_find(const char *data, const char *data_end,
+				  char ch)
+{
+	for (; data != data_end; data++) {
+		if (*data == ch)
+			return data;
+	}
+
+	return NULL;
+}
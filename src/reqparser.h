@@ -18,6 +18,7 @@
 #ifndef HTTP2SD_REQPARSER_H
 #define HTTP2SD_REQPARSER_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -62,4 +63,11 @@ enum reqparser_completion {
  */
 enum reqparser_completion reqparser_feed(struct reqparser_args *args);
 
+/**
+ * Returns true if the parser has read the whole request line in the given
+ * state, in which case the path is at the start of the request fields and
+ * followed by a NULL character.
+ */
+bool reqparser_has_path(uint8_t state);
+
 #endif
@@ -0,0 +1,365 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <flibc/linux.h>
+#include <flibc/util.h>
+
+#include "scale.h"
+#include "sysext.h"
+#include "vdso.h"
+
+/* How often the supervisor samples the load, in milliseconds. */
+#define SCALE_INTERVAL_MS 1000
+
+/* The load, in percents, above which a worker is added and below which one is
+   retired, and the amount of consecutive samples for which it must stay so,
+   which makes a short burst or pause not change anything. */
+#define SCALE_UP_LOAD 75
+#define SCALE_UP_SAMPLES 3
+#define SCALE_DOWN_LOAD 25
+#define SCALE_DOWN_SAMPLES 10
+
+enum scale_worker_state {
+	SWS_FREE,
+	SWS_RUNNING,
+	SWS_RETIRING,
+};
+
+/**
+ * The slot of a worker in the shared mapping. The load and the PID are only
+ * written by the worker and the state is only written by the supervisor,
+ * except that a slot goes back to SWS_FREE when its worker has exited. It has
+ * its own cache line so that the workers do not write to the same one.
+ */
+struct scale_worker {
+	uint64_t busy_ns;
+	uint32_t conn_count;
+	uint32_t conn_capacity;
+	uint32_t state;
+	pid_t pid;
+} __attribute__((aligned(64)));
+
+static struct scale_worker *scale_workers;
+static uint32_t scale_min_workers;
+static uint32_t scale_max_workers;
+
+/* Worker state */
+static struct scale_worker *scale_worker;
+static bool scale_worker_can_retire;
+
+/* Supervisor state */
+static pid_t scale_pids[SCALE_MAX_WORKERS];
+static uint64_t scale_last_busy_ns[SCALE_MAX_WORKERS];
+
+static uint32_t scale_run();
+static uint32_t scale_load(uint64_t elapsed_ns, uint32_t *running);
+static bool scale_spawn(uint32_t *worker_index);
+static void scale_retire();
+static void scale_reap();
+static bool scale_first_workers_have_exited();
+static bool scale_has_exited(pid_t pid);
+static uint64_t scale_now_ns();
+
+bool scale_init(uint32_t min_workers, uint32_t max_workers)
+{
+	F_ASSERT(min_workers < max_workers && max_workers <= SCALE_MAX_WORKERS);
+
+	/* The mapping is shared with the supervisor and the workers because it
+	   is created before they are cloned. */
+	void *workers = sysext_mmap(
+	    NULL, max_workers * sizeof(struct scale_worker),
+	    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (SYSEXT_IS_ERR(workers)) {
+		F_PRINT(2, "mmap() failed\n");
+		return false;
+	}
+
+	scale_workers = workers;
+	scale_min_workers = min_workers;
+	scale_max_workers = max_workers;
+
+	for (uint32_t i = 0; i < min_workers; i++)
+		scale_workers[i].state = SWS_RUNNING;
+
+	return true;
+}
+
+bool scale_is_enabled() { return scale_workers != NULL; }
+
+bool scale_start(uint32_t *worker_index)
+{
+	/* The supervisor is a sibling of the workers, like the logger, but the
+	   extra workers are its own children so that it can reap them. */
+	pid_t child =
+	    sys_clone(CLONE_FILES | CLONE_FS | CLONE_IO | CLONE_PARENT, NULL,
+		      NULL, NULL, 0);
+	if (child < 0) {
+		F_PRINT(2, "clone() failed\n");
+		return false;
+	} else if (child == 0) {
+		*worker_index = scale_run();
+	}
+
+	return true;
+}
+
+void scale_set_worker(uint32_t worker_index)
+{
+	F_ASSERT(worker_index < scale_max_workers);
+	scale_worker = &scale_workers[worker_index];
+	scale_worker_can_retire = worker_index >= scale_min_workers;
+	__atomic_store_n(&scale_worker->pid, sysext_getpid(), __ATOMIC_RELAXED);
+}
+
+bool scale_can_retire() { return scale_worker_can_retire; }
+
+void scale_report(uint64_t busy_ns, uint32_t conn_count,
+		  uint32_t conn_capacity)
+{
+	F_ASSERT(scale_worker != NULL);
+
+	/* The supervisor only needs a recent value of every field, not a
+	   consistent snapshot of all of them. */
+	__atomic_store_n(&scale_worker->busy_ns, busy_ns, __ATOMIC_RELAXED);
+	__atomic_store_n(&scale_worker->conn_count, conn_count,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&scale_worker->conn_capacity, conn_capacity,
+			 __ATOMIC_RELAXED);
+}
+
+bool scale_should_retire()
+{
+	return __atomic_load_n(&scale_worker->state, __ATOMIC_RELAXED) ==
+	       SWS_RETIRING;
+}
+
+static uint32_t scale_run()
+{
+	uint32_t up_samples = 0;
+	uint32_t down_samples = 0;
+	uint64_t last_ns = scale_now_ns();
+
+	for (;;) {
+		struct timespec duration;
+		duration.tv_sec = SCALE_INTERVAL_MS / 1000;
+		duration.tv_nsec = SCALE_INTERVAL_MS % 1000 * 1000000;
+		sysext_nanosleep(&duration);
+
+		scale_reap();
+
+		/* The first workers are not children of the supervisor, so it
+		   checks their pidfds to stop with them. The extra workers
+		   then finish serving their connections on their own. */
+		if (scale_first_workers_have_exited()) {
+			for (uint32_t i = scale_min_workers;
+			     i < scale_max_workers; i++) {
+				struct scale_worker *worker =
+				    &scale_workers[i];
+				if (worker->state == SWS_RUNNING)
+					__atomic_store_n(&worker->state,
+							 SWS_RETIRING,
+							 __ATOMIC_RELAXED);
+			}
+			sys_exit(0);
+		}
+
+		uint64_t now_ns = scale_now_ns();
+		uint32_t running;
+		uint32_t load = scale_load(now_ns - last_ns, &running);
+		last_ns = now_ns;
+
+		if (load >= SCALE_UP_LOAD && running < scale_max_workers) {
+			down_samples = 0;
+			if (++up_samples < SCALE_UP_SAMPLES)
+				continue;
+			up_samples = 0;
+
+			uint32_t worker_index;
+			if (scale_spawn(&worker_index))
+				return worker_index;
+		} else if (load <= SCALE_DOWN_LOAD &&
+			   running > scale_min_workers) {
+			up_samples = 0;
+			if (++down_samples < SCALE_DOWN_SAMPLES)
+				continue;
+			down_samples = 0;
+
+			scale_retire();
+		} else {
+			up_samples = 0;
+			down_samples = 0;
+		}
+	}
+}
+
+/**
+ * Returns the load of the running workers since the previous sample, which is
+ * the highest of the average share of the time that they spent handling
+ * events and of the share of their connections that are in use, in percents.
+ */
+static uint32_t scale_load(uint64_t elapsed_ns, uint32_t *running)
+{
+	uint64_t busy_ns = 0;
+	uint64_t conn_count = 0;
+	uint64_t conn_capacity = 0;
+	*running = 0;
+
+	for (uint32_t i = 0; i < scale_max_workers; i++) {
+		struct scale_worker *worker = &scale_workers[i];
+		uint64_t worker_busy_ns =
+		    __atomic_load_n(&worker->busy_ns, __ATOMIC_RELAXED);
+		uint64_t last_busy_ns = scale_last_busy_ns[i];
+		scale_last_busy_ns[i] = worker_busy_ns;
+
+		if (__atomic_load_n(&worker->state, __ATOMIC_RELAXED) !=
+		    SWS_RUNNING)
+			continue;
+
+		(*running)++;
+		busy_ns += worker_busy_ns - last_busy_ns;
+		conn_count +=
+		    __atomic_load_n(&worker->conn_count, __ATOMIC_RELAXED);
+		conn_capacity +=
+		    __atomic_load_n(&worker->conn_capacity, __ATOMIC_RELAXED);
+	}
+
+	uint32_t busy_load = 0;
+	if (*running != 0 && elapsed_ns != 0)
+		busy_load = busy_ns * 100 / (elapsed_ns * *running);
+
+	uint32_t conn_load = 0;
+	if (conn_capacity != 0)
+		conn_load = conn_count * 100 / conn_capacity;
+
+	return busy_load > conn_load ? busy_load : conn_load;
+}
+
+/**
+ * Clones a new worker. Returns true in the new worker, with the index of its
+ * slot, and false in the supervisor.
+ */
+static bool scale_spawn(uint32_t *worker_index)
+{
+	uint32_t i = scale_min_workers;
+	while (i < scale_max_workers && scale_workers[i].state != SWS_FREE)
+		i++;
+	if (i == scale_max_workers)
+		return false;
+
+	struct scale_worker *worker = &scale_workers[i];
+	worker->busy_ns = 0;
+	worker->conn_count = 0;
+	worker->conn_capacity = 0;
+	scale_last_busy_ns[i] = 0;
+	__atomic_store_n(&worker->state, SWS_RUNNING, __ATOMIC_RELAXED);
+
+	pid_t child = sys_clone(CLONE_FILES | CLONE_FS | CLONE_IO | SIGCHLD,
+				NULL, NULL, NULL, 0);
+	if (child < 0) {
+		F_PRINT(2, "clone() failed\n");
+		__atomic_store_n(&worker->state, SWS_FREE, __ATOMIC_RELAXED);
+		return false;
+	} else if (child == 0) {
+		*worker_index = i;
+		return true;
+	}
+
+	scale_pids[i] = child;
+	return false;
+}
+
+/**
+ * Asks the most recent extra worker to retire.
+ */
+static void scale_retire()
+{
+	for (uint32_t i = scale_max_workers; i > scale_min_workers; i--) {
+		struct scale_worker *worker = &scale_workers[i - 1];
+		if (worker->state == SWS_RUNNING) {
+			__atomic_store_n(&worker->state, SWS_RETIRING,
+					 __ATOMIC_RELAXED);
+			return;
+		}
+	}
+}
+
+/**
+ * Frees the slots of the workers that have exited, whether they have retired
+ * or crashed.
+ */
+static void scale_reap()
+{
+	for (;;) {
+		int status;
+		pid_t pid = sysext_wait4(-1, &status, WNOHANG);
+		if (pid <= 0)
+			return;
+
+		for (uint32_t i = scale_min_workers; i < scale_max_workers;
+		     i++) {
+			if (scale_pids[i] == pid) {
+				scale_pids[i] = 0;
+				__atomic_store_n(&scale_workers[i].state,
+						 SWS_FREE, __ATOMIC_RELAXED);
+				break;
+			}
+		}
+	}
+}
+
+/**
+ * Returns true if all the workers that were started at launch have exited.
+ */
+static bool scale_first_workers_have_exited()
+{
+	for (uint32_t i = 0; i < scale_min_workers; i++) {
+		/* The PID is 0 until the worker has called scale_set_worker. */
+		pid_t pid =
+		    __atomic_load_n(&scale_workers[i].pid, __ATOMIC_RELAXED);
+		if (pid == 0 || !scale_has_exited(pid))
+			return false;
+	}
+
+	return true;
+}
+
+static bool scale_has_exited(pid_t pid)
+{
+	/* A worker that has exited stays a zombie until its parent reaps it,
+	   and its pidfd is then readable. */
+	int pid_fd = sysext_pidfd_open(pid, 0);
+	if (pid_fd < 0)
+		return pid_fd == -ESRCH;
+
+	struct sysext_pollfd poll_fd;
+	poll_fd.fd = pid_fd;
+	poll_fd.events = POLLIN;
+	poll_fd.revents = 0;
+	bool has_exited = sysext_poll(&poll_fd, 1, 0) == 1;
+	sys_close(pid_fd);
+	return has_exited;
+}
+
+static uint64_t scale_now_ns()
+{
+	struct timespec ts;
+	F_ASSERT(vdso_clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP2SD_SCALE_H
+#define HTTP2SD_SCALE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Adjusts the amount of workers to the load. A supervisor process samples
+ * the time that every worker spends handling events and the share of its
+ * connections that are in use, which the workers publish in a shared mapping.
+ * It clones a new worker when the load stays high, and asks the most recent
+ * extra worker to retire when it stays low. A retiring worker stops accepting
+ * connections and exits once its last connection is closed.
+ *
+ * The first workers are never retired, so that there are always at least as
+ * many workers as the minimum. Once they have all exited, the supervisor asks
+ * the extra workers to retire and exits too.
+ */
+
+/**
+ * The maximum amount of workers.
+ */
+#define SCALE_MAX_WORKERS 256
+
+/**
+ * Creates the shared mapping. This must be called before the workers are
+ * cloned, and the minimum amount of workers must then be cloned like when
+ * scaling is disabled.
+ */
+bool scale_init(uint32_t min_workers, uint32_t max_workers);
+
+/**
+ * Returns true if scale_init has been called.
+ */
+bool scale_is_enabled();
+
+/**
+ * Clones the supervisor. It must be called by the first worker before
+ * anything else is initialized, because the extra workers are cloned from the
+ * supervisor and start from this call, which returns in them with the index
+ * of their worker.
+ */
+bool scale_start(uint32_t *worker_index);
+
+/**
+ * Sets the index of the current worker, which determines its slot in the
+ * shared mapping.
+ */
+void scale_set_worker(uint32_t worker_index);
+
+/**
+ * Returns true if the current worker can be asked to retire, and should
+ * therefore wake up from time to time to check whether it has been.
+ */
+bool scale_can_retire();
+
+/**
+ * Publishes the load of the current worker: the total amount of nanoseconds
+ * spent handling events and the amount of connections in use out of the
+ * capacity.
+ */
+void scale_report(uint64_t busy_ns, uint32_t conn_count,
+		  uint32_t conn_capacity);
+
+/**
+ * Returns true if the supervisor has asked the current worker to retire.
+ */
+bool scale_should_retire();
+
+#endif
@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <flibc/mem.h>
+#include <flibc/str.h>
+#include <flibc/util.h>
+
+#include "fmt.h"
+#include "stats.h"
+
+static uint64_t stats_counters[SC_COUNT];
+
+static const char *const stats_names[SC_COUNT] = {
+    [SC_SYSCALLS] = "syscalls",
+    [SC_REQUESTS] = "requests",
+    [SC_OTHER_RESPONSES] = "other_responses",
+    [SC_ACCESS_LOG_DROPS] = "access_log_drops",
+    [SC_ACCESS_LOG_STALLS] = "access_log_stalls",
+    [SC_RATE_LIMITED] = "rate_limited",
+    [SC_BUSY_POLL_HITS] = "busy_poll_hits",
+    [SC_BUSY_POLL_MISSES] = "busy_poll_misses",
+    [SC_CLOSE_ABORTS] = "close_aborts",
+    [SC_LINGER_FINS] = "linger_fins",
+    [SC_LINGER_TIMEOUTS] = "linger_timeouts",
+    [SC_LINGER_OVERFLOWS] = "linger_overflows",
+    [SC_LINGER_BYTES] = "linger_bytes",
+    [SC_HOSTS_REJECTED] = "hosts_rejected",
+    [SC_SUBNET_REDIRECTS] = "subnet_redirects",
+    [SC_HEALTH_CHECKS] = "health_checks",
+    [SC_HEALTH_CHECKS_FAILED] = "health_checks_failed",
+    [SC_REQUESTS_TOO_LARGE] = "requests_too_large",
+    [SC_READ_BUDGET_EXHAUSTED] = "read_budget_exhausted",
+    [SC_ACCEPT_BUDGET_EXHAUSTED] = "accept_budget_exhausted",
+    [SC_LISTEN_QUEUE] = "listen_queue",
+    [SC_LISTEN_QUEUE_PEAK] = "listen_queue_peak",
+    [SC_LISTEN_BACKLOG] = "listen_backlog",
+    [SC_LISTEN_OVERFLOWS] = "listen_overflows",
+    [SC_LISTEN_GROWTHS] = "listen_growths",
+    [SC_CYCLES] = "cycles",
+    [SC_INSTRUCTIONS] = "instructions",
+    [SC_CACHE_MISSES] = "cache_misses",
+    [SC_BRANCH_MISSES] = "branch_misses",
+};
+
+static uint64_t stats_rx_delays[STATS_RX_DELAY_BUCKETS];
+static uint64_t stats_rx_delay_count;
+
+static bool stats_print_pair(int fd, const char *name, uint64_t value);
+static bool stats_print_ratio(int fd, const char *name, uint64_t num,
+			      uint64_t den);
+static bool stats_print_rx_delays(int fd);
+static uint64_t stats_rx_delay_percentile(uint32_t percent);
+static uint64_t stats_rx_delay_bound(int bucket);
+
+void stats_inc(enum stats_counter counter) { stats_counters[counter]++; }
+
+void stats_add(enum stats_counter counter, uint64_t n)
+{
+	stats_counters[counter] += n;
+}
+
+void stats_set(enum stats_counter counter, uint64_t value)
+{
+	stats_counters[counter] = value;
+}
+
+uint64_t stats_get(enum stats_counter counter)
+{
+	return stats_counters[counter];
+}
+
+void stats_record_rx_delay(uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+
+	/* The bucket is the amount of significant bits of the delay. */
+	int bucket = us == 0 ? 0 : 64 - __builtin_clzll(us);
+	if (bucket >= STATS_RX_DELAY_BUCKETS)
+		bucket = STATS_RX_DELAY_BUCKETS - 1;
+
+	stats_rx_delays[bucket]++;
+	stats_rx_delay_count++;
+}
+
+bool stats_dump(int fd)
+{
+	for (int i = 0; i < SC_COUNT; i++) {
+		if (!stats_print_pair(fd, stats_names[i], stats_counters[i]))
+			return false;
+	}
+
+	if (stats_rx_delay_count != 0 && !stats_print_rx_delays(fd))
+		return false;
+
+	uint64_t requests = stats_counters[SC_REQUESTS];
+	uint64_t busy_polls = stats_counters[SC_BUSY_POLL_HITS] +
+			      stats_counters[SC_BUSY_POLL_MISSES];
+
+	return stats_print_ratio(fd, "syscalls_per_request",
+				 stats_counters[SC_SYSCALLS], requests) &&
+	       stats_print_ratio(fd, "busy_poll_hit_rate",
+				 stats_counters[SC_BUSY_POLL_HITS],
+				 busy_polls) &&
+	       stats_print_ratio(fd, "cycles_per_request",
+				 stats_counters[SC_CYCLES], requests) &&
+	       stats_print_ratio(fd, "instructions_per_request",
+				 stats_counters[SC_INSTRUCTIONS], requests) &&
+	       stats_print_ratio(fd, "instructions_per_cycle",
+				 stats_counters[SC_INSTRUCTIONS],
+				 stats_counters[SC_CYCLES]) &&
+	       stats_print_ratio(fd, "cache_misses_per_request",
+				 stats_counters[SC_CACHE_MISSES], requests) &&
+	       stats_print_ratio(fd, "branch_misses_per_request",
+				 stats_counters[SC_BRANCH_MISSES], requests);
+}
+
+static bool stats_print_pair(int fd, const char *name, uint64_t value)
+{
+	char num[FMT_U64_MAX_LEN + 2];
+	size_t num_len = fmt_u64(num, value);
+	num[num_len] = '\n';
+	num[num_len + 1] = '\0';
+
+	return F_PRINT(fd, name) && F_PRINT(fd, " ") && F_PRINT(fd, num);
+}
+
+static bool stats_print_ratio(int fd, const char *name, uint64_t num,
+			      uint64_t den)
+{
+	/* Print the ratio with two decimals without using floating point
+	   numbers. */
+	uint64_t hundredths = den == 0 ? 0 : num * 100 / den;
+
+	char buf[FMT_U64_MAX_LEN + 5];
+	size_t len = fmt_u64(buf, hundredths / 100);
+	buf[len++] = '.';
+	buf[len++] = '0' + hundredths / 10 % 10;
+	buf[len++] = '0' + hundredths % 10;
+	buf[len++] = '\n';
+	buf[len] = '\0';
+
+	return F_PRINT(fd, name) && F_PRINT(fd, " ") && F_PRINT(fd, buf);
+}
+
+static bool stats_print_rx_delays(int fd)
+{
+	/* The name of a bucket is its upper bound, except for the last one
+	   which has none. */
+	char name[32 + FMT_U64_MAX_LEN];
+	for (int i = 0; i < STATS_RX_DELAY_BUCKETS; i++) {
+		bool last = i == STATS_RX_DELAY_BUCKETS - 1;
+		const char *prefix =
+		    last ? "rx_delay_us_ge_" : "rx_delay_us_lt_";
+		size_t len = strlen(prefix);
+		memcpy(name, prefix, len);
+		len += fmt_u64(name + len,
+			       stats_rx_delay_bound(last ? i - 1 : i));
+		name[len] = '\0';
+
+		if (!stats_print_pair(fd, name, stats_rx_delays[i]))
+			return false;
+	}
+
+	return stats_print_pair(fd, "rx_delay_us_p50",
+				stats_rx_delay_percentile(50)) &&
+	       stats_print_pair(fd, "rx_delay_us_p99",
+				stats_rx_delay_percentile(99));
+}
+
+/* Returns the upper bound of the bucket that contains the percentile, which
+   overestimates it by at most a factor of two. */
+static uint64_t stats_rx_delay_percentile(uint32_t percent)
+{
+	uint64_t rank = (stats_rx_delay_count * percent + 99) / 100;
+	uint64_t seen = 0;
+	for (int i = 0; i < STATS_RX_DELAY_BUCKETS - 1; i++) {
+		seen += stats_rx_delays[i];
+		if (seen >= rank)
+			return stats_rx_delay_bound(i);
+	}
+
+	return stats_rx_delay_bound(STATS_RX_DELAY_BUCKETS - 2);
+}
+
+static uint64_t stats_rx_delay_bound(int bucket) { return 1ULL << bucket; }
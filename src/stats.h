@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP2SD_STATS_H
+#define HTTP2SD_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum stats_counter {
+	/**
+	 * Syscalls made by the event loop to serve clients.
+	 */
+	SC_SYSCALLS,
+
+	/**
+	 * Requests whose redirect has been entirely sent. The ratios per
+	 * request are relative to them.
+	 */
+	SC_REQUESTS,
+
+	/**
+	 * Responses other than redirects that have been entirely sent: health
+	 * checks, ACME challenges, rejected hosts and too long requests.
+	 */
+	SC_OTHER_RESPONSES,
+
+	/**
+	 * Access log records that were dropped because the ring was full.
+	 */
+	SC_ACCESS_LOG_DROPS,
+
+	/**
+	 * Times that a worker waited for the logger to make space in its ring,
+	 * with --access-log-wait.
+	 */
+	SC_ACCESS_LOG_STALLS,
+
+	/**
+	 * Connections that were closed right after being accepted because
+	 * their client exceeded the rate limit.
+	 */
+	SC_RATE_LIMITED,
+
+	/**
+	 * Busy polling loops that found an event before the end of their
+	 * budget.
+	 */
+	SC_BUSY_POLL_HITS,
+
+	/**
+	 * Busy polling loops that exhausted their budget, after which the
+	 * worker went to sleep in epoll_wait.
+	 */
+	SC_BUSY_POLL_MISSES,
+
+	/**
+	 * Connections that have been reset with SO_LINGER set to 0 after their
+	 * response.
+	 */
+	SC_CLOSE_ABORTS,
+
+	/**
+	 * Lingering connections that the client closed in time.
+	 */
+	SC_LINGER_FINS,
+
+	/**
+	 * Lingering connections that were closed because the client did not
+	 * close them in time.
+	 */
+	SC_LINGER_TIMEOUTS,
+
+	/**
+	 * Lingering connections that were closed because the client sent too
+	 * much data.
+	 */
+	SC_LINGER_OVERFLOWS,
+
+	/**
+	 * Bytes that have been read and discarded from lingering connections.
+	 */
+	SC_LINGER_BYTES,
+
+	/**
+	 * Requests that have been rejected because their host is not in the
+	 * host list.
+	 */
+	SC_HOSTS_REJECTED,
+
+	/**
+	 * Requests that have been redirected to the target of their client's
+	 * subnet.
+	 */
+	SC_SUBNET_REDIRECTS,
+
+	/**
+	 * Health checks that have been answered, and those of them that were
+	 * answered with a 503 because the worker was saturated.
+	 */
+	SC_HEALTH_CHECKS,
+	SC_HEALTH_CHECKS_FAILED,
+
+	/**
+	 * Connections that have been dropped because their request line and
+	 * headers were larger than CONN_MAX_REQUEST_BYTES.
+	 */
+	SC_REQUESTS_TOO_LARGE,
+
+	/**
+	 * Times that a connection still had data to read, or a server socket
+	 * connections to accept, when its budget for an iteration of the event
+	 * loop was exhausted.
+	 */
+	SC_READ_BUDGET_EXHAUSTED,
+	SC_ACCEPT_BUDGET_EXHAUSTED,
+
+	/**
+	 * The length and the limit of the accept queue of the TCP server
+	 * socket, and the longest queue that was seen, as sampled by the
+	 * backlog module.
+	 */
+	SC_LISTEN_QUEUE,
+	SC_LISTEN_QUEUE_PEAK,
+	SC_LISTEN_BACKLOG,
+
+	/**
+	 * The ListenOverflows counter of the network namespace, which counts
+	 * the connections that were dropped because an accept queue was full.
+	 */
+	SC_LISTEN_OVERFLOWS,
+
+	/**
+	 * Times that this worker has grown the backlog after overflows.
+	 */
+	SC_LISTEN_GROWTHS,
+
+	/**
+	 * CPU cycles, instructions, cache misses and branch misses of the
+	 * worker, which are read from the hardware counters by the perf module
+	 * right before the statistics are dumped.
+	 */
+	SC_CYCLES,
+	SC_INSTRUCTIONS,
+	SC_CACHE_MISSES,
+	SC_BRANCH_MISSES,
+
+	SC_COUNT,
+};
+
+/**
+ * Increments a counter of the current worker.
+ */
+void stats_inc(enum stats_counter counter);
+
+void stats_add(enum stats_counter counter, uint64_t n);
+void stats_set(enum stats_counter counter, uint64_t value);
+uint64_t stats_get(enum stats_counter counter);
+
+/**
+ * The amount of buckets of the receive delay histogram. The first bucket
+ * counts the delays under a microsecond, bucket i the delays from 2^(i-1) to
+ * 2^i microseconds and the last one every longer delay.
+ */
+#define STATS_RX_DELAY_BUCKETS 21
+
+/**
+ * Records in the histogram the time that the first bytes of a request spent
+ * in the kernel between their arrival and their read by the worker, in
+ * nanoseconds.
+ */
+void stats_record_rx_delay(uint64_t ns);
+
+/**
+ * Writes the counters of the current worker in a human and machine readable
+ * format (one "name value" pair per line) to the given FD. The receive delay
+ * histogram is only written once a delay has been recorded.
+ */
+bool stats_dump(int fd);
+
+#endif
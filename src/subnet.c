@@ -0,0 +1,663 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <flibc/linux.h>
+#include <flibc/mem.h>
+#include <flibc/util.h>
+
+#include "listfile.h"
+#include "netaddr.h"
+#include "subnet.h"
+#include "sysext.h"
+
+/* The entries of the table are either the index of a target plus one, 0 if no
+   prefix covers them, or the index of the chunk of the next level with this
+   bit set. */
+#define SUBNET_CHUNK 0x8000
+#define SUBNET_MAX_CHUNKS 0x8000
+
+/* The first level is indexed by the first 2 bytes of the address and every
+   next level by one more byte. */
+#define SUBNET_ROOT_BITS 16
+#define SUBNET_ROOT_LEN (1 << SUBNET_ROOT_BITS)
+#define SUBNET_CHUNK_BITS 8
+#define SUBNET_CHUNK_LEN (1 << SUBNET_CHUNK_BITS)
+
+#define SUBNET_MAX_TARGETS 4096
+
+/* "H2SN" */
+#define SUBNET_MAGIC 0x4e533248
+#define SUBNET_VERSION 1
+
+struct subnet_prefix {
+	/**
+	 * The address in network byte order, with the bits after the prefix
+	 * cleared. An IPv4 prefix only uses the first 4 bytes.
+	 */
+	uint8_t addr[16];
+
+	uint8_t len;
+	bool is_ipv6;
+	uint16_t entry;
+};
+
+struct subnet_target {
+	/**
+	 * The offset of the target in the text of the list while compiling,
+	 * then in the texts of the image.
+	 */
+	uint32_t offset;
+	uint32_t len;
+};
+
+/**
+ * The start of an image. It is followed by the first levels of the IPv4 and
+ * the IPv6 tables, the chunks of the next levels that they share, the targets
+ * and then the texts of the targets, which fill the rest of the image.
+ */
+struct subnet_image {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t generation;
+	uint64_t size;
+	uint32_t chunk_count;
+	uint32_t target_count;
+};
+
+_Static_assert(sizeof(struct subnet_image) % 8 == 0,
+	       "the tables that follow the image header must be aligned");
+
+/* The current image of this worker */
+static const struct subnet_image *subnet_image;
+static const uint16_t *subnet_ipv4_root;
+static const uint16_t *subnet_ipv6_root;
+static const uint16_t (*subnet_chunks)[SUBNET_CHUNK_LEN];
+static const struct subnet_target *subnet_targets;
+static const char *subnet_texts;
+
+/* The tables that are being compiled */
+static uint16_t (*subnet_build_chunks)[SUBNET_CHUNK_LEN];
+static uint32_t subnet_build_chunk_count;
+static uint32_t subnet_build_max_chunks;
+static struct subnet_target subnet_build_targets[SUBNET_MAX_TARGETS];
+static uint32_t subnet_build_target_count;
+
+static bool subnet_build(char *text, size_t text_len,
+			 struct subnet_prefix *prefixes, int out_fd,
+			 uint64_t generation);
+static bool subnet_write(const char *text, const uint16_t *roots, int out_fd,
+			 uint64_t generation);
+static size_t subnet_image_size(uint32_t chunk_count, uint32_t target_count,
+				uint32_t texts_len);
+static bool subnet_is_valid(const struct subnet_image *image);
+static bool subnet_parse(char *text, size_t text_len,
+			 struct subnet_prefix *prefixes, uint32_t *count);
+static bool subnet_parse_prefix(const char *text, size_t *pos, size_t end,
+				struct subnet_prefix *prefix);
+static bool subnet_parse_ipv4(const char *text, size_t *pos, size_t end,
+			      uint8_t *addr);
+static bool subnet_parse_ipv6(const char *text, size_t *pos, size_t end,
+			      uint8_t *addr);
+static int subnet_hex_digit(char ch);
+static bool subnet_parse_target(char *text, size_t start, size_t end,
+				uint16_t *entry);
+static bool subnet_insert(uint16_t *root, const struct subnet_prefix *prefix);
+static int subnet_child(uint16_t *entry);
+
+bool subnet_compile(const char *path, int out_fd, uint64_t generation)
+{
+	int fd = sysext_openat(AT_FDCWD, path, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0) {
+		F_PRINT(2, "open() failed for the subnet list\n");
+		return false;
+	}
+
+	int64_t text_len = sysext_lseek(fd, 0, SEEK_END);
+	if (text_len <= 0 || text_len > UINT32_MAX) {
+		F_PRINT(2, "the subnet list is empty, not a regular file or "
+			   "too big\n");
+		sys_close(fd);
+		return false;
+	}
+
+	/* The mapping is private, so that the targets can be converted to
+	   lower case in place without changing the file. */
+	char *text = sysext_mmap(NULL, text_len, PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE, fd, 0);
+	sys_close(fd);
+	if (SYSEXT_IS_ERR(text)) {
+		F_PRINT(2, "mmap() failed\n");
+		return false;
+	}
+
+	/* There cannot be more prefixes than lines. */
+	uint32_t max_count = 1;
+	for (int64_t i = 0; i < text_len; i++) {
+		if (text[i] == '\n')
+			max_count++;
+	}
+
+	size_t prefixes_size = max_count * sizeof(struct subnet_prefix);
+	struct subnet_prefix *prefixes = listfile_alloc(prefixes_size);
+	bool ok = prefixes != NULL &&
+		  subnet_build(text, text_len, prefixes, out_fd, generation);
+
+	if (prefixes != NULL)
+		listfile_free(prefixes, prefixes_size);
+	F_ASSERT(sysext_munmap(text, text_len) == 0);
+
+	return ok;
+}
+
+bool subnet_map(int fd, uint64_t generation)
+{
+	int64_t size = sysext_lseek(fd, 0, SEEK_END);
+	if (size < (int64_t)subnet_image_size(0, 0, 0))
+		return false;
+
+	const struct subnet_image *image =
+	    sysext_mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (SYSEXT_IS_ERR(image))
+		return false;
+
+	if (image->magic != SUBNET_MAGIC || image->version != SUBNET_VERSION ||
+	    image->generation != generation ||
+	    image->size != (uint64_t)size ||
+	    image->chunk_count > SUBNET_MAX_CHUNKS ||
+	    image->target_count > SUBNET_MAX_TARGETS ||
+	    subnet_image_size(image->chunk_count, image->target_count, 0) >
+		(uint64_t)size ||
+	    !subnet_is_valid(image)) {
+		F_ASSERT(sysext_munmap((void *)image, size) == 0);
+		return false;
+	}
+
+	/* A lookup is done in one go, so the previous image is not used
+	   anymore. */
+	if (subnet_image != NULL) {
+		F_ASSERT(sysext_munmap((void *)subnet_image,
+				       subnet_image->size) == 0);
+	}
+
+	subnet_image = image;
+	subnet_ipv4_root = (const uint16_t *)(image + 1);
+	subnet_ipv6_root = subnet_ipv4_root + SUBNET_ROOT_LEN;
+	subnet_chunks = (const void *)(subnet_ipv6_root + SUBNET_ROOT_LEN);
+	subnet_targets =
+	    (const struct subnet_target *)(subnet_chunks + image->chunk_count);
+	subnet_texts = (const char *)(subnet_targets + image->target_count);
+
+	return true;
+}
+
+bool subnet_is_enabled() { return subnet_image != NULL; }
+
+const char *subnet_lookup(const struct netaddr *addr, size_t *len)
+{
+	/* The IPv4 clients are looked up in the IPv4 table with the last 4
+	   bytes of their IPv4-mapped address. */
+	const uint16_t *root = subnet_ipv6_root;
+	const uint8_t *bytes = addr->bytes;
+	size_t bytes_len = sizeof(addr->bytes);
+	if (netaddr_is_ipv4(addr)) {
+		root = subnet_ipv4_root;
+		bytes += 12;
+		bytes_len = 4;
+	}
+
+	uint16_t entry = root[bytes[0] << 8 | bytes[1]];
+	for (size_t i = 2; i < bytes_len && (entry & SUBNET_CHUNK); i++)
+		entry = subnet_chunks[entry & ~SUBNET_CHUNK][bytes[i]];
+	if (entry == 0)
+		return NULL;
+
+	const struct subnet_target *target = &subnet_targets[entry - 1];
+	*len = target->len;
+	return subnet_texts + target->offset;
+}
+
+/**
+ * Parses the text of the list into the prefixes, which must have room for one
+ * prefix per line, expands them into the tables and writes the image into the
+ * file.
+ */
+static bool subnet_build(char *text, size_t text_len,
+			 struct subnet_prefix *prefixes, int out_fd,
+			 uint64_t generation)
+{
+	subnet_build_chunk_count = 0;
+	subnet_build_target_count = 0;
+
+	uint32_t count;
+	if (!subnet_parse(text, text_len, prefixes, &count))
+		return false;
+
+	/* Every prefix needs at most one chunk in each level after the first
+	   one that it is longer than. */
+	uint32_t max_chunks = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		if (prefixes[i].len > SUBNET_ROOT_BITS) {
+			max_chunks += (prefixes[i].len - SUBNET_ROOT_BITS +
+				       SUBNET_CHUNK_BITS - 1) /
+				      SUBNET_CHUNK_BITS;
+		}
+	}
+	if (max_chunks > SUBNET_MAX_CHUNKS)
+		max_chunks = SUBNET_MAX_CHUNKS;
+	subnet_build_max_chunks = max_chunks;
+
+	size_t root_size = SUBNET_ROOT_LEN * sizeof(uint16_t);
+	size_t tables_size =
+	    2 * root_size + max_chunks * sizeof(*subnet_build_chunks);
+	uint16_t *ipv4_root = listfile_alloc(tables_size);
+	if (ipv4_root == NULL)
+		return false;
+	uint16_t *ipv6_root = ipv4_root + SUBNET_ROOT_LEN;
+	subnet_build_chunks = (void *)(ipv6_root + SUBNET_ROOT_LEN);
+
+	/* The prefixes are inserted from the shortest to the longest, so that
+	   the longer ones overwrite the shorter ones that contain them, and
+	   that a chunk always inherits the entry that it replaces. The lines
+	   with the same prefix are inserted in order and the last one wins. */
+	bool ok = true;
+	for (uint32_t len = 0; ok && len <= 128; len++) {
+		for (uint32_t i = 0; ok && i < count; i++) {
+			const struct subnet_prefix *prefix = &prefixes[i];
+			uint16_t *root =
+			    prefix->is_ipv6 ? ipv6_root : ipv4_root;
+			if (prefix->len == len &&
+			    !subnet_insert(root, prefix)) {
+				F_PRINT(2, "too many prefixes in the subnet "
+					   "list\n");
+				ok = false;
+			}
+		}
+	}
+
+	ok = ok && subnet_write(text, ipv4_root, out_fd, generation);
+	listfile_free(ipv4_root, tables_size);
+	return ok;
+}
+
+/**
+ * Writes the image of the tables that have been built, whose roots are
+ * followed by their chunks, into the file.
+ */
+static bool subnet_write(const char *text, const uint16_t *roots, int out_fd,
+			 uint64_t generation)
+{
+	uint32_t texts_len = 0;
+	for (uint32_t i = 0; i < subnet_build_target_count; i++)
+		texts_len += subnet_build_targets[i].len;
+
+	size_t size = subnet_image_size(subnet_build_chunk_count,
+					subnet_build_target_count, texts_len);
+	if (sysext_ftruncate(out_fd, size) != 0) {
+		F_PRINT(2, "ftruncate() failed\n");
+		return false;
+	}
+	struct subnet_image *image = sysext_mmap(
+	    NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, out_fd, 0);
+	if (SYSEXT_IS_ERR(image)) {
+		F_PRINT(2, "mmap() failed\n");
+		return false;
+	}
+
+	/* The chunks that were not used are left out. */
+	size_t tables_len =
+	    2 * SUBNET_ROOT_LEN + subnet_build_chunk_count * SUBNET_CHUNK_LEN;
+	uint16_t *tables = (uint16_t *)(image + 1);
+	memcpy(tables, roots, tables_len * sizeof(uint16_t));
+
+	struct subnet_target *targets =
+	    (struct subnet_target *)(tables + tables_len);
+	char *texts = (char *)(targets + subnet_build_target_count);
+	uint32_t texts_offset = 0;
+	for (uint32_t i = 0; i < subnet_build_target_count; i++) {
+		const struct subnet_target *target = &subnet_build_targets[i];
+		memcpy(texts + texts_offset, text + target->offset,
+		       target->len);
+		targets[i].offset = texts_offset;
+		targets[i].len = target->len;
+		texts_offset += target->len;
+	}
+
+	image->magic = SUBNET_MAGIC;
+	image->version = SUBNET_VERSION;
+	image->generation = generation;
+	image->size = size;
+	image->chunk_count = subnet_build_chunk_count;
+	image->target_count = subnet_build_target_count;
+
+	F_ASSERT(sysext_munmap(image, size) == 0);
+	return true;
+}
+
+static size_t subnet_image_size(uint32_t chunk_count, uint32_t target_count,
+				uint32_t texts_len)
+{
+	return sizeof(struct subnet_image) +
+	       (2 * SUBNET_ROOT_LEN + (size_t)chunk_count * SUBNET_CHUNK_LEN) *
+		   sizeof(uint16_t) +
+	       (size_t)target_count * sizeof(struct subnet_target) + texts_len;
+}
+
+static bool subnet_is_valid(const struct subnet_image *image)
+{
+	/* Every entry that a lookup can follow is checked once here instead of
+	   on every request. */
+	const uint16_t *tables = (const uint16_t *)(image + 1);
+	size_t tables_len =
+	    2 * SUBNET_ROOT_LEN + (size_t)image->chunk_count * SUBNET_CHUNK_LEN;
+	for (size_t i = 0; i < tables_len; i++) {
+		uint16_t entry = tables[i];
+		if ((entry & SUBNET_CHUNK)
+			? (uint32_t)(entry & ~SUBNET_CHUNK) >=
+			      image->chunk_count
+			: entry > image->target_count)
+			return false;
+	}
+
+	const struct subnet_target *targets =
+	    (const struct subnet_target *)(tables + tables_len);
+	uint64_t texts_len =
+	    image->size -
+	    subnet_image_size(image->chunk_count, image->target_count, 0);
+	for (uint32_t i = 0; i < image->target_count; i++) {
+		if ((uint64_t)targets[i].offset + targets[i].len > texts_len)
+			return false;
+	}
+
+	return true;
+}
+
+static bool subnet_parse(char *text, size_t text_len,
+			 struct subnet_prefix *prefixes, uint32_t *count)
+{
+	*count = 0;
+
+	size_t line_start = 0;
+	while (line_start < text_len) {
+		size_t line_end = line_start;
+		while (line_end < text_len && text[line_end] != '\n')
+			line_end++;
+
+		size_t start = line_start;
+		size_t end = line_end;
+		line_start = line_end + 1;
+
+		while (start < end &&
+		       (text[start] == ' ' || text[start] == '\t'))
+			start++;
+		while (start < end &&
+		       (text[end - 1] == ' ' || text[end - 1] == '\t' ||
+			text[end - 1] == '\r'))
+			end--;
+
+		/* Empty lines and comments */
+		if (start == end || text[start] == '#')
+			continue;
+
+		struct subnet_prefix *prefix = &prefixes[*count];
+		size_t pos = start;
+		if (!subnet_parse_prefix(text, &pos, end, prefix)) {
+			F_PRINT(2, "invalid prefix in the subnet list\n");
+			return false;
+		}
+
+		if (pos == end || (text[pos] != ' ' && text[pos] != '\t')) {
+			F_PRINT(2, "missing target in the subnet list\n");
+			return false;
+		}
+		while (text[pos] == ' ' || text[pos] == '\t')
+			pos++;
+
+		if (!subnet_parse_target(text, pos, end, &prefix->entry))
+			return false;
+		(*count)++;
+	}
+
+	return true;
+}
+
+static bool subnet_parse_prefix(const char *text, size_t *pos, size_t end,
+				struct subnet_prefix *prefix)
+{
+	size_t i = *pos;
+
+	/* Only the IPv6 addresses contain colons. */
+	prefix->is_ipv6 = false;
+	for (size_t j = i; j < end && text[j] != ' ' && text[j] != '\t'; j++) {
+		if (text[j] == ':')
+			prefix->is_ipv6 = true;
+	}
+
+	memset(prefix->addr, 0, sizeof(prefix->addr));
+	if (prefix->is_ipv6 ? !subnet_parse_ipv6(text, &i, end, prefix->addr)
+			    : !subnet_parse_ipv4(text, &i, end, prefix->addr))
+		return false;
+
+	/* A lone address is a prefix of all its bits. */
+	uint32_t max_len = prefix->is_ipv6 ? 128 : 32;
+	uint32_t value = max_len;
+	if (i < end && text[i] == '/') {
+		i++;
+		value = 0;
+		size_t digits = 0;
+		for (; i < end && text[i] >= '0' && text[i] <= '9'; i++) {
+			value = value * 10 + (text[i] - '0');
+			if (++digits > 3)
+				return false;
+		}
+		if (digits == 0 || value > max_len)
+			return false;
+	}
+
+	/* Bits after the prefix are most likely a typo. */
+	for (uint32_t byte = 0; byte < max_len / 8; byte++) {
+		uint32_t kept = value > byte * 8 ? value - byte * 8 : 0;
+		uint8_t mask = kept >= 8 ? 0xff : (uint8_t)(0xff00 >> kept);
+		if ((prefix->addr[byte] & ~mask) != 0)
+			return false;
+	}
+
+	prefix->len = value;
+	*pos = i;
+	return true;
+}
+
+static bool subnet_parse_ipv4(const char *text, size_t *pos, size_t end,
+			      uint8_t *addr)
+{
+	size_t i = *pos;
+
+	for (int octet = 0; octet < 4; octet++) {
+		if (octet != 0) {
+			if (i == end || text[i] != '.')
+				return false;
+			i++;
+		}
+
+		uint32_t value = 0;
+		size_t digits = 0;
+		for (; i < end && text[i] >= '0' && text[i] <= '9'; i++) {
+			value = value * 10 + (text[i] - '0');
+			if (++digits > 3)
+				return false;
+		}
+		if (digits == 0 || value > 255)
+			return false;
+		addr[octet] = value;
+	}
+
+	*pos = i;
+	return true;
+}
+
+static bool subnet_parse_ipv6(const char *text, size_t *pos, size_t end,
+			      uint8_t *addr)
+{
+	size_t i = *pos;
+
+	/* The groups after "::" are moved to the end once they are all
+	   known. */
+	uint16_t groups[8];
+	int count = 0;
+	int gap = -1;
+
+	if (end - i >= 2 && text[i] == ':' && text[i + 1] == ':') {
+		gap = 0;
+		i += 2;
+	}
+
+	while (count < 8) {
+		uint32_t value = 0;
+		size_t digits = 0;
+		for (; i < end && subnet_hex_digit(text[i]) >= 0; i++) {
+			value = value * 16 + subnet_hex_digit(text[i]);
+			if (++digits > 4)
+				return false;
+		}
+		if (digits == 0) {
+			/* Only "::" can be followed by nothing. */
+			if (gap != count)
+				return false;
+			break;
+		}
+		groups[count++] = value;
+
+		if (end - i >= 2 && text[i] == ':' && text[i + 1] == ':') {
+			if (gap != -1)
+				return false;
+			gap = count;
+			i += 2;
+		} else if (i < end && text[i] == ':' && count < 8) {
+			i++;
+		} else {
+			break;
+		}
+	}
+
+	/* "::" stands for at least one group of zeros. */
+	if (gap == -1 ? count != 8 : count == 8)
+		return false;
+
+	int tail = gap == -1 ? 0 : count - gap;
+	for (int g = 0; g < count; g++) {
+		int index = g < count - tail ? g : 8 - (count - g);
+		addr[2 * index] = groups[g] >> 8;
+		addr[2 * index + 1] = groups[g] & 0xff;
+	}
+
+	*pos = i;
+	return true;
+}
+
+static int subnet_hex_digit(char ch)
+{
+	if (ch >= '0' && ch <= '9')
+		return ch - '0';
+	if (ch >= 'a' && ch <= 'f')
+		return ch - 'a' + 10;
+	if (ch >= 'A' && ch <= 'F')
+		return ch - 'A' + 10;
+	return -1;
+}
+
+static bool subnet_parse_target(char *text, size_t start, size_t end,
+				uint16_t *entry)
+{
+	if (!listfile_check_target(text + start, end - start)) {
+		F_PRINT(2, "invalid target in the subnet list\n");
+		return false;
+	}
+
+	/* There are only a few regions, so the targets are shared with a
+	   linear search. */
+	uint32_t len = end - start;
+	for (uint32_t i = 0; i < subnet_build_target_count; i++) {
+		const struct subnet_target *target = &subnet_build_targets[i];
+		if (target->len == len &&
+		    memcmp(text + target->offset, text + start, len) == 0) {
+			*entry = i + 1;
+			return true;
+		}
+	}
+
+	if (subnet_build_target_count == SUBNET_MAX_TARGETS) {
+		F_PRINT(2, "too many targets in the subnet list\n");
+		return false;
+	}
+	struct subnet_target *target =
+	    &subnet_build_targets[subnet_build_target_count++];
+	target->offset = start;
+	target->len = len;
+	*entry = subnet_build_target_count;
+	return true;
+}
+
+static bool subnet_insert(uint16_t *root, const struct subnet_prefix *prefix)
+{
+	uint16_t *table = root;
+	uint32_t index = prefix->addr[0] << 8 | prefix->addr[1];
+
+	/* The amount of bits of the address up to the end of the index */
+	uint32_t depth = SUBNET_ROOT_BITS;
+	size_t next_byte = 2;
+
+	while (prefix->len > depth) {
+		int chunk = subnet_child(&table[index]);
+		if (chunk < 0)
+			return false;
+
+		table = subnet_build_chunks[chunk];
+		index = prefix->addr[next_byte++];
+		depth += SUBNET_CHUNK_BITS;
+	}
+
+	/* Expand the prefix to all the entries that it covers. The bits of the
+	   index after the prefix are cleared. */
+	uint32_t entries = 1 << (depth - prefix->len);
+	for (uint32_t i = 0; i < entries; i++)
+		table[index + i] = prefix->entry;
+
+	return true;
+}
+
+/**
+ * Returns the chunk that the entry points to, after replacing the entry with a
+ * new chunk filled with it if it does not point to one yet, or -1 if there is
+ * no chunk left.
+ */
+static int subnet_child(uint16_t *entry)
+{
+	if (!(*entry & SUBNET_CHUNK)) {
+		if (subnet_build_chunk_count == subnet_build_max_chunks)
+			return -1;
+
+		uint16_t *chunk = subnet_build_chunks[subnet_build_chunk_count];
+		for (int i = 0; i < SUBNET_CHUNK_LEN; i++)
+			chunk[i] = *entry;
+		*entry = SUBNET_CHUNK | subnet_build_chunk_count++;
+	}
+
+	return *entry & ~SUBNET_CHUNK;
+}
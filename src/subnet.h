@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP2SD_SUBNET_H
+#define HTTP2SD_SUBNET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "netaddr.h"
+
+/*
+ * Maps the client subnets to the hosts that their requests are redirected to,
+ * so that every client is sent to the frontend of its region. The file has one
+ * IPv4 or IPv6 prefix per line, such as 192.0.2.0/24 or 2001:db8::/32, followed
+ * by the target host and an optional port, and the longest prefix that contains
+ * the address of the client wins. The IPv4 clients are only matched by the
+ * IPv4 prefixes, even though the socket gives them an IPv4-mapped address.
+ *
+ * The prefixes are expanded into a multibit trie per address family, with a
+ * first level of 16 bits and then one level per byte, like DIR-24-8 but with a
+ * much smaller first level. An IPv4 lookup is therefore at most three
+ * dependent loads from a table that fits in the caches, and an IPv6 one is one
+ * load more per byte of the longest prefix that contains the address.
+ *
+ * The tables are compiled into an image that does not contain any pointer, like
+ * the host list, so that it can be written to a memfd and mapped by every
+ * worker, and a new one is compiled and published when the server is reloaded.
+ */
+
+/**
+ * Compiles the list of the file at path into an image written to out_fd, which
+ * is resized to the size of the image. The image records the generation, so
+ * that a reader can check that it maps the image that it expects.
+ */
+bool subnet_compile(const char *path, int out_fd, uint64_t generation);
+
+/**
+ * Maps the image of the FD and makes it the current list of this worker,
+ * unmapping the previous one. Returns false if the FD does not contain an
+ * image of the given generation, or if one of its entries points outside of
+ * the image, in which case the current list is kept.
+ */
+bool subnet_map(int fd, uint64_t generation);
+
+/**
+ * Returns true if an image has been mapped.
+ */
+bool subnet_is_enabled();
+
+/**
+ * Returns the target of the longest prefix that contains the given address and
+ * sets len to its length, or returns NULL if no prefix contains it. The target
+ * points into the image, so it is only valid until the next image is mapped.
+ */
+const char *subnet_lookup(const struct netaddr *addr, size_t *len);
+
+#endif
@@ -0,0 +1,276 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+
+#include "sysext.h"
+
+#ifndef __x86_64__
+#	error "only x86_64 is supported"
+#endif
+
+#define SYSEXT_NR_POLL 7
+#define SYSEXT_NR_LSEEK 8
+#define SYSEXT_NR_MMAP 9
+#define SYSEXT_NR_MUNMAP 11
+#define SYSEXT_NR_RT_SIGPROCMASK 14
+#define SYSEXT_NR_IOCTL 16
+#define SYSEXT_NR_SCHED_YIELD 24
+#define SYSEXT_NR_NANOSLEEP 35
+#define SYSEXT_NR_GETPID 39
+#define SYSEXT_NR_CONNECT 42
+#define SYSEXT_NR_RECVMSG 47
+#define SYSEXT_NR_SHUTDOWN 48
+#define SYSEXT_NR_SETSOCKOPT 54
+#define SYSEXT_NR_GETSOCKOPT 55
+#define SYSEXT_NR_WAIT4 61
+#define SYSEXT_NR_FTRUNCATE 77
+#define SYSEXT_NR_WAITID 247
+#define SYSEXT_NR_GETDENTS64 217
+#define SYSEXT_NR_INOTIFY_ADD_WATCH 254
+#define SYSEXT_NR_OPENAT 257
+#define SYSEXT_NR_MKDIRAT 258
+#define SYSEXT_NR_NEWFSTATAT 262
+#define SYSEXT_NR_UNLINKAT 263
+#define SYSEXT_NR_RENAMEAT 264
+#define SYSEXT_NR_FCHMODAT 268
+#define SYSEXT_NR_SIGNALFD4 289
+#define SYSEXT_NR_EVENTFD2 290
+#define SYSEXT_NR_INOTIFY_INIT1 294
+#define SYSEXT_NR_PERF_EVENT_OPEN 298
+#define SYSEXT_NR_PRLIMIT64 302
+#define SYSEXT_NR_GETRANDOM 318
+#define SYSEXT_NR_MEMFD_CREATE 319
+#define SYSEXT_NR_PIDFD_OPEN 434
+
+static long sysext_syscall(long nr, long a, long b, long c, long d, long e,
+			   long f);
+
+int sysext_rt_sigprocmask(int how, const uint64_t *set, uint64_t *old_set)
+{
+	return sysext_syscall(SYSEXT_NR_RT_SIGPROCMASK, how, (long)set,
+			      (long)old_set, sizeof(*set), 0, 0);
+}
+
+int sysext_signalfd4(int fd, const uint64_t *mask, int flags)
+{
+	return sysext_syscall(SYSEXT_NR_SIGNALFD4, fd, (long)mask,
+			      sizeof(*mask), flags, 0, 0);
+}
+
+int sysext_openat(int dir_fd, const char *path, int flags, int mode)
+{
+	return sysext_syscall(SYSEXT_NR_OPENAT, dir_fd, (long)path, flags,
+			      mode, 0, 0);
+}
+
+int sysext_newfstatat(int dir_fd, const char *path, struct sysext_stat *st,
+		      int flags)
+{
+	return sysext_syscall(SYSEXT_NR_NEWFSTATAT, dir_fd, (long)path,
+			      (long)st, flags, 0, 0);
+}
+
+int sysext_mkdirat(int dir_fd, const char *path, uint32_t mode)
+{
+	return sysext_syscall(SYSEXT_NR_MKDIRAT, dir_fd, (long)path, mode, 0, 0,
+			      0);
+}
+
+int sysext_unlinkat(int dir_fd, const char *path, int flags)
+{
+	return sysext_syscall(SYSEXT_NR_UNLINKAT, dir_fd, (long)path, flags, 0,
+			      0, 0);
+}
+
+int sysext_renameat(int old_dir_fd, const char *old_path, int new_dir_fd,
+		    const char *new_path)
+{
+	return sysext_syscall(SYSEXT_NR_RENAMEAT, old_dir_fd, (long)old_path,
+			      new_dir_fd, (long)new_path, 0, 0);
+}
+
+int sysext_fchmodat(int dir_fd, const char *path, uint32_t mode)
+{
+	return sysext_syscall(SYSEXT_NR_FCHMODAT, dir_fd, (long)path, mode, 0,
+			      0, 0);
+}
+
+int sysext_ftruncate(int fd, int64_t len)
+{
+	return sysext_syscall(SYSEXT_NR_FTRUNCATE, fd, len, 0, 0, 0, 0);
+}
+
+int sysext_memfd_create(const char *name, unsigned int flags)
+{
+	return sysext_syscall(SYSEXT_NR_MEMFD_CREATE, (long)name, flags, 0, 0,
+			      0, 0);
+}
+
+int sysext_eventfd2(unsigned int value, int flags)
+{
+	return sysext_syscall(SYSEXT_NR_EVENTFD2, value, flags, 0, 0, 0, 0);
+}
+
+pid_t sysext_wait4(pid_t pid, int *status, int options)
+{
+	return sysext_syscall(SYSEXT_NR_WAIT4, pid, (long)status, options, 0,
+			      0, 0);
+}
+
+int sysext_waitid(int id_type, pid_t id, int options)
+{
+	/* A siginfo structure is 128 bytes long. */
+	uint64_t info[16];
+	return sysext_syscall(SYSEXT_NR_WAITID, id_type, id, (long)info,
+			      options, 0, 0);
+}
+
+int sysext_pidfd_open(pid_t pid, unsigned int flags)
+{
+	return sysext_syscall(SYSEXT_NR_PIDFD_OPEN, pid, flags, 0, 0, 0, 0);
+}
+
+int sysext_poll(struct sysext_pollfd *fds, uint32_t count, int timeout)
+{
+	return sysext_syscall(SYSEXT_NR_POLL, (long)fds, count, timeout, 0, 0,
+			      0);
+}
+
+int sysext_prlimit64(pid_t pid, int resource,
+		     const struct sysext_rlimit *new_limit,
+		     struct sysext_rlimit *old_limit)
+{
+	return sysext_syscall(SYSEXT_NR_PRLIMIT64, pid, resource,
+			      (long)new_limit, (long)old_limit, 0, 0);
+}
+
+int64_t sysext_lseek(int fd, int64_t offset, int whence)
+{
+	return sysext_syscall(SYSEXT_NR_LSEEK, fd, offset, whence, 0, 0, 0);
+}
+
+ssize_t sysext_getdents64(int fd, void *buf, size_t len)
+{
+	return sysext_syscall(SYSEXT_NR_GETDENTS64, fd, (long)buf, len, 0, 0,
+			      0);
+}
+
+int sysext_inotify_init1(int flags)
+{
+	return sysext_syscall(SYSEXT_NR_INOTIFY_INIT1, flags, 0, 0, 0, 0, 0);
+}
+
+int sysext_inotify_add_watch(int fd, const char *path, uint32_t mask)
+{
+	return sysext_syscall(SYSEXT_NR_INOTIFY_ADD_WATCH, fd, (long)path,
+			      mask, 0, 0, 0);
+}
+
+int sysext_ioctl(int fd, unsigned long request, void *arg)
+{
+	return sysext_syscall(SYSEXT_NR_IOCTL, fd, request, (long)arg, 0, 0, 0);
+}
+
+int sysext_connect(int fd, const struct sockaddr *addr, uint32_t addr_len)
+{
+	return sysext_syscall(SYSEXT_NR_CONNECT, fd, (long)addr, addr_len, 0, 0,
+			      0);
+}
+
+int sysext_shutdown(int fd, int how)
+{
+	return sysext_syscall(SYSEXT_NR_SHUTDOWN, fd, how, 0, 0, 0, 0);
+}
+
+ssize_t sysext_recvmsg(int fd, struct sysext_msghdr *msg, int flags)
+{
+	return sysext_syscall(SYSEXT_NR_RECVMSG, fd, (long)msg, flags, 0, 0, 0);
+}
+
+int sysext_setsockopt(int fd, int level, int name, const void *value,
+		      uint32_t value_len)
+{
+	return sysext_syscall(SYSEXT_NR_SETSOCKOPT, fd, level, name,
+			      (long)value, value_len, 0);
+}
+
+int sysext_getsockopt(int fd, int level, int name, void *value,
+		      uint32_t *value_len)
+{
+	return sysext_syscall(SYSEXT_NR_GETSOCKOPT, fd, level, name,
+			      (long)value, (long)value_len, 0);
+}
+
+int sysext_perf_event_open(const struct sysext_perf_event_attr *attr,
+			   pid_t pid, int cpu, int group_fd,
+			   unsigned long flags)
+{
+	return sysext_syscall(SYSEXT_NR_PERF_EVENT_OPEN, (long)attr, pid, cpu,
+			      group_fd, flags, 0);
+}
+
+void *sysext_mmap(void *addr, size_t len, int prot, int flags, int fd,
+		  int64_t offset)
+{
+	return (void *)sysext_syscall(SYSEXT_NR_MMAP, (long)addr, len, prot,
+				      flags, fd, offset);
+}
+
+int sysext_munmap(void *addr, size_t len)
+{
+	return sysext_syscall(SYSEXT_NR_MUNMAP, (long)addr, len, 0, 0, 0, 0);
+}
+
+ssize_t sysext_getrandom(void *buf, size_t len, unsigned int flags)
+{
+	return sysext_syscall(SYSEXT_NR_GETRANDOM, (long)buf, len, flags, 0, 0,
+			      0);
+}
+
+int sysext_nanosleep(const struct timespec *duration)
+{
+	return sysext_syscall(SYSEXT_NR_NANOSLEEP, (long)duration, 0, 0, 0, 0,
+			      0);
+}
+
+int sysext_sched_yield()
+{
+	return sysext_syscall(SYSEXT_NR_SCHED_YIELD, 0, 0, 0, 0, 0, 0);
+}
+
+pid_t sysext_getpid()
+{
+	return sysext_syscall(SYSEXT_NR_GETPID, 0, 0, 0, 0, 0, 0);
+}
+
+static long sysext_syscall(long nr, long a, long b, long c, long d, long e,
+			   long f)
+{
+	register long r10 __asm__("r10") = d;
+	register long r8 __asm__("r8") = e;
+	register long r9 __asm__("r9") = f;
+	long ret;
+
+	__asm__ volatile("syscall"
+			 : "=a"(ret)
+			 : "a"(nr), "D"(a), "S"(b), "d"(c), "r"(r10), "r"(r8),
+			   "r"(r9)
+			 : "rcx", "r11", "memory");
+
+	return ret;
+}
@@ -0,0 +1,495 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP2SD_SYSEXT_H
+#define HTTP2SD_SYSEXT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <flibc/linux.h>
+
+/*
+ * Syscalls and constants that flibc does not provide. Like flibc, this only
+ * supports x86_64 and the functions return a negated errno value on failure.
+ */
+
+#ifndef AT_FDCWD
+#	define AT_FDCWD (-100)
+#endif
+#ifndef O_RDONLY
+#	define O_RDONLY 0
+#endif
+#ifndef O_WRONLY
+#	define O_WRONLY 01
+#endif
+#ifndef O_RDWR
+#	define O_RDWR 02
+#endif
+#ifndef O_CREAT
+#	define O_CREAT 0100
+#endif
+#ifndef O_TRUNC
+#	define O_TRUNC 01000
+#endif
+#ifndef O_APPEND
+#	define O_APPEND 02000
+#endif
+#ifndef O_DIRECTORY
+#	define O_DIRECTORY 0200000
+#endif
+#ifndef O_CLOEXEC
+#	define O_CLOEXEC 02000000
+#endif
+#ifndef AT_SYMLINK_NOFOLLOW
+#	define AT_SYMLINK_NOFOLLOW 0x100
+#endif
+#ifndef AT_REMOVEDIR
+#	define AT_REMOVEDIR 0x200
+#endif
+#ifndef S_IFMT
+#	define S_IFMT 0170000
+#endif
+#ifndef S_IFSOCK
+#	define S_IFSOCK 0140000
+#endif
+#ifndef AF_UNIX
+#	define AF_UNIX 1
+#endif
+#ifndef AF_INET6
+#	define AF_INET6 10
+#endif
+#ifndef SEEK_END
+#	define SEEK_END 2
+#endif
+#ifndef PROT_READ
+#	define PROT_READ 1
+#endif
+#ifndef PROT_WRITE
+#	define PROT_WRITE 2
+#endif
+#ifndef MAP_SHARED
+#	define MAP_SHARED 1
+#endif
+#ifndef MAP_PRIVATE
+#	define MAP_PRIVATE 2
+#endif
+#ifndef MAP_ANONYMOUS
+#	define MAP_ANONYMOUS 0x20
+#endif
+#ifndef CLOCK_REALTIME
+#	define CLOCK_REALTIME 0
+#endif
+#ifndef CLOCK_MONOTONIC_COARSE
+#	define CLOCK_MONOTONIC_COARSE 6
+#endif
+#ifndef SIG_BLOCK
+#	define SIG_BLOCK 0
+#endif
+#ifndef SIGHUP
+#	define SIGHUP 1
+#endif
+#ifndef SIGCHLD
+#	define SIGCHLD 17
+#endif
+#ifndef SIGUSR1
+#	define SIGUSR1 10
+#endif
+#ifndef SIGPIPE
+#	define SIGPIPE 13
+#endif
+#ifndef SFD_CLOEXEC
+#	define SFD_CLOEXEC 02000000
+#endif
+#ifndef SFD_NONBLOCK
+#	define SFD_NONBLOCK 04000
+#endif
+#ifndef EPERM
+#	define EPERM 1
+#endif
+#ifndef ENOENT
+#	define ENOENT 2
+#endif
+#ifndef ESRCH
+#	define ESRCH 3
+#endif
+#ifndef EACCES
+#	define EACCES 13
+#endif
+#ifndef EEXIST
+#	define EEXIST 17
+#endif
+#ifndef EINVAL
+#	define EINVAL 22
+#endif
+#ifndef ENOTTY
+#	define ENOTTY 25
+#endif
+#ifndef ENOPROTOOPT
+#	define ENOPROTOOPT 92
+#endif
+#ifndef EAFNOSUPPORT
+#	define EAFNOSUPPORT 97
+#endif
+#ifndef EINPROGRESS
+#	define EINPROGRESS 115
+#endif
+#ifndef RLIMIT_NOFILE
+#	define RLIMIT_NOFILE 7
+#endif
+#ifndef MFD_CLOEXEC
+#	define MFD_CLOEXEC 1
+#endif
+#ifndef EFD_CLOEXEC
+#	define EFD_CLOEXEC 02000000
+#endif
+#ifndef EFD_NONBLOCK
+#	define EFD_NONBLOCK 04000
+#endif
+#ifndef WNOHANG
+#	define WNOHANG 1
+#endif
+#ifndef WEXITED
+#	define WEXITED 4
+#endif
+#ifndef WNOWAIT
+#	define WNOWAIT 0x01000000
+#endif
+#ifndef P_ALL
+#	define P_ALL 0
+#endif
+#ifndef POLLIN
+#	define POLLIN 1
+#endif
+#ifndef IN_NONBLOCK
+#	define IN_NONBLOCK 04000
+#endif
+#ifndef IN_CLOEXEC
+#	define IN_CLOEXEC 02000000
+#endif
+#ifndef IN_CLOSE_WRITE
+#	define IN_CLOSE_WRITE 0x8
+#endif
+#ifndef IN_MOVED_FROM
+#	define IN_MOVED_FROM 0x40
+#endif
+#ifndef IN_MOVED_TO
+#	define IN_MOVED_TO 0x80
+#endif
+#ifndef IN_DELETE
+#	define IN_DELETE 0x200
+#endif
+#ifndef IN_ONLYDIR
+#	define IN_ONLYDIR 0x01000000
+#endif
+#ifndef DT_UNKNOWN
+#	define DT_UNKNOWN 0
+#endif
+#ifndef DT_REG
+#	define DT_REG 8
+#endif
+#ifndef SOL_SOCKET
+#	define SOL_SOCKET 1
+#endif
+#ifndef SO_LINGER
+#	define SO_LINGER 13
+#endif
+#ifndef SHUT_WR
+#	define SHUT_WR 1
+#endif
+#ifndef IPPROTO_IP
+#	define IPPROTO_IP 0
+#endif
+#ifndef IPPROTO_TCP
+#	define IPPROTO_TCP 6
+#endif
+#ifndef TCP_INFO
+#	define TCP_INFO 11
+#endif
+#ifndef IPPROTO_IPV6
+#	define IPPROTO_IPV6 41
+#endif
+#ifndef IPV6_V6ONLY
+#	define IPV6_V6ONLY 26
+#endif
+#ifndef TCP_LISTEN
+#	define TCP_LISTEN 10
+#endif
+#ifndef IP_BIND_ADDRESS_NO_PORT
+#	define IP_BIND_ADDRESS_NO_PORT 24
+#endif
+#ifndef SO_TIMESTAMPING
+#	define SO_TIMESTAMPING 37
+#endif
+#ifndef SOF_TIMESTAMPING_RX_SOFTWARE
+#	define SOF_TIMESTAMPING_RX_SOFTWARE (1 << 3)
+#endif
+#ifndef SOF_TIMESTAMPING_SOFTWARE
+#	define SOF_TIMESTAMPING_SOFTWARE (1 << 4)
+#endif
+#ifndef SO_BUSY_POLL
+#	define SO_BUSY_POLL 46
+#endif
+#ifndef SO_PREFER_BUSY_POLL
+#	define SO_PREFER_BUSY_POLL 69
+#endif
+#ifndef EPIOCSPARAMS
+#	define EPIOCSPARAMS 0x40088a01
+#endif
+#ifndef PERF_TYPE_HARDWARE
+#	define PERF_TYPE_HARDWARE 0
+#endif
+#ifndef PERF_COUNT_HW_CPU_CYCLES
+#	define PERF_COUNT_HW_CPU_CYCLES 0
+#endif
+#ifndef PERF_COUNT_HW_INSTRUCTIONS
+#	define PERF_COUNT_HW_INSTRUCTIONS 1
+#endif
+#ifndef PERF_COUNT_HW_CACHE_MISSES
+#	define PERF_COUNT_HW_CACHE_MISSES 3
+#endif
+#ifndef PERF_COUNT_HW_BRANCH_MISSES
+#	define PERF_COUNT_HW_BRANCH_MISSES 5
+#endif
+#ifndef PERF_FORMAT_TOTAL_TIME_ENABLED
+#	define PERF_FORMAT_TOTAL_TIME_ENABLED 1
+#endif
+#ifndef PERF_FORMAT_TOTAL_TIME_RUNNING
+#	define PERF_FORMAT_TOTAL_TIME_RUNNING 2
+#endif
+#ifndef PERF_FORMAT_GROUP
+#	define PERF_FORMAT_GROUP 8
+#endif
+#ifndef PERF_FLAG_FD_CLOEXEC
+#	define PERF_FLAG_FD_CLOEXEC 8
+#endif
+
+/**
+ * A directory entry as returned by getdents64. The records have a variable
+ * size given by reclen.
+ */
+struct sysext_dirent64 {
+	uint64_t ino;
+	int64_t off;
+	uint16_t reclen;
+	uint8_t type;
+	char name[];
+};
+
+/**
+ * The address of a Unix socket.
+ */
+struct sysext_sockaddr_un {
+	uint16_t sun_family;
+	char sun_path[108];
+};
+
+/**
+ * The address of an IPv6 socket.
+ */
+struct sysext_sockaddr_in6 {
+	uint16_t sin6_family;
+	uint16_t sin6_port;
+	uint32_t sin6_flowinfo;
+	uint8_t sin6_addr[16];
+	uint32_t sin6_scope_id;
+};
+
+/**
+ * The result of newfstatat on x86_64.
+ */
+struct sysext_stat {
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t nlink;
+	uint32_t mode;
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t pad;
+	uint64_t rdev;
+	int64_t size;
+	int64_t blksize;
+	int64_t blocks;
+	uint64_t times[6];
+	int64_t unused[3];
+};
+
+/**
+ * An FD to watch with poll.
+ */
+struct sysext_pollfd {
+	int fd;
+	int16_t events;
+	int16_t revents;
+};
+
+/**
+ * A resource limit for prlimit64.
+ */
+struct sysext_rlimit {
+	uint64_t cur;
+	uint64_t max;
+};
+
+/**
+ * The beginning of the TCP_INFO socket option, which the kernel truncates to
+ * the size that is given. For a listening socket, unacked is the amount of
+ * connections in the accept queue and sacked the backlog.
+ */
+struct sysext_tcp_info {
+	uint8_t state;
+	uint8_t ca_state;
+	uint8_t retransmits;
+	uint8_t probes;
+	uint8_t backoff;
+	uint8_t options;
+	uint8_t wscale;
+	uint8_t flags;
+	uint32_t rto;
+	uint32_t ato;
+	uint32_t snd_mss;
+	uint32_t rcv_mss;
+	uint32_t unacked;
+	uint32_t sacked;
+};
+
+/**
+ * A buffer of a scatter/gather I/O.
+ */
+struct sysext_iovec {
+	void *base;
+	size_t len;
+};
+
+/**
+ * The message of recvmsg. The control buffer receives a sequence of
+ * struct sysext_cmsghdr, each followed by its data and aligned on 8 bytes.
+ */
+struct sysext_msghdr {
+	void *name;
+	uint32_t name_len;
+	struct sysext_iovec *iov;
+	size_t iov_len;
+	void *control;
+	size_t control_len;
+	int flags;
+};
+
+struct sysext_cmsghdr {
+	size_t len;
+	int level;
+	int type;
+};
+
+/**
+ * The argument of the EPIOCSPARAMS ioctl, which configures busy polling for an
+ * epoll instance (Linux 6.9 and later).
+ */
+struct sysext_epoll_params {
+	uint32_t busy_poll_usecs;
+	uint16_t busy_poll_budget;
+	uint8_t prefer_busy_poll;
+	uint8_t pad;
+};
+
+/**
+ * The first version of the argument of perf_event_open, which the kernel
+ * still accepts when its size is given as 64.
+ */
+struct sysext_perf_event_attr {
+	uint32_t type;
+	uint32_t size;
+	uint64_t config;
+	uint64_t sample_period;
+	uint64_t sample_type;
+	uint64_t read_format;
+	uint64_t flags;
+	uint32_t wakeup_events;
+	uint32_t bp_type;
+	uint64_t config1;
+};
+
+/* Bits of the flags field of struct sysext_perf_event_attr. */
+#define SYSEXT_PERF_EXCLUDE_KERNEL (1ULL << 5)
+#define SYSEXT_PERF_EXCLUDE_HV (1ULL << 6)
+
+/**
+ * Returns the bit of a signal in a signal set.
+ */
+#define SYSEXT_SIGBIT(sig) (1ULL << ((sig)-1))
+
+int sysext_rt_sigprocmask(int how, const uint64_t *set, uint64_t *old_set);
+int sysext_signalfd4(int fd, const uint64_t *mask, int flags);
+int sysext_openat(int dir_fd, const char *path, int flags, int mode);
+int sysext_newfstatat(int dir_fd, const char *path, struct sysext_stat *st,
+		      int flags);
+int sysext_mkdirat(int dir_fd, const char *path, uint32_t mode);
+int sysext_unlinkat(int dir_fd, const char *path, int flags);
+int sysext_fchmodat(int dir_fd, const char *path, uint32_t mode);
+int sysext_renameat(int old_dir_fd, const char *old_path, int new_dir_fd,
+		    const char *new_path);
+int sysext_ftruncate(int fd, int64_t len);
+int sysext_memfd_create(const char *name, unsigned int flags);
+int sysext_eventfd2(unsigned int value, int flags);
+pid_t sysext_wait4(pid_t pid, int *status, int options);
+
+/**
+ * The information about the child is not returned, so that the caller does
+ * not have to define the siginfo structure.
+ */
+int sysext_waitid(int id_type, pid_t id, int options);
+int sysext_pidfd_open(pid_t pid, unsigned int flags);
+int sysext_poll(struct sysext_pollfd *fds, uint32_t count, int timeout);
+int sysext_prlimit64(pid_t pid, int resource,
+		     const struct sysext_rlimit *new_limit,
+		     struct sysext_rlimit *old_limit);
+int64_t sysext_lseek(int fd, int64_t offset, int whence);
+ssize_t sysext_getdents64(int fd, void *buf, size_t len);
+int sysext_inotify_init1(int flags);
+int sysext_inotify_add_watch(int fd, const char *path, uint32_t mask);
+int sysext_ioctl(int fd, unsigned long request, void *arg);
+int sysext_connect(int fd, const struct sockaddr *addr, uint32_t addr_len);
+int sysext_shutdown(int fd, int how);
+ssize_t sysext_recvmsg(int fd, struct sysext_msghdr *msg, int flags);
+int sysext_setsockopt(int fd, int level, int name, const void *value,
+		      uint32_t value_len);
+int sysext_getsockopt(int fd, int level, int name, void *value,
+		      uint32_t *value_len);
+int sysext_perf_event_open(const struct sysext_perf_event_attr *attr,
+			   pid_t pid, int cpu, int group_fd,
+			   unsigned long flags);
+
+/**
+ * Returns the address of the mapping, or a negated errno value that can be
+ * detected with SYSEXT_IS_ERR.
+ */
+void *sysext_mmap(void *addr, size_t len, int prot, int flags, int fd,
+		  int64_t offset);
+int sysext_munmap(void *addr, size_t len);
+
+/**
+ * Returns true if a pointer returned by a function of this module is an
+ * error, because the last page of the address space is never mapped.
+ */
+#define SYSEXT_IS_ERR(ptr) ((uintptr_t)(ptr) > (uintptr_t)-4096)
+
+ssize_t sysext_getrandom(void *buf, size_t len, unsigned int flags);
+int sysext_nanosleep(const struct timespec *duration);
+int sysext_sched_yield();
+pid_t sysext_getpid();
+
+#endif
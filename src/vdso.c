@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <flibc/util.h>
+
+#include "stats.h"
+#include "vdso.h"
+
+#define VDSO_AT_NULL 0
+#define VDSO_AT_SYSINFO_EHDR 33
+
+#define VDSO_PT_LOAD 1
+#define VDSO_PT_DYNAMIC 2
+
+#define VDSO_DT_NULL 0
+#define VDSO_DT_HASH 4
+#define VDSO_DT_STRTAB 5
+#define VDSO_DT_SYMTAB 6
+
+#define VDSO_STT_FUNC 2
+#define VDSO_SHN_UNDEF 0
+
+/*
+ * The few ELF64 structures that we need to find a symbol in the vDSO.
+ */
+
+struct vdso_ehdr {
+	unsigned char e_ident[16];
+	uint16_t e_type;
+	uint16_t e_machine;
+	uint32_t e_version;
+	uint64_t e_entry;
+	uint64_t e_phoff;
+	uint64_t e_shoff;
+	uint32_t e_flags;
+	uint16_t e_ehsize;
+	uint16_t e_phentsize;
+	uint16_t e_phnum;
+	uint16_t e_shentsize;
+	uint16_t e_shnum;
+	uint16_t e_shstrndx;
+};
+
+struct vdso_phdr {
+	uint32_t p_type;
+	uint32_t p_flags;
+	uint64_t p_offset;
+	uint64_t p_vaddr;
+	uint64_t p_paddr;
+	uint64_t p_filesz;
+	uint64_t p_memsz;
+	uint64_t p_align;
+};
+
+struct vdso_dyn {
+	int64_t d_tag;
+	uint64_t d_val;
+};
+
+struct vdso_sym {
+	uint32_t st_name;
+	unsigned char st_info;
+	unsigned char st_other;
+	uint16_t st_shndx;
+	uint64_t st_value;
+	uint64_t st_size;
+};
+
+typedef int (*vdso_clock_gettime_fn)(int clock_id, struct timespec *ts);
+
+static vdso_clock_gettime_fn vdso_clock_gettime_ptr;
+
+static uintptr_t vdso_find_base(char **argv);
+static void *vdso_find_symbol(uintptr_t base, const char *name);
+
+void vdso_init(char **argv)
+{
+	uintptr_t base = vdso_find_base(argv);
+	if (base == 0)
+		return;
+
+	vdso_clock_gettime_ptr =
+	    (vdso_clock_gettime_fn)vdso_find_symbol(base,
+						    "__vdso_clock_gettime");
+}
+
+int vdso_clock_gettime(int clock_id, struct timespec *ts)
+{
+	if (vdso_clock_gettime_ptr != NULL)
+		return vdso_clock_gettime_ptr(clock_id, ts);
+
+	stats_inc(SC_SYSCALLS);
+	return sys_clock_gettime(clock_id, ts);
+}
+
+static uintptr_t vdso_find_base(char **argv)
+{
+	/* Skip the arguments and the environment variables, which are both
+	   terminated by a NULL pointer. */
+	char **cursor = argv;
+	while (*cursor != NULL)
+		cursor++;
+	cursor++;
+	while (*cursor != NULL)
+		cursor++;
+	cursor++;
+
+	/* The auxiliary vector is a list of type and value pairs. */
+	for (uintptr_t *aux = (uintptr_t *)cursor; aux[0] != VDSO_AT_NULL;
+	     aux += 2) {
+		if (aux[0] == VDSO_AT_SYSINFO_EHDR)
+			return aux[1];
+	}
+
+	return 0;
+}
+
+static void *vdso_find_symbol(uintptr_t base, const char *name)
+{
+	const struct vdso_ehdr *ehdr = (const struct vdso_ehdr *)base;
+	const struct vdso_phdr *phdrs =
+	    (const struct vdso_phdr *)(base + ehdr->e_phoff);
+
+	/* The addresses in the vDSO are relative to where it was supposed to
+	   be loaded, which is not where it actually is. */
+	uintptr_t load_offset = 0;
+	bool found_load = false;
+	const struct vdso_dyn *dyn = NULL;
+	for (uint16_t i = 0; i < ehdr->e_phnum; i++) {
+		if (phdrs[i].p_type == VDSO_PT_LOAD && !found_load) {
+			load_offset =
+			    base + phdrs[i].p_offset - phdrs[i].p_vaddr;
+			found_load = true;
+		} else if (phdrs[i].p_type == VDSO_PT_DYNAMIC) {
+			dyn = (const struct vdso_dyn *)(base +
+							phdrs[i].p_offset);
+		}
+	}
+	if (!found_load || dyn == NULL)
+		return NULL;
+
+	const uint32_t *hash = NULL;
+	const char *strtab = NULL;
+	const struct vdso_sym *symtab = NULL;
+	for (; dyn->d_tag != VDSO_DT_NULL; dyn++) {
+		switch (dyn->d_tag) {
+		case VDSO_DT_HASH:
+			hash = (const uint32_t *)(load_offset + dyn->d_val);
+			break;
+		case VDSO_DT_STRTAB:
+			strtab = (const char *)(load_offset + dyn->d_val);
+			break;
+		case VDSO_DT_SYMTAB:
+			symtab =
+			    (const struct vdso_sym *)(load_offset + dyn->d_val);
+			break;
+		}
+	}
+	if (hash == NULL || strtab == NULL || symtab == NULL)
+		return NULL;
+
+	/* The vDSO exports a handful of symbols so a linear search is good
+	   enough. The second word of the hash table is the amount of entries
+	   in the symbol table. */
+	uint32_t sym_count = hash[1];
+	for (uint32_t i = 0; i < sym_count; i++) {
+		const struct vdso_sym *sym = &symtab[i];
+		if ((sym->st_info & 0xf) != VDSO_STT_FUNC ||
+		    sym->st_shndx == VDSO_SHN_UNDEF)
+			continue;
+
+		if (strcmp(strtab + sym->st_name, name) == 0)
+			return (void *)(load_offset + sym->st_value);
+	}
+
+	return NULL;
+}
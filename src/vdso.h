@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP2SD_VDSO_H
+#define HTTP2SD_VDSO_H
+
+#include <flibc/linux.h>
+
+/**
+ * Looks for the functions exported by the vDSO that the kernel maps into
+ * every process. Takes the argv given to the main function as an argument
+ * because the auxiliary vector that gives the vDSO's address comes right
+ * after the arguments and the environment variables on the initial stack.
+ */
+void vdso_init(char **argv);
+
+/**
+ * Same as sys_clock_gettime, but without entering the kernel if the vDSO
+ * exports __vdso_clock_gettime. Falls back to the syscall otherwise.
+ */
+int vdso_clock_gettime(int clock_id, struct timespec *ts);
+
+#endif
@@ -0,0 +1,742 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <flibc/linux.h>
+#include <flibc/mem.h>
+#include <flibc/util.h>
+
+#include "fmt.h"
+#include "sysext.h"
+#include "toolutil.h"
+
+/*
+ * The connection-scaling benchmark: keeps many slow clients connected to a
+ * running server on the loopback interface, which trickle their request one
+ * byte at a time, while a foreground client measures the latency of complete
+ * requests. The memory of the server processes and of the kernel's TCP sockets
+ * is sampled every second. The results are printed as "name value" lines, like
+ * the statistics, so that runs can be compared by a script.
+ */
+
+/* One source address only has enough ephemeral ports for a few tens of
+   thousands of connections to the same server port, so the slow clients are
+   spread over several loopback addresses. */
+#define BENCH_CONNS_PER_ADDR 20000
+
+#define BENCH_MAX_SLOW 1048576
+#define BENCH_MAX_PIDS 64
+#define BENCH_MAX_SAMPLES 1048576
+
+/* How often the slow clients are opened and fed, in milliseconds. */
+#define BENCH_TICK 10
+
+/* How many slow clients are opened per tick, so that the SYN burst of a large
+   run does not overflow the backlog at once. */
+#define BENCH_OPEN_BUDGET 1000
+
+/* How often the memory is sampled and how long a foreground request can take,
+   in milliseconds. */
+#define BENCH_SAMPLE_PERIOD 1000
+#define BENCH_FG_TIMEOUT 5000
+
+/* The epoll data of the foreground client. The slow clients use their index. */
+#define BENCH_DATA_FG UINT64_MAX
+
+#define BENCH_CLOCK_MONOTONIC 1
+
+enum bench_slow_state {
+	BSS_CLOSED,
+	BSS_CONNECTING,
+	BSS_OPEN,
+};
+
+struct bench_config {
+	uint64_t port;
+	uint64_t slow;
+	/* The time between two bytes of a slow client, or 0 to only send the
+	   start of the request. */
+	uint64_t trickle_ms;
+	/* Foreground requests per second, or 0 to disable them. */
+	uint64_t fg_rate;
+	uint64_t duration_ms;
+	uint64_t pids[BENCH_MAX_PIDS];
+	uint32_t pid_count;
+};
+
+struct bench_memory {
+	uint64_t rss_kb;
+	uint64_t tcp_mem_kb;
+};
+
+static const char bench_slow_prefix[] = "GET / HTTP/1.1\r\nX-Trickle: ";
+static const char bench_fg_request[] =
+    "GET /bench HTTP/1.1\r\nHost: bench.example\r\n\r\n";
+
+static struct bench_config bench_config;
+static int bench_epoll_fd;
+static struct sockaddr_in bench_server_addr;
+
+static int *bench_slow_fds;
+static uint8_t *bench_slow_states;
+
+/* The indexes of the slow clients that must be opened again. */
+static uint32_t *bench_closed;
+static uint32_t bench_closed_len;
+
+static uint64_t bench_trickle_cursor;
+static uint64_t bench_trickle_credit;
+
+static int bench_fg_fd = -1;
+static uint64_t bench_fg_start;
+static bool bench_fg_sent;
+static char bench_fg_buf[1024];
+static size_t bench_fg_len;
+
+/* The foreground latencies, in microseconds. */
+static uint32_t *bench_samples;
+static uint64_t bench_sample_count;
+
+static uint64_t bench_slow_connecting;
+static uint64_t bench_slow_open;
+static uint64_t bench_slow_open_max;
+static uint64_t bench_slow_connects;
+static uint64_t bench_slow_connect_errors;
+static uint64_t bench_slow_closed;
+static uint64_t bench_trickle_bytes;
+static uint64_t bench_ramp_ms;
+static uint64_t bench_fg_requests;
+static uint64_t bench_fg_errors;
+static uint64_t bench_fg_timeouts;
+
+static bool bench_parse_args(char **argv);
+static bool bench_on_arg(const char *flag, const char *value);
+static bool bench_setup();
+static void *bench_alloc(size_t len);
+static uint64_t bench_now_ns();
+
+static bool bench_open_slow(uint32_t index);
+static void bench_close_slow(uint32_t index);
+static void bench_on_slow_event(uint32_t index, uint32_t events);
+static void bench_trickle(uint64_t elapsed_ms);
+
+static bool bench_start_fg(uint64_t now);
+static void bench_end_fg(bool ok, uint64_t now);
+static void bench_on_fg_event(uint32_t events);
+
+static void bench_sample(struct bench_memory *memory);
+static bool bench_read_num(const char *path, const char *line,
+			   const char *field, uint64_t *result);
+static void bench_sort(uint32_t *values, uint64_t count);
+static void bench_sift_down(uint32_t *values, uint64_t root, uint64_t end);
+static void bench_print_report(const struct bench_memory *start,
+			       const struct bench_memory *max,
+			       const struct bench_memory *end);
+
+int main(int argc, char **argv)
+{
+	F_UNUSED(argc);
+
+	if (!bench_parse_args(argv) || !bench_setup())
+		return 2;
+
+	struct bench_memory start_memory;
+	bench_sample(&start_memory);
+	struct bench_memory max_memory = start_memory;
+	struct bench_memory end_memory = start_memory;
+
+	uint64_t now_ns = bench_now_ns();
+	uint64_t start = now_ns / 1000000;
+	uint64_t now = start;
+	uint64_t last_tick = start;
+	uint64_t next_sample = start + BENCH_SAMPLE_PERIOD;
+	uint64_t fg_period_ns =
+	    bench_config.fg_rate == 0 ? 0 : 1000000000 / bench_config.fg_rate;
+	uint64_t next_fg_ns = start * 1000000;
+
+	struct epoll_event events[256];
+	while (now - start < bench_config.duration_ms) {
+		/* Wake up for the next tick or the next foreground request,
+		   whichever comes first. */
+		int timeout = BENCH_TICK;
+		if (fg_period_ns != 0 && bench_fg_fd == -1)
+			timeout = next_fg_ns <= now_ns
+				      ? 0
+				      : (next_fg_ns - now_ns) / 1000000;
+		if (timeout > BENCH_TICK)
+			timeout = BENCH_TICK;
+
+		int ret = sys_epoll_wait(bench_epoll_fd, events,
+					 sizeof(events) / sizeof(*events),
+					 timeout);
+		if (ret < 0 && ret != -EINTR) {
+			F_PRINT(2, "bench: epoll_wait() failed\n");
+			return 1;
+		}
+
+		for (int i = 0; i < ret; i++) {
+			if (events[i].data.u64 == BENCH_DATA_FG)
+				bench_on_fg_event(events[i].events);
+			else
+				bench_on_slow_event(events[i].data.u64,
+						    events[i].events);
+		}
+
+		now_ns = bench_now_ns();
+		now = now_ns / 1000000;
+
+		if (bench_fg_fd != -1 &&
+		    now - bench_fg_start / 1000000 >= BENCH_FG_TIMEOUT) {
+			bench_fg_timeouts++;
+			bench_end_fg(false, now_ns);
+		}
+		if (fg_period_ns != 0 && bench_fg_fd == -1 &&
+		    now_ns >= next_fg_ns) {
+			if (!bench_start_fg(now_ns))
+				return 1;
+			/* The stream is closed-loop, so a slow response
+			   delays the next request instead of causing a
+			   burst. */
+			next_fg_ns += fg_period_ns;
+			if (next_fg_ns < now_ns)
+				next_fg_ns = now_ns + fg_period_ns;
+		}
+
+		if (now - last_tick >= BENCH_TICK) {
+			for (int opened = 0; opened < BENCH_OPEN_BUDGET &&
+					     bench_closed_len != 0;
+			     opened++) {
+				bench_closed_len--;
+				if (!bench_open_slow(
+					bench_closed[bench_closed_len]))
+					return 1;
+			}
+
+			bench_trickle(now - last_tick);
+			last_tick = now;
+		}
+
+		if (bench_ramp_ms == 0 && bench_config.slow != 0 &&
+		    bench_slow_open == bench_config.slow)
+			bench_ramp_ms = now - start;
+
+		if (now >= next_sample) {
+			bench_sample(&end_memory);
+			if (end_memory.rss_kb > max_memory.rss_kb)
+				max_memory.rss_kb = end_memory.rss_kb;
+			if (end_memory.tcp_mem_kb > max_memory.tcp_mem_kb)
+				max_memory.tcp_mem_kb = end_memory.tcp_mem_kb;
+			next_sample += BENCH_SAMPLE_PERIOD;
+		}
+	}
+
+	bench_print_report(&start_memory, &max_memory, &end_memory);
+	return 0;
+}
+
+static bool bench_parse_args(char **argv)
+{
+	bench_config.port = 80;
+	bench_config.slow = 1000;
+	bench_config.trickle_ms = 1000;
+	bench_config.fg_rate = 100;
+	bench_config.duration_ms = 10000;
+	bench_config.pid_count = 0;
+
+	return toolutil_parse_args(argv,
+				   "Usage: bench [-p PORT] [-n SLOW] "
+				   "[-i TRICKLE_MS] [-r RATE] [-d SECONDS] "
+				   "[-P PID]...\n",
+				   bench_on_arg);
+}
+
+static bool bench_on_arg(const char *flag, const char *value)
+{
+	uint64_t num;
+	if (!toolutil_parse_num(&num, value))
+		return false;
+
+	if (strcmp(flag, "-p") == 0 && num >= 1 && num <= UINT16_MAX) {
+		bench_config.port = num;
+	} else if (strcmp(flag, "-n") == 0 && num <= BENCH_MAX_SLOW) {
+		bench_config.slow = num;
+	} else if (strcmp(flag, "-i") == 0) {
+		bench_config.trickle_ms = num;
+	} else if (strcmp(flag, "-r") == 0 && num <= 1000000) {
+		bench_config.fg_rate = num;
+	} else if (strcmp(flag, "-d") == 0 && num >= 1 && num <= 86400) {
+		bench_config.duration_ms = num * 1000;
+	} else if (strcmp(flag, "-P") == 0 &&
+		   bench_config.pid_count < BENCH_MAX_PIDS) {
+		bench_config.pids[bench_config.pid_count++] = num;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+static bool bench_setup()
+{
+	/* Every slow client needs a FD. */
+	struct sysext_rlimit limit;
+	if (sysext_prlimit64(0, RLIMIT_NOFILE, NULL, &limit) != 0 ||
+	    limit.max < bench_config.slow + 64) {
+		F_PRINT(2, "bench: the limit of open files is too low\n");
+		return false;
+	}
+	limit.cur = limit.max;
+	if (sysext_prlimit64(0, RLIMIT_NOFILE, &limit, NULL) != 0) {
+		F_PRINT(2, "bench: prlimit64() failed\n");
+		return false;
+	}
+
+	/* Writing to a client that the server has closed must fail with EPIPE
+	   instead of killing the benchmark. */
+	uint64_t mask = SYSEXT_SIGBIT(SIGPIPE);
+	if (sysext_rt_sigprocmask(SIG_BLOCK, &mask, NULL) != 0) {
+		F_PRINT(2, "bench: rt_sigprocmask() failed\n");
+		return false;
+	}
+
+	bench_epoll_fd = sys_epoll_create1(EPOLL_CLOEXEC);
+	if (bench_epoll_fd < 0) {
+		F_PRINT(2, "bench: epoll_create1() failed\n");
+		return false;
+	}
+
+	memset(&bench_server_addr, 0, sizeof(bench_server_addr));
+	bench_server_addr.sin_family = AF_INET;
+	bench_server_addr.sin_port = htons(bench_config.port);
+	bench_server_addr.sin_addr = __builtin_bswap32(0x7f000001);
+
+	/* The pages are only touched when they are used. */
+	size_t slow = bench_config.slow == 0 ? 1 : bench_config.slow;
+	bench_slow_fds = bench_alloc(slow * sizeof(*bench_slow_fds));
+	bench_slow_states = bench_alloc(slow * sizeof(*bench_slow_states));
+	bench_closed = bench_alloc(slow * sizeof(*bench_closed));
+	bench_samples = bench_alloc(BENCH_MAX_SAMPLES * sizeof(*bench_samples));
+	if (bench_slow_fds == NULL || bench_slow_states == NULL ||
+	    bench_closed == NULL || bench_samples == NULL) {
+		F_PRINT(2, "bench: mmap() failed\n");
+		return false;
+	}
+
+	/* The clients are opened in the order of their index. */
+	for (uint64_t i = 0; i < bench_config.slow; i++)
+		bench_closed[i] = bench_config.slow - 1 - i;
+	bench_closed_len = bench_config.slow;
+
+	return true;
+}
+
+static void *bench_alloc(size_t len)
+{
+	void *ptr = sysext_mmap(NULL, len, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return SYSEXT_IS_ERR(ptr) ? NULL : ptr;
+}
+
+static uint64_t bench_now_ns()
+{
+	struct timespec ts;
+	if (sys_clock_gettime(BENCH_CLOCK_MONOTONIC, &ts) != 0)
+		return 0;
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool bench_open_slow(uint32_t index)
+{
+	int fd =
+	    sys_socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd < 0) {
+		F_PRINT(2, "bench: socket() failed\n");
+		return false;
+	}
+
+	/* The port is chosen by connect, which only needs it to be unique for
+	   the whole address and port pair. */
+	int one = 1;
+	struct sockaddr_in source;
+	memset(&source, 0, sizeof(source));
+	source.sin_family = AF_INET;
+	source.sin_addr =
+	    __builtin_bswap32(0x7f010001 + index / BENCH_CONNS_PER_ADDR);
+	if (sysext_setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one,
+			      sizeof(one)) != 0 ||
+	    sys_bind(fd, (struct sockaddr *)&source, sizeof(source)) != 0) {
+		F_PRINT(2, "bench: bind() failed\n");
+		return false;
+	}
+
+	bench_slow_fds[index] = fd;
+	int ret = sysext_connect(fd, (struct sockaddr *)&bench_server_addr,
+				 sizeof(bench_server_addr));
+	if (ret != 0 && ret != -EINPROGRESS) {
+		bench_slow_connect_errors++;
+		bench_close_slow(index);
+		return true;
+	}
+
+	/* Edge-triggered, so that the socket is only reported once when it
+	   becomes writable and then when the server closes it. */
+	struct epoll_event event;
+	event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	event.data.u64 = index;
+	if (sys_epoll_ctl(bench_epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+		F_PRINT(2, "bench: epoll_ctl() failed\n");
+		return false;
+	}
+	bench_slow_states[index] = BSS_CONNECTING;
+	bench_slow_connecting++;
+
+	return true;
+}
+
+static void bench_close_slow(uint32_t index)
+{
+	if (bench_slow_states[index] == BSS_CONNECTING)
+		bench_slow_connecting--;
+	else if (bench_slow_states[index] == BSS_OPEN)
+		bench_slow_open--;
+	bench_slow_states[index] = BSS_CLOSED;
+
+	F_ASSERT(sys_close(bench_slow_fds[index]) == 0);
+	bench_closed[bench_closed_len++] = index;
+}
+
+static void bench_on_slow_event(uint32_t index, uint32_t events)
+{
+	if (bench_slow_states[index] == BSS_CLOSED)
+		return;
+
+	/* The server never answers the slow clients, so anything to read
+	   means that it has closed the connection, most likely because of its
+	   timeout. The client is opened again in a later tick. */
+	if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) != 0) {
+		if (bench_slow_states[index] == BSS_CONNECTING)
+			bench_slow_connect_errors++;
+		else
+			bench_slow_closed++;
+		bench_close_slow(index);
+		return;
+	}
+
+	if ((events & EPOLLOUT) != 0 &&
+	    bench_slow_states[index] == BSS_CONNECTING) {
+		bench_slow_states[index] = BSS_OPEN;
+		bench_slow_connecting--;
+		bench_slow_connects++;
+		if (++bench_slow_open > bench_slow_open_max)
+			bench_slow_open_max = bench_slow_open;
+
+		/* The prefix is much smaller than the socket buffer. */
+		if (sys_write(bench_slow_fds[index], bench_slow_prefix,
+			      sizeof(bench_slow_prefix) - 1) < 0) {
+			bench_slow_closed++;
+			bench_close_slow(index);
+		}
+	}
+}
+
+static void bench_trickle(uint64_t elapsed_ms)
+{
+	if (bench_config.trickle_ms == 0 || bench_config.slow == 0)
+		return;
+
+	/* Every slow client sends a byte once per period, and the clients are
+	   visited in a round-robin fashion, so the work is spread evenly over
+	   the ticks. */
+	bench_trickle_credit += bench_config.slow * elapsed_ms;
+	while (bench_trickle_credit >= bench_config.trickle_ms) {
+		bench_trickle_credit -= bench_config.trickle_ms;
+
+		uint32_t index = bench_trickle_cursor;
+		bench_trickle_cursor =
+		    (bench_trickle_cursor + 1) % bench_config.slow;
+		if (bench_slow_states[index] != BSS_OPEN)
+			continue;
+
+		ssize_t ret = sys_write(bench_slow_fds[index], "a", 1);
+		if (ret == 1) {
+			bench_trickle_bytes++;
+		} else if (ret != -EAGAIN) {
+			bench_slow_closed++;
+			bench_close_slow(index);
+		}
+	}
+}
+
+static bool bench_start_fg(uint64_t now)
+{
+	bench_fg_fd =
+	    sys_socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (bench_fg_fd < 0) {
+		F_PRINT(2, "bench: socket() failed\n");
+		return false;
+	}
+	bench_fg_start = now;
+	bench_fg_sent = false;
+	bench_fg_len = 0;
+
+	int ret = sysext_connect(bench_fg_fd,
+				 (struct sockaddr *)&bench_server_addr,
+				 sizeof(bench_server_addr));
+	if (ret != 0 && ret != -EINPROGRESS) {
+		bench_end_fg(false, now);
+		return true;
+	}
+
+	struct epoll_event event;
+	event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	event.data.u64 = BENCH_DATA_FG;
+	if (sys_epoll_ctl(bench_epoll_fd, EPOLL_CTL_ADD, bench_fg_fd,
+			  &event) != 0) {
+		F_PRINT(2, "bench: epoll_ctl() failed\n");
+		return false;
+	}
+
+	return true;
+}
+
+static void bench_end_fg(bool ok, uint64_t now)
+{
+	bench_fg_requests++;
+	if (!ok)
+		bench_fg_errors++;
+	else if (bench_sample_count < BENCH_MAX_SAMPLES)
+		bench_samples[bench_sample_count++] =
+		    (now - bench_fg_start) / 1000;
+
+	F_ASSERT(sys_close(bench_fg_fd) == 0);
+	bench_fg_fd = -1;
+}
+
+static void bench_on_fg_event(uint32_t events)
+{
+	if (bench_fg_fd == -1)
+		return;
+
+	if ((events & EPOLLOUT) != 0 && !bench_fg_sent) {
+		/* The request is much smaller than the socket buffer. */
+		if (sys_write(bench_fg_fd, bench_fg_request,
+			      sizeof(bench_fg_request) - 1) !=
+		    sizeof(bench_fg_request) - 1) {
+			bench_end_fg(false, bench_now_ns());
+			return;
+		}
+		bench_fg_sent = true;
+	}
+
+	if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) == 0)
+		return;
+
+	for (;;) {
+		ssize_t ret =
+		    sys_read(bench_fg_fd, bench_fg_buf + bench_fg_len,
+			     sizeof(bench_fg_buf) - 1 - bench_fg_len);
+		if (ret == -EAGAIN)
+			return;
+		if (ret <= 0) {
+			/* The server closed the connection before the end of
+			   the headers. */
+			bench_end_fg(false, bench_now_ns());
+			return;
+		}
+		bench_fg_len += ret;
+		bench_fg_buf[bench_fg_len] = '\0';
+
+		/* The response is complete once its headers are. */
+		for (size_t i = 0; i + 4 <= bench_fg_len; i++) {
+			if (memcmp(bench_fg_buf + i, "\r\n\r\n", 4) != 0)
+				continue;
+
+			bench_end_fg(memcmp(bench_fg_buf, "HTTP/1.1 301 ",
+					    13) == 0,
+				     bench_now_ns());
+			return;
+		}
+
+		if (bench_fg_len == sizeof(bench_fg_buf) - 1) {
+			bench_end_fg(false, bench_now_ns());
+			return;
+		}
+	}
+}
+
+static void bench_sample(struct bench_memory *memory)
+{
+	memory->rss_kb = 0;
+	for (uint32_t i = 0; i < bench_config.pid_count; i++) {
+		char path[32] = "/proc/";
+		size_t len = 6 + fmt_u64(path + 6, bench_config.pids[i]);
+		memcpy(path + len, "/status", sizeof("/status"));
+
+		uint64_t rss;
+		if (bench_read_num(path, "VmRSS:", NULL, &rss))
+			memory->rss_kb += rss;
+	}
+
+	/* The memory of the TCP sockets is counted in pages. */
+	uint64_t pages;
+	memory->tcp_mem_kb =
+	    bench_read_num("/proc/net/sockstat", "TCP:", " mem ", &pages)
+		? pages * 4
+		: 0;
+}
+
+static bool bench_read_num(const char *path, const char *line,
+			   const char *field, uint64_t *result)
+{
+	char buf[4096];
+	int fd = sysext_openat(AT_FDCWD, path, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0)
+		return false;
+	ssize_t len = sys_read(fd, buf, sizeof(buf) - 1);
+	F_ASSERT(sys_close(fd) == 0);
+	if (len <= 0)
+		return false;
+	buf[len] = '\0';
+
+	/* Find the line, then the field in it, and parse the number that
+	   follows. */
+	size_t line_len = strlen(line);
+	const char *cursor = buf;
+	while (memcmp(cursor, line, line_len) != 0) {
+		while (*cursor != '\n' && *cursor != '\0')
+			cursor++;
+		if (*cursor == '\0')
+			return false;
+		cursor++;
+	}
+	cursor += line_len;
+
+	if (field != NULL) {
+		size_t field_len = strlen(field);
+		while (memcmp(cursor, field, field_len) != 0) {
+			if (*cursor == '\n' || *cursor == '\0')
+				return false;
+			cursor++;
+		}
+		cursor += field_len;
+	}
+
+	while (*cursor == ' ' || *cursor == '\t')
+		cursor++;
+	if (*cursor < '0' || *cursor > '9')
+		return false;
+
+	*result = 0;
+	for (; *cursor >= '0' && *cursor <= '9'; cursor++)
+		*result = *result * 10 + (*cursor - '0');
+
+	return true;
+}
+
+static void bench_sort(uint32_t *values, uint64_t count)
+{
+	/* A heap sort, which does not need any memory and is fast enough for
+	   a million samples. */
+	for (uint64_t i = count / 2; i-- > 0;)
+		bench_sift_down(values, i, count);
+
+	for (uint64_t end = count; end > 1;) {
+		end--;
+		uint32_t tmp = values[0];
+		values[0] = values[end];
+		values[end] = tmp;
+		bench_sift_down(values, 0, end);
+	}
+}
+
+static void bench_sift_down(uint32_t *values, uint64_t root, uint64_t end)
+{
+	while (2 * root + 1 < end) {
+		uint64_t child = 2 * root + 1;
+		if (child + 1 < end && values[child + 1] > values[child])
+			child++;
+		if (values[root] >= values[child])
+			return;
+
+		uint32_t tmp = values[root];
+		values[root] = values[child];
+		values[child] = tmp;
+		root = child;
+	}
+}
+
+static void bench_print_report(const struct bench_memory *start,
+			       const struct bench_memory *max,
+			       const struct bench_memory *end)
+{
+	toolutil_print_num("slow_target", bench_config.slow);
+	/* The clients that are still connecting have not fit in the SYN and
+	   accept queues, whose size is capped by the somaxconn sysctl. */
+	toolutil_print_num("slow_connecting", bench_slow_connecting);
+	toolutil_print_num("slow_open", bench_slow_open);
+	toolutil_print_num("slow_open_max", bench_slow_open_max);
+	toolutil_print_num("slow_ramp_ms", bench_ramp_ms);
+	toolutil_print_num("slow_connects", bench_slow_connects);
+	toolutil_print_num("slow_connect_errors", bench_slow_connect_errors);
+	toolutil_print_num("slow_closed_by_server", bench_slow_closed);
+	toolutil_print_num("trickle_bytes", bench_trickle_bytes);
+
+	toolutil_print_num("fg_requests", bench_fg_requests);
+	toolutil_print_num("fg_errors", bench_fg_errors);
+	toolutil_print_num("fg_timeouts", bench_fg_timeouts);
+
+	bench_sort(bench_samples, bench_sample_count);
+	static const struct {
+		const char *name;
+		uint64_t per_mille;
+	} percentiles[] = {
+	    {"fg_latency_us_p50", 500},	 {"fg_latency_us_p90", 900},
+	    {"fg_latency_us_p99", 990},	 {"fg_latency_us_p999", 999},
+	    {"fg_latency_us_max", 1000},
+	};
+	for (size_t i = 0; i < sizeof(percentiles) / sizeof(*percentiles);
+	     i++) {
+		uint64_t value = 0;
+		if (bench_sample_count != 0)
+			value = bench_samples[(bench_sample_count - 1) *
+					      percentiles[i].per_mille / 1000];
+		toolutil_print_num(percentiles[i].name, value);
+	}
+
+	toolutil_print_num("server_rss_kb_start", start->rss_kb);
+	toolutil_print_num("server_rss_kb_max", max->rss_kb);
+	toolutil_print_num("server_rss_kb_end", end->rss_kb);
+	toolutil_print_num("tcp_mem_kb_start", start->tcp_mem_kb);
+	toolutil_print_num("tcp_mem_kb_max", max->tcp_mem_kb);
+	toolutil_print_num("tcp_mem_kb_end", end->tcp_mem_kb);
+
+	/* The cost of one more idle connection, which is what the scaling of
+	   the server depends on. */
+	uint64_t conns = bench_slow_open_max == 0 ? 1 : bench_slow_open_max;
+	toolutil_print_num("server_rss_bytes_per_slow",
+			   max->rss_kb > start->rss_kb
+			       ? (max->rss_kb - start->rss_kb) * 1024 / conns
+			       : 0);
+	toolutil_print_num("tcp_mem_bytes_per_slow",
+			   max->tcp_mem_kb > start->tcp_mem_kb
+			       ? (max->tcp_mem_kb - start->tcp_mem_kb) *
+				     1024 / conns
+			       : 0);
+}
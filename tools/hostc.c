@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <flibc/linux.h>
+#include <flibc/mem.h>
+#include <flibc/str.h>
+#include <flibc/util.h>
+
+#include "fmt.h"
+#include "hostlist.h"
+#include "sysext.h"
+#include "toolutil.h"
+
+/*
+ * Compiles a host list into an image that http2sd maps directly when it is
+ * given to --allow-hosts, instead of compiling the list at startup. The image
+ * is written next to the output file and renamed over it, so that a server
+ * that reloads the list on SIGHUP never sees a partial image. The size of the
+ * image and the time it took are printed as "name value" lines.
+ */
+
+#define HOSTC_CLOCK_MONOTONIC 1
+
+/* Room for the output path and the suffix of the temporary file. */
+#define HOSTC_PATH_MAX 4096
+
+static const char hostc_usage[] = "Usage: hostc -i LIST -o IMAGE\n";
+
+static const char *hostc_in_path;
+static const char *hostc_out_path;
+
+static bool hostc_on_arg(const char *flag, const char *value);
+static uint64_t hostc_now_us();
+
+int main(int argc, char **argv)
+{
+	F_UNUSED(argc);
+
+	if (!toolutil_parse_args(argv, hostc_usage, hostc_on_arg))
+		return 2;
+	if (hostc_in_path == NULL || hostc_out_path == NULL) {
+		F_PRINT(2, hostc_usage);
+		return 2;
+	}
+
+	const char suffix[] = ".tmp";
+	size_t out_len = strlen(hostc_out_path);
+	if (out_len + sizeof(suffix) > HOSTC_PATH_MAX) {
+		F_PRINT(2, "hostc: output path too long\n");
+		return 2;
+	}
+	char tmp_path[HOSTC_PATH_MAX];
+	memcpy(tmp_path, hostc_out_path, out_len);
+	memcpy(tmp_path + out_len, suffix, sizeof(suffix));
+
+	/* The image is mapped to be written, so it must also be readable. */
+	int fd = sysext_openat(AT_FDCWD, tmp_path,
+			       O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		F_PRINT(2, "hostc: open() failed for the image\n");
+		return 1;
+	}
+
+	uint64_t start = hostc_now_us();
+	if (!hostlist_compile(hostc_in_path, fd, 0)) {
+		sys_close(fd);
+		sysext_unlinkat(AT_FDCWD, tmp_path, 0);
+		return 1;
+	}
+	uint64_t end = hostc_now_us();
+
+	int64_t size = sysext_lseek(fd, 0, SEEK_END);
+	sys_close(fd);
+
+	int ret = sysext_renameat(AT_FDCWD, tmp_path, AT_FDCWD, hostc_out_path);
+	if (ret != 0) {
+		F_PRINT(2, "hostc: rename() failed for the image\n");
+		sysext_unlinkat(AT_FDCWD, tmp_path, 0);
+		return 1;
+	}
+
+	toolutil_print_num("image_bytes", size);
+	toolutil_print_num("compile_us", end - start);
+	return 0;
+}
+
+static bool hostc_on_arg(const char *flag, const char *value)
+{
+	if (strcmp(flag, "-i") == 0)
+		hostc_in_path = value;
+	else if (strcmp(flag, "-o") == 0)
+		hostc_out_path = value;
+	else
+		return false;
+
+	return true;
+}
+
+static uint64_t hostc_now_us()
+{
+	struct timespec ts;
+	if (sys_clock_gettime(HOSTC_CLOCK_MONOTONIC, &ts) != 0)
+		return 0;
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
@@ -0,0 +1,233 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <flibc/mem.h>
+#include <flibc/str.h>
+#include <flibc/util.h>
+
+#include "hostnorm.h"
+#include "toolutil.h"
+
+/*
+ * A differential test of the host normalization: random hosts, most of them
+ * close to a valid domain name, IPv4 or IPv6 address with a port, are
+ * normalized by the hostnorm module, which works on blocks of 16 bytes, and by
+ * a plain scalar reference written from the rules of hostnorm.h. Both must
+ * accept the same hosts and give the same result. The seed and the index of
+ * the first host that differs are printed so that it can be replayed.
+ */
+
+#define HOSTDIFF_HOST_MAX 64
+
+static uint64_t hostdiff_seed = 1;
+static uint64_t hostdiff_count = 1000000;
+
+static bool hostdiff_on_arg(const char *flag, const char *value);
+static size_t hostdiff_build(char *host);
+static void hostdiff_append(char *host, size_t *len, const char *str);
+static size_t hostdiff_reference(char *host, size_t len,
+				 size_t *ref_name_len);
+static bool hostdiff_is_name_char(char ch);
+
+int main(int argc, char **argv)
+{
+	F_UNUSED(argc);
+
+	if (!toolutil_parse_args(argv, "Usage: hostdiff [-s SEED] [-n COUNT]\n",
+				 hostdiff_on_arg))
+		return 2;
+
+	toolutil_seed(hostdiff_seed);
+
+	uint64_t valid = 0;
+	for (uint64_t i = 0; i < hostdiff_count; i++) {
+		char host[HOSTDIFF_HOST_MAX];
+		size_t len = hostdiff_build(host);
+
+		char ref[HOSTDIFF_HOST_MAX];
+		memcpy(ref, host, len);
+		size_t ref_name_len = 0;
+		size_t ref_len = hostdiff_reference(ref, len, &ref_name_len);
+
+		size_t new_len = hostnorm_normalize(host, len);
+		bool same = new_len == ref_len;
+		if (same && new_len != 0) {
+			same = memcmp(host, ref, new_len) == 0 &&
+			       hostnorm_name_len(host, new_len) ==
+				   ref_name_len;
+		}
+		if (!same) {
+			F_PRINT(2, "hostdiff: the normalizations differ\n");
+			toolutil_print_num("seed", hostdiff_seed);
+			toolutil_print_num("host", i);
+			return 1;
+		}
+
+		if (new_len != 0)
+			valid++;
+	}
+
+	toolutil_print_num("hosts", hostdiff_count);
+	toolutil_print_num("valid", valid);
+	toolutil_print_num("invalid", hostdiff_count - valid);
+
+	return 0;
+}
+
+static bool hostdiff_on_arg(const char *flag, const char *value)
+{
+	uint64_t num;
+	if (!toolutil_parse_num(&num, value))
+		return false;
+
+	if (strcmp(flag, "-s") == 0)
+		hostdiff_seed = num;
+	else if (strcmp(flag, "-n") == 0)
+		hostdiff_count = num;
+	else
+		return false;
+
+	return true;
+}
+
+/**
+ * Builds a host that is not empty, like the ones given by the request parser,
+ * and that may cross the boundaries of the blocks.
+ */
+static size_t hostdiff_build(char *host)
+{
+	static const char name_chars[] = "abcXYZ09-._";
+	static const char ipv6_chars[] = "0123456789abcdefABCDEF:";
+	/* Includes bytes that cannot be in a host, and the characters that
+	   are only valid in some places. */
+	static const char noise_chars[] = ":[]./ @\x7f\x80\xff";
+
+	size_t len = 0;
+	if (toolutil_rand_range(0, 3) == 0) {
+		hostdiff_append(host, &len, "[");
+		for (uint64_t n = toolutil_rand_range(0, 30); n != 0; n--) {
+			host[len++] = ipv6_chars[toolutil_rand_range(
+			    0, sizeof(ipv6_chars) - 2)];
+		}
+		hostdiff_append(host, &len, "]");
+	} else {
+		for (uint64_t n = toolutil_rand_range(0, 40); n != 0; n--) {
+			host[len++] = name_chars[toolutil_rand_range(
+			    0, sizeof(name_chars) - 2)];
+		}
+		if (toolutil_rand_range(0, 3) == 0)
+			hostdiff_append(host, &len, ".");
+	}
+
+	switch (toolutil_rand_range(0, 3)) {
+	case 0:
+		hostdiff_append(host, &len, ":80");
+		break;
+	case 1:
+		hostdiff_append(host, &len, ":");
+		for (uint64_t n = toolutil_rand_range(0, 5); n != 0; n--)
+			host[len++] = '0' + toolutil_rand_range(0, 9);
+		break;
+	default:
+		break;
+	}
+
+	/* A few hosts get a byte replaced by noise. */
+	if (len != 0 && toolutil_rand_range(0, 3) == 0) {
+		host[toolutil_rand_range(0, len - 1)] = noise_chars
+		    [toolutil_rand_range(0, sizeof(noise_chars) - 2)];
+	}
+
+	if (len == 0)
+		host[len++] = 'a';
+	return len;
+}
+
+static void hostdiff_append(char *host, size_t *len, const char *str)
+{
+	size_t str_len = strlen(str);
+	memcpy(host + *len, str, str_len);
+	*len += str_len;
+}
+
+/**
+ * Normalizes the host one byte at a time, directly from the rules: a name that
+ * is either a bracketed IPv6 address or only made of the characters of a
+ * domain name, followed by an optional colon and at least one digit.
+ */
+static size_t hostdiff_reference(char *host, size_t len,
+				 size_t *ref_name_len)
+{
+	for (size_t i = 0; i < len; i++) {
+		if (host[i] >= 'A' && host[i] <= 'Z')
+			host[i] += 'a' - 'A';
+		if (!hostdiff_is_name_char(host[i]) && host[i] != ':' &&
+		    host[i] != '[' && host[i] != ']')
+			return 0;
+	}
+
+	size_t name_len = 0;
+	if (host[0] == '[') {
+		name_len = 1;
+		while (name_len < len && host[name_len] != ']') {
+			if (host[name_len] == '[')
+				return 0;
+			name_len++;
+		}
+		if (name_len == len || name_len == 1)
+			return 0;
+		name_len++;
+	} else {
+		while (name_len < len && hostdiff_is_name_char(host[name_len]))
+			name_len++;
+		if (name_len == 0)
+			return 0;
+	}
+
+	size_t port_len = len - name_len;
+	if (port_len != 0) {
+		if (host[name_len] != ':' || port_len == 1)
+			return 0;
+		for (size_t i = name_len + 1; i < len; i++) {
+			if (host[i] < '0' || host[i] > '9')
+				return 0;
+		}
+		if (port_len == 3 && memcmp(host + name_len, ":80", 3) == 0)
+			port_len = 0;
+	}
+
+	size_t new_name_len = name_len;
+	if (host[0] != '[' && host[name_len - 1] == '.') {
+		new_name_len--;
+		if (new_name_len == 0)
+			return 0;
+	}
+
+	memmove(host + new_name_len, host + name_len, port_len);
+	*ref_name_len = new_name_len;
+	return new_name_len + port_len;
+}
+
+static bool hostdiff_is_name_char(char ch)
+{
+	return (ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9') ||
+	       ch == '-' || ch == '.' || ch == '_';
+}
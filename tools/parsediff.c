@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <flibc/mem.h>
+#include <flibc/str.h>
+#include <flibc/util.h>
+
+#include "reqparser.h"
+#include "toolutil.h"
+
+/*
+ * A differential test of the request parser: random requests, valid or
+ * mutated, are parsed once in one piece, which goes through the single-shot
+ * parser, and once byte by byte, which the single-shot parser can never
+ * complete and which therefore only goes through the resumable parser. The
+ * two must give the same result and the same request fields. The seed and the
+ * index of the first request that differs are printed so that it can be
+ * replayed.
+ */
+
+#define PARSEDIFF_REQ_MAX 512
+#define PARSEDIFF_REQ_FIELDS_MAX 128
+
+struct parsediff_result {
+	enum reqparser_completion completion;
+	char req_fields[PARSEDIFF_REQ_FIELDS_MAX];
+};
+
+static uint64_t parsediff_seed = 1;
+static uint64_t parsediff_count = 1000000;
+
+static bool parsediff_on_arg(const char *flag, const char *value);
+static size_t parsediff_build(char *req);
+static void parsediff_mutate(char *req, size_t *len);
+static void parsediff_append(char *req, size_t *len, const char *str);
+static void parsediff_parse(const char *req, size_t len,
+			    size_t req_fields_len, size_t step,
+			    struct parsediff_result *result);
+static bool parsediff_same(const struct parsediff_result *a,
+			   const struct parsediff_result *b,
+			   size_t req_fields_len);
+static size_t parsediff_field_len(const char *field, size_t max);
+
+int main(int argc, char **argv)
+{
+	F_UNUSED(argc);
+
+	if (!toolutil_parse_args(argv,
+				 "Usage: parsediff [-s SEED] [-n COUNT]\n",
+				 parsediff_on_arg))
+		return 2;
+
+	toolutil_seed(parsediff_seed);
+
+	uint64_t results[PC_BUFFER_TOO_SMALL + 1] = {0};
+	for (uint64_t i = 0; i < parsediff_count; i++) {
+		char req[PARSEDIFF_REQ_MAX];
+		size_t len = parsediff_build(req);
+		parsediff_mutate(req, &len);
+		if (len == 0)
+			continue;
+
+		/* Small buffers check that both parsers run out of space for
+		   the same requests. The parser needs room for the NULL
+		   characters after the path and the host at least. */
+		size_t req_fields_len =
+		    toolutil_rand_range(0, 3) == 0
+			? toolutil_rand_range(2, 32)
+			: PARSEDIFF_REQ_FIELDS_MAX;
+
+		struct parsediff_result whole;
+		struct parsediff_result bytes;
+		parsediff_parse(req, len, req_fields_len, len, &whole);
+		parsediff_parse(req, len, req_fields_len, 1, &bytes);
+		if (!parsediff_same(&whole, &bytes, req_fields_len)) {
+			F_PRINT(2, "parsediff: the parsers differ\n");
+			toolutil_print_num("seed", parsediff_seed);
+			toolutil_print_num("request", i);
+			return 1;
+		}
+
+		results[whole.completion]++;
+	}
+
+	toolutil_print_num("requests", parsediff_count);
+	toolutil_print_num("complete", results[PC_COMPLETE]);
+	toolutil_print_num("incomplete", results[PC_NEEDS_MORE_DATA]);
+	toolutil_print_num("bad_data", results[PC_BAD_DATA]);
+	toolutil_print_num("too_small", results[PC_BUFFER_TOO_SMALL]);
+
+	return 0;
+}
+
+static bool parsediff_on_arg(const char *flag, const char *value)
+{
+	uint64_t num;
+	if (!toolutil_parse_num(&num, value))
+		return false;
+
+	if (strcmp(flag, "-s") == 0)
+		parsediff_seed = num;
+	else if (strcmp(flag, "-n") == 0)
+		parsediff_count = num;
+	else
+		return false;
+
+	return true;
+}
+
+static size_t parsediff_build(char *req)
+{
+	static const char *const methods[] = {"GET", "HEAD", "POST", ""};
+	static const char *const headers[] = {
+	    "Accept: */*\r\n", "User-Agent: curl\r\n", "Hos: a\r\n",
+	    "Hostile: b\r\n",  "host: c\r\n",	       "Host:d\r\n",
+	};
+	/* The characters that the parsers look for are added by
+	   parsediff_mutate. */
+	static const char chars[] = "abcz09/.-?=";
+
+	size_t len = 0;
+	parsediff_append(req, &len, methods[toolutil_rand_range(0, 3)]);
+	parsediff_append(req, &len, " ");
+	if (toolutil_rand_range(0, 15) != 0)
+		parsediff_append(req, &len, "/");
+	for (uint64_t n = toolutil_rand_range(0, 40); n != 0; n--)
+		req[len++] = chars[toolutil_rand_range(0, sizeof(chars) - 2)];
+	parsediff_append(req, &len, " HTTP/1.1\r\n");
+
+	for (uint64_t n = toolutil_rand_range(0, 3); n != 0; n--) {
+		parsediff_append(req, &len,
+				 headers[toolutil_rand_range(0, 5)]);
+	}
+
+	if (toolutil_rand_range(0, 7) != 0) {
+		parsediff_append(req, &len, "Host: ");
+		for (uint64_t n = toolutil_rand_range(0, 40); n != 0; n--)
+			req[len++] =
+			    chars[toolutil_rand_range(0, sizeof(chars) - 2)];
+		parsediff_append(req, &len, "\r\n");
+	}
+	parsediff_append(req, &len, "\r\n");
+
+	return len;
+}
+
+static void parsediff_mutate(char *req, size_t *len)
+{
+	static const char chars[] = " \r\n:/H\0a";
+
+	for (uint64_t n = toolutil_rand_range(0, 3); n != 0; n--) {
+		if (*len == 0)
+			return;
+
+		size_t pos = toolutil_rand_range(0, *len - 1);
+		char ch = chars[toolutil_rand_range(0, sizeof(chars) - 2)];
+		switch (toolutil_rand_range(0, 3)) {
+		case 0:
+			req[pos] = ch;
+			break;
+		case 1:
+			if (*len == PARSEDIFF_REQ_MAX)
+				break;
+			memmove(req + pos + 1, req + pos, *len - pos);
+			req[pos] = ch;
+			(*len)++;
+			break;
+		case 2:
+			memmove(req + pos, req + pos + 1, *len - pos - 1);
+			(*len)--;
+			break;
+		default:
+			*len = pos;
+			break;
+		}
+	}
+}
+
+static void parsediff_append(char *req, size_t *len, const char *str)
+{
+	size_t str_len = strlen(str);
+	memcpy(req + *len, str, str_len);
+	*len += str_len;
+}
+
+static void parsediff_parse(const char *req, size_t len,
+			    size_t req_fields_len, size_t step,
+			    struct parsediff_result *result)
+{
+	memset(result->req_fields, 0, sizeof(result->req_fields));
+	result->completion = PC_NEEDS_MORE_DATA;
+
+	struct reqparser_args args;
+	args.state = 0;
+	args.req_fields = result->req_fields;
+	args.req_fields_len = req_fields_len;
+
+	/* Like conn_recv, nothing is parsed after the end of the request. */
+	for (size_t pos = 0;
+	     pos < len && result->completion == PC_NEEDS_MORE_DATA;
+	     pos += step) {
+		args.data = req + pos;
+		args.data_end = req + (len - pos < step ? len : pos + step);
+		result->completion = reqparser_feed(&args);
+	}
+}
+
+static bool parsediff_same(const struct parsediff_result *a,
+			   const struct parsediff_result *b,
+			   size_t req_fields_len)
+{
+	if (a->completion != b->completion)
+		return false;
+	if (a->completion != PC_COMPLETE)
+		return true;
+
+	/* Only the path and the host are meaningful. */
+	size_t path_len = parsediff_field_len(a->req_fields, req_fields_len);
+	size_t host_len = parsediff_field_len(a->req_fields + path_len + 1,
+					      req_fields_len - path_len - 1);
+	return memcmp(a->req_fields, b->req_fields,
+		      path_len + 1 + host_len) == 0;
+}
+
+static size_t parsediff_field_len(const char *field, size_t max)
+{
+	size_t len = 0;
+	while (len < max && field[len] != '\0')
+		len++;
+	return len;
+}
@@ -0,0 +1,508 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <flibc/linux.h>
+#include <flibc/mem.h>
+#include <flibc/util.h>
+
+#include "capture.h"
+#include "fmt.h"
+#include "reqparser.h"
+#include "sysext.h"
+#include "toolutil.h"
+
+/*
+ * Replays a file written with --capture. By default, the chunks are fed
+ * straight into the request parser, one connection after the other, as many
+ * times as asked, which measures the parser on real requests. With -p, every
+ * connection is opened again to a server on the loopback interface and its
+ * chunks are written with the same boundaries and, unless the speed is 0, the
+ * same pace divided by the speed. The results are printed as "name value"
+ * lines, like the statistics.
+ */
+
+#define REPLAY_CLOCK_MONOTONIC 1
+
+/* How long the responses are waited for after the last chunk, in
+   milliseconds. It is longer than the timeout of the server. */
+#define REPLAY_DRAIN_TIME 3000
+
+/* The size of the request fields in the conn module. */
+#define REPLAY_REQ_FIELDS_LEN 256
+
+struct replay_chunk {
+	uint64_t time;
+	uint32_t conn;
+	uint32_t len;
+	const char *data;
+};
+
+struct replay_slot {
+	uint32_t conn;
+	int fd;
+	bool answered;
+};
+
+struct replay_config {
+	const char *path;
+	uint64_t port;
+	uint64_t speed;
+	uint64_t iterations;
+};
+
+static struct replay_config replay_config;
+static struct replay_chunk *replay_chunks;
+static uint64_t replay_chunk_count;
+static uint64_t replay_bytes;
+
+/* The connections of the network mode, in an open addressing table indexed
+   by their conn number. */
+static struct replay_slot *replay_slots;
+static uint64_t replay_slot_mask;
+static uint64_t replay_open;
+
+static bool replay_parse_args(char **argv);
+static bool replay_on_arg(const char *flag, const char *value);
+static bool replay_load();
+static void *replay_alloc(size_t len);
+static uint64_t replay_now_ns();
+
+static bool replay_less(const struct replay_chunk *a,
+			const struct replay_chunk *b, bool by_conn);
+static void replay_sort(bool by_conn);
+static void replay_sift_down(uint64_t root, uint64_t end, bool by_conn);
+
+static int replay_parse();
+static int replay_send();
+static struct replay_slot *replay_find_slot(uint32_t conn);
+static bool replay_poll(int epoll_fd, int timeout, uint64_t *statuses);
+
+int main(int argc, char **argv)
+{
+	F_UNUSED(argc);
+
+	if (!replay_parse_args(argv) || !replay_load())
+		return 2;
+
+	return replay_config.port == 0 ? replay_parse() : replay_send();
+}
+
+static bool replay_parse_args(char **argv)
+{
+	replay_config.path = NULL;
+	replay_config.port = 0;
+	replay_config.speed = 1;
+	replay_config.iterations = 1;
+
+	if (!toolutil_parse_args(argv,
+				 "Usage: replay -f FILE [-n ITERATIONS]\n"
+				 "       replay -f FILE -p PORT [-s SPEED]\n",
+				 replay_on_arg))
+		return false;
+
+	if (replay_config.path == NULL) {
+		F_PRINT(2, "replay: missing capture file\n");
+		return false;
+	}
+
+	return true;
+}
+
+static bool replay_on_arg(const char *flag, const char *value)
+{
+	if (strcmp(flag, "-f") == 0) {
+		replay_config.path = value;
+		return true;
+	}
+
+	uint64_t num;
+	if (!toolutil_parse_num(&num, value))
+		return false;
+
+	if (strcmp(flag, "-p") == 0 && num >= 1 && num <= UINT16_MAX)
+		replay_config.port = num;
+	else if (strcmp(flag, "-s") == 0)
+		replay_config.speed = num;
+	else if (strcmp(flag, "-n") == 0 && num >= 1)
+		replay_config.iterations = num;
+	else
+		return false;
+
+	return true;
+}
+
+static bool replay_load()
+{
+	int fd = sysext_openat(AT_FDCWD, replay_config.path,
+			       O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0) {
+		F_PRINT(2, "replay: open() failed\n");
+		return false;
+	}
+
+	int64_t size = sysext_lseek(fd, 0, SEEK_END);
+	uint64_t magic;
+	if (size < (int64_t)sizeof(magic)) {
+		F_PRINT(2, "replay: the file is not a capture\n");
+		return false;
+	}
+
+	const char *file =
+	    sysext_mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	F_ASSERT(sys_close(fd) == 0);
+	if (SYSEXT_IS_ERR(file)) {
+		F_PRINT(2, "replay: mmap() failed\n");
+		return false;
+	}
+
+	memcpy(&magic, file, sizeof(magic));
+	if (magic != CAPTURE_MAGIC) {
+		F_PRINT(2, "replay: the file is not a capture\n");
+		return false;
+	}
+
+	/* There cannot be more chunks than records of the smallest size. */
+	uint64_t max_chunks = size / sizeof(struct capture_record);
+	replay_chunks = replay_alloc((max_chunks + 1) * sizeof(*replay_chunks));
+	if (replay_chunks == NULL) {
+		F_PRINT(2, "replay: mmap() failed\n");
+		return false;
+	}
+
+	/* A worker that was killed may have left a truncated record at the
+	   end of a batch, but never in the middle of the file. */
+	const char *cursor = file + sizeof(magic);
+	const char *end = file + size;
+	while ((size_t)(end - cursor) >= sizeof(struct capture_record)) {
+		struct capture_record record;
+		memcpy(&record, cursor, sizeof(record));
+		cursor += sizeof(record);
+		if (record.len > (size_t)(end - cursor))
+			break;
+
+		struct replay_chunk *chunk = &replay_chunks[replay_chunk_count];
+		chunk->time = record.time;
+		chunk->conn = record.conn;
+		chunk->len = record.len;
+		chunk->data = cursor;
+		replay_chunk_count++;
+		replay_bytes += record.len;
+		cursor += record.len;
+	}
+
+	return true;
+}
+
+static void *replay_alloc(size_t len)
+{
+	void *ptr = sysext_mmap(NULL, len, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return SYSEXT_IS_ERR(ptr) ? NULL : ptr;
+}
+
+static uint64_t replay_now_ns()
+{
+	struct timespec ts;
+	if (sys_clock_gettime(REPLAY_CLOCK_MONOTONIC, &ts) != 0)
+		return 0;
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool replay_less(const struct replay_chunk *a,
+			const struct replay_chunk *b, bool by_conn)
+{
+	if (by_conn && a->conn != b->conn)
+		return a->conn < b->conn;
+	if (a->time != b->time)
+		return a->time < b->time;
+
+	/* The chunks of a connection are in order in the file. */
+	return a->data < b->data;
+}
+
+static void replay_sort(bool by_conn)
+{
+	/* A heap sort, which does not need any memory. */
+	for (uint64_t i = replay_chunk_count / 2; i-- > 0;)
+		replay_sift_down(i, replay_chunk_count, by_conn);
+
+	for (uint64_t end = replay_chunk_count; end > 1;) {
+		end--;
+		struct replay_chunk tmp = replay_chunks[0];
+		replay_chunks[0] = replay_chunks[end];
+		replay_chunks[end] = tmp;
+		replay_sift_down(0, end, by_conn);
+	}
+}
+
+static void replay_sift_down(uint64_t root, uint64_t end, bool by_conn)
+{
+	while (2 * root + 1 < end) {
+		uint64_t child = 2 * root + 1;
+		if (child + 1 < end &&
+		    replay_less(&replay_chunks[child],
+				&replay_chunks[child + 1], by_conn))
+			child++;
+		if (!replay_less(&replay_chunks[root], &replay_chunks[child],
+				 by_conn))
+			return;
+
+		struct replay_chunk tmp = replay_chunks[root];
+		replay_chunks[root] = replay_chunks[child];
+		replay_chunks[child] = tmp;
+		root = child;
+	}
+}
+
+static int replay_parse()
+{
+	/* The parser only sees one connection at a time, so it does not
+	   matter when the chunks were received. */
+	replay_sort(true);
+
+	uint64_t results[PC_BUFFER_TOO_SMALL + 1] = {0};
+	uint64_t conns = 0;
+	char req_fields[REPLAY_REQ_FIELDS_LEN];
+
+	uint64_t start = replay_now_ns();
+	for (uint64_t iteration = 0; iteration < replay_config.iterations;
+	     iteration++) {
+		struct reqparser_args args;
+		enum reqparser_completion result = PC_NEEDS_MORE_DATA;
+
+		for (uint64_t i = 0; i < replay_chunk_count; i++) {
+			const struct replay_chunk *chunk = &replay_chunks[i];
+			if (i == 0 ||
+			    chunk->conn != replay_chunks[i - 1].conn) {
+				if (i != 0)
+					results[result]++;
+				conns++;
+				result = PC_NEEDS_MORE_DATA;
+				args.state = 0;
+				memset(req_fields, 0, sizeof(req_fields));
+			}
+
+			/* Like conn_recv, nothing is parsed after the end of
+			   the request. */
+			if (result != PC_NEEDS_MORE_DATA)
+				continue;
+
+			args.data = chunk->data;
+			args.data_end = chunk->data + chunk->len;
+			args.req_fields = req_fields;
+			args.req_fields_len = sizeof(req_fields);
+			result = reqparser_feed(&args);
+		}
+		if (replay_chunk_count != 0)
+			results[result]++;
+	}
+	uint64_t elapsed = replay_now_ns() - start;
+
+	toolutil_print_num("conns", conns / replay_config.iterations);
+	toolutil_print_num("chunks", replay_chunk_count);
+	toolutil_print_num("bytes", replay_bytes);
+	toolutil_print_num("iterations", replay_config.iterations);
+	toolutil_print_num("complete", results[PC_COMPLETE]);
+	toolutil_print_num("incomplete", results[PC_NEEDS_MORE_DATA]);
+	toolutil_print_num("bad_data", results[PC_BAD_DATA]);
+	toolutil_print_num("too_small", results[PC_BUFFER_TOO_SMALL]);
+	toolutil_print_num("ns", elapsed);
+	toolutil_print_num("ns_per_conn", conns == 0 ? 0 : elapsed / conns);
+	toolutil_print_num("mb_per_second",
+			   elapsed == 0 ? 0
+					: replay_bytes *
+					      replay_config.iterations * 1000 /
+					      elapsed);
+
+	return 0;
+}
+
+static int replay_send()
+{
+	replay_sort(false);
+
+	/* Every connection of the capture may be open at once. */
+	struct sysext_rlimit limit;
+	if (sysext_prlimit64(0, RLIMIT_NOFILE, NULL, &limit) == 0) {
+		limit.cur = limit.max;
+		sysext_prlimit64(0, RLIMIT_NOFILE, &limit, NULL);
+	}
+
+	/* The server closes the connections whose request is invalid, which
+	   must make the writes fail instead of killing the replayer. */
+	uint64_t mask = SYSEXT_SIGBIT(SIGPIPE);
+	int epoll_fd = sys_epoll_create1(EPOLL_CLOEXEC);
+	uint64_t slot_count = 16;
+	while (slot_count < replay_chunk_count * 2)
+		slot_count *= 2;
+	replay_slots = replay_alloc(slot_count * sizeof(*replay_slots));
+	replay_slot_mask = slot_count - 1;
+	if (sysext_rt_sigprocmask(SIG_BLOCK, &mask, NULL) != 0 ||
+	    epoll_fd < 0 || replay_slots == NULL) {
+		F_PRINT(2, "replay: initialization failed\n");
+		return 1;
+	}
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(replay_config.port);
+	addr.sin_addr = __builtin_bswap32(0x7f000001);
+
+	/* The status classes, 0 for the connections without a response. */
+	uint64_t statuses[6] = {0};
+	uint64_t conns = 0;
+	uint64_t connect_errors = 0;
+	uint64_t start = replay_now_ns();
+	uint64_t first = replay_chunk_count == 0 ? 0 : replay_chunks[0].time;
+
+	for (uint64_t i = 0; i < replay_chunk_count; i++) {
+		const struct replay_chunk *chunk = &replay_chunks[i];
+
+		/* The capture is in microseconds. */
+		if (replay_config.speed != 0) {
+			uint64_t due = start + (chunk->time - first) * 1000 /
+						   replay_config.speed;
+			for (uint64_t now = replay_now_ns(); now < due;
+			     now = replay_now_ns()) {
+				if (!replay_poll(epoll_fd,
+						 (due - now) / 1000000,
+						 statuses))
+					return 1;
+			}
+		}
+
+		struct replay_slot *slot = replay_find_slot(chunk->conn);
+		if (slot->conn == 0) {
+			slot->conn = chunk->conn;
+			conns++;
+
+			/* A blocking socket keeps the order of the chunks
+			   simple, and the server is local. */
+			slot->fd =
+			    sys_socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+			if (slot->fd < 0 ||
+			    sysext_connect(slot->fd, (struct sockaddr *)&addr,
+					   sizeof(addr)) != 0) {
+				connect_errors++;
+				if (slot->fd >= 0)
+					F_ASSERT(sys_close(slot->fd) == 0);
+				slot->fd = -1;
+				continue;
+			}
+
+			replay_open++;
+
+			struct epoll_event event;
+			event.events = EPOLLIN | EPOLLRDHUP;
+			event.data.u64 = slot - replay_slots;
+			if (sys_epoll_ctl(epoll_fd, EPOLL_CTL_ADD, slot->fd,
+					  &event) != 0) {
+				F_PRINT(2, "replay: epoll_ctl() failed\n");
+				return 1;
+			}
+		}
+
+		/* The server may have answered and closed the connection
+		   already, in which case the rest is dropped. */
+		if (slot->fd != -1)
+			sys_write(slot->fd, chunk->data, chunk->len);
+
+		if (!replay_poll(epoll_fd, 0, statuses))
+			return 1;
+	}
+
+	uint64_t drain_end = replay_now_ns() + REPLAY_DRAIN_TIME * 1000000ULL;
+	for (uint64_t now = replay_now_ns();
+	     now < drain_end && replay_open != 0; now = replay_now_ns()) {
+		if (!replay_poll(epoll_fd, (drain_end - now) / 1000000,
+				 statuses))
+			return 1;
+	}
+	uint64_t elapsed = replay_now_ns() - start;
+
+	uint64_t answered = 0;
+	for (int i = 1; i < 6; i++)
+		answered += statuses[i];
+
+	toolutil_print_num("conns", conns);
+	toolutil_print_num("chunks", replay_chunk_count);
+	toolutil_print_num("bytes", replay_bytes);
+	toolutil_print_num("connect_errors", connect_errors);
+	toolutil_print_num("status_2xx", statuses[2]);
+	toolutil_print_num("status_3xx", statuses[3]);
+	toolutil_print_num("status_4xx", statuses[4]);
+	toolutil_print_num("status_5xx", statuses[5]);
+	toolutil_print_num("status_other", statuses[1]);
+	toolutil_print_num("no_response", conns - connect_errors - answered);
+	toolutil_print_num("ms", elapsed / 1000000);
+
+	return 0;
+}
+
+static struct replay_slot *replay_find_slot(uint32_t conn)
+{
+	uint64_t index = (conn * 0x9e3779b97f4a7c15ULL) >> 32;
+	for (;; index++) {
+		struct replay_slot *slot =
+		    &replay_slots[index & replay_slot_mask];
+		if (slot->conn == conn || slot->conn == 0)
+			return slot;
+	}
+}
+
+static bool replay_poll(int epoll_fd, int timeout, uint64_t *statuses)
+{
+	struct epoll_event events[64];
+	int ret = sys_epoll_wait(epoll_fd, events,
+				 sizeof(events) / sizeof(*events), timeout);
+	if (ret < 0 && ret != -EINTR) {
+		F_PRINT(2, "replay: epoll_wait() failed\n");
+		return false;
+	}
+
+	for (int i = 0; i < ret; i++) {
+		struct replay_slot *slot = &replay_slots[events[i].data.u64];
+		if (slot->fd == -1)
+			continue;
+
+		/* The responses fit in one read, and their status line is
+		   all that matters. */
+		char buf[512];
+		ssize_t len = sys_read(slot->fd, buf, sizeof(buf));
+		if (len > 0 && !slot->answered) {
+			slot->answered = true;
+			if (len >= 12 && memcmp(buf, "HTTP/1.1 ", 9) == 0 &&
+			    buf[9] >= '2' && buf[9] <= '5')
+				statuses[buf[9] - '0']++;
+			else
+				statuses[1]++;
+		}
+		if (len > 0)
+			continue;
+
+		F_ASSERT(sys_close(slot->fd) == 0);
+		slot->fd = -1;
+		replay_open--;
+	}
+
+	return true;
+}
@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <flibc/mem.h>
+#include <flibc/util.h>
+
+#include "acme.h"
+#include "backlog.h"
+#include "cli.h"
+#include "epoll.h"
+#include "fmt.h"
+#include "health.h"
+#include "reload.h"
+#include "simos.h"
+#include "stats.h"
+#include "sysext.h"
+#include "toolutil.h"
+
+#define SIM_CLOCK_PROCESS_CPUTIME_ID 2
+
+/*
+ * The simulation harness: runs the real event loop and connection code against
+ * the fake os module of simos.c, and prints a report of what the clients saw
+ * and how much CPU time the server needed per request.
+ */
+
+static struct simos_config sim_config;
+static uint64_t sim_max_backlog;
+
+static int sim_run(const struct simos_config *config,
+		   const struct simos_paths *paths, int listen_fd,
+		   uint64_t max_backlog);
+static bool sim_on_arg(const char *flag, const char *value);
+static uint64_t sim_cpu_time();
+
+int main(int argc, char **argv)
+{
+	F_UNUSED(argc);
+
+	sim_config.seed = 1;
+	sim_config.clients = 100000;
+	sim_config.concurrency = 64;
+	sim_config.backlog = 32;
+
+	if (!toolutil_parse_args(argv,
+				 "Usage: sim [-s SEED] [-n CLIENTS] "
+				 "[-c CONCURRENCY] [-b BACKLOG] "
+				 "[-m MAX_BACKLOG]\n",
+				 sim_on_arg))
+		return 2;
+
+	/* The files of the server are written in a directory of its own, so
+	   that several simulations can run at once. */
+	char dir[SIMOS_PATH_MAX];
+	const char dir_prefix[] = "/tmp/http2sd-sim.";
+	memcpy(dir, dir_prefix, sizeof(dir_prefix) - 1);
+	dir[sizeof(dir_prefix) - 1 +
+	    fmt_u64(dir + sizeof(dir_prefix) - 1, sysext_getpid())] = '\0';
+	sim_config.dir = dir;
+
+	struct simos_paths paths;
+	int listen_fd = simos_init(&sim_config, &paths);
+	int ret = listen_fd < 0 ? 1
+				: sim_run(&sim_config, &paths, listen_fd,
+					  sim_max_backlog);
+	simos_cleanup();
+	return ret;
+}
+
+static int sim_run(const struct simos_config *config,
+		   const struct simos_paths *paths, int listen_fd,
+		   uint64_t max_backlog)
+{
+	struct cli_options options;
+	options.server_port = 80;
+	options.tcp = true;
+	options.unix_socket_path = NULL;
+	options.unix_socket_mode = 0660;
+	options.threads = 1;
+	options.max_threads = 0;
+	options.socket_backlog = config->backlog;
+	options.max_socket_backlog = max_backlog;
+	options.coarse_clock = false;
+	options.perf_counters = false;
+	options.access_log_path = NULL;
+	options.access_log_wait = false;
+	options.rate_limit = 0;
+	options.rate_limit_burst = 0;
+	/* The virtual clock does not advance while spinning. */
+	options.busy_poll = 0;
+	options.rx_timestamps = false;
+	options.close_strategy = CCS_CLOSE;
+	options.linger = 1000;
+	options.acme_dir = paths->acme_dir;
+	options.allow_hosts_path = paths->hosts;
+	options.subnet_targets_path = paths->subnets;
+	options.health_path = SIMOS_HEALTH_PATH;
+	options.capture_path = NULL;
+	options.capture_sample = 1;
+
+	/* Like the main function, before the event loop is initialized. */
+	if (!acme_init(options.acme_dir) ||
+	    !health_init(options.health_path) ||
+	    !reload_init(options.allow_hosts_path,
+			 options.subnet_targets_path))
+		return 1;
+
+	backlog_init(listen_fd, options.socket_backlog,
+		     options.max_socket_backlog);
+	backlog_set_worker(0);
+	if (!epoll_init(listen_fd, -1, &options) || !backlog_listen())
+		return 1;
+
+	uint64_t cpu_start = sim_cpu_time();
+	while (!simos_is_finished()) {
+		if (!epoll_wait_and_dispatch())
+			return 1;
+	}
+	uint64_t cpu_time = sim_cpu_time() - cpu_start;
+
+	struct simos_report report;
+	simos_get_report(&report);
+
+	uint64_t failed = 0;
+	for (int i = 0; i < SB_COUNT; i++) {
+		/* The suffix completes the name of the behavior. */
+		F_PRINT(1, simos_behavior_names[i]);
+		toolutil_print_num("_ok", report.ok[i]);
+		F_PRINT(1, simos_behavior_names[i]);
+		toolutil_print_num("_failed", report.failed[i]);
+		failed += report.failed[i];
+	}
+
+	toolutil_print_num("clients", config->clients);
+	toolutil_print_num("virtual_ms", report.virtual_time);
+	toolutil_print_num("cpu_ns", cpu_time);
+	toolutil_print_num("cpu_ns_per_client",
+			   config->clients == 0 ? 0
+						: cpu_time / config->clients);
+	toolutil_print_num("clients_per_cpu_second",
+			   cpu_time == 0
+			       ? 0
+			       : config->clients * 1000000000 / cpu_time);
+	stats_dump(1);
+
+	return failed == 0 ? 0 : 1;
+}
+
+static bool sim_on_arg(const char *flag, const char *value)
+{
+	uint64_t num;
+	if (!toolutil_parse_num(&num, value))
+		return false;
+
+	if (strcmp(flag, "-s") == 0)
+		sim_config.seed = num;
+	else if (strcmp(flag, "-n") == 0)
+		sim_config.clients = num;
+	else if (strcmp(flag, "-c") == 0 && num >= 1 && num <= 4096)
+		sim_config.concurrency = num;
+	else if (strcmp(flag, "-b") == 0 && num >= 1 && num <= 4096)
+		sim_config.backlog = num;
+	else if (strcmp(flag, "-m") == 0 && num <= 4096)
+		sim_max_backlog = num;
+	else
+		return false;
+
+	return true;
+}
+
+static uint64_t sim_cpu_time()
+{
+	struct timespec ts;
+	if (sys_clock_gettime(SIM_CLOCK_PROCESS_CPUTIME_ID, &ts) != 0)
+		return 0;
+
+	return ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
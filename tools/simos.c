@@ -0,0 +1,1210 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <flibc/mem.h>
+#include <flibc/util.h>
+
+#include "fmt.h"
+#include "os.h"
+#include "simos.h"
+#include "stats.h"
+#include "sysext.h"
+#include "toolutil.h"
+
+/* The simulated FDs are above the ones that the kernel gives out with the
+   default fs.nr_open, so that they never clash with the real FDs that the
+   server creates, such as the eventfd of the reload module. */
+#define SIMOS_FD_BASE (1 << 20)
+#define SIMOS_LISTEN_FD SIMOS_FD_BASE
+#define SIMOS_EPOLL_FD (SIMOS_FD_BASE + 1)
+#define SIMOS_SIGNAL_FD (SIMOS_FD_BASE + 2)
+#define SIMOS_NETSTAT_FD (SIMOS_FD_BASE + 3)
+#define SIMOS_FIRST_CLIENT_FD (SIMOS_FD_BASE + 4)
+
+#define SIMOS_MAX_CLIENTS 4096
+#define SIMOS_MAX_FDS                                                          \
+	(SIMOS_FIRST_CLIENT_FD - SIMOS_FD_BASE + SIMOS_MAX_CLIENTS)
+
+/* The real FDs that the server watches: the inotify FD of the acme module and
+   the eventfd of the reload module. */
+#define SIMOS_MAX_REAL_FDS 4
+
+/* How long the builder of the host list has to publish the new image, in real
+   milliseconds. */
+#define SIMOS_RELOAD_TIMEOUT 10000
+
+#define SIMOS_ACME_TOKENS 4
+
+/* The timeout of the event loop, which the slow and idle clients expect. */
+#define SIMOS_CONN_TIMEOUT 2000
+
+/* How late the server can close a connection after its timeout. */
+#define SIMOS_TIMEOUT_SLACK 2
+
+/* When the accept queue is full, a client tries to connect again after this
+   amount of milliseconds, like TCP does when its SYN is dropped. */
+#define SIMOS_SYN_RETRY 1000
+
+#define SIMOS_NEVER UINT64_MAX
+
+enum simos_reload {
+	/**
+	 * The host list has not been extended yet.
+	 */
+	SR_WAITING,
+
+	/**
+	 * The host list has been extended and SIGHUP is pending.
+	 */
+	SR_SIGNALED,
+
+	/**
+	 * The server has received SIGHUP and its builder is running.
+	 */
+	SR_BUILDING,
+
+	SR_DONE,
+};
+
+enum simos_phase {
+	SP_UNUSED,
+	SP_CONNECTING,
+	SP_QUEUED,
+	SP_ACCEPTED,
+};
+
+struct simos_client {
+	uint64_t id;
+	enum simos_behavior behavior;
+	enum simos_phase phase;
+
+	/**
+	 * When the client connects, or delivers its next chunk of request
+	 * after it has connected.
+	 */
+	uint64_t next_send;
+
+	/**
+	 * When the client makes space in its receive buffer, after the server
+	 * has filled it.
+	 */
+	uint64_t next_refill;
+
+	uint64_t accept_time;
+	int fd;
+
+	/* Client to server */
+	char request[400];
+	uint16_t request_len;
+	uint16_t delivered;
+	uint16_t consumed;
+	uint16_t max_chunk;
+	uint16_t max_delay;
+	uint16_t min_delay;
+	/**
+	 * The client shuts down its side of the connection after it has
+	 * delivered this amount of bytes.
+	 */
+	uint16_t shutdown_at;
+	bool shut;
+
+	/* Server to client */
+	char response[512];
+	uint16_t response_len;
+	uint16_t tx_space;
+	char expected[512];
+	uint16_t expected_len;
+
+	/* epoll */
+	bool registered;
+	uint32_t events;
+	uint64_t data;
+	bool in_edge;
+	bool out_edge;
+};
+
+struct simos_real_fd {
+	int fd;
+	uint64_t data;
+};
+
+static struct simos_config simos_config;
+static struct simos_paths simos_paths;
+static uint64_t simos_now;
+static uint64_t simos_spawned;
+static uint32_t simos_live;
+
+static struct simos_client simos_clients[SIMOS_MAX_CLIENTS];
+
+/**
+ * Maps the client FDs, minus SIMOS_FD_BASE, to the index of their client.
+ */
+static int32_t simos_fds[SIMOS_MAX_FDS];
+
+static struct simos_real_fd simos_real_fds[SIMOS_MAX_REAL_FDS];
+static uint32_t simos_real_fd_count;
+
+static bool simos_signal_registered;
+static uint64_t simos_signal_data;
+
+/**
+ * The signals that are pending for the signalfd.
+ */
+static uint64_t simos_signals;
+
+static enum simos_reload simos_reload;
+
+static uint32_t simos_accept_queue[SIMOS_MAX_CLIENTS];
+static uint32_t simos_accept_head;
+static uint32_t simos_accept_len;
+
+static bool simos_listen_registered;
+static uint64_t simos_listen_data;
+
+/**
+ * The limit of the accept queue, which the server can change with listen, and
+ * the amount of connection attempts that were dropped because it was full.
+ */
+static uint32_t simos_backlog;
+static uint64_t simos_overflows;
+
+/**
+ * The content of /proc/net/netstat when it was opened, and how much of it has
+ * been read.
+ */
+static char simos_netstat[64 + FMT_U64_MAX_LEN];
+static uint16_t simos_netstat_len;
+static uint16_t simos_netstat_read;
+
+static struct simos_report simos_report;
+static uint32_t simos_failures_printed;
+
+const char *const simos_behavior_names[SB_COUNT] = {
+    [SB_NORMAL] = "normal",	      [SB_LONG_PATH] = "long_path",
+    [SB_BAD_REQUEST] = "bad_request", [SB_EARLY_CLOSE] = "early_close",
+    [SB_SLOW] = "slow",		      [SB_IDLE] = "idle",
+    [SB_ONE_CHUNK] = "one_chunk",     [SB_HEALTH] = "health",
+    [SB_ACME] = "acme",		      [SB_REJECTED] = "rejected",
+    [SB_RELOADED] = "reloaded",	      [SB_SUBNET] = "subnet",
+};
+
+static bool simos_write_files();
+static bool simos_join(char *path, const char *dir, const char *name);
+static bool simos_write_file(const char *path, const char *content,
+			     int flags);
+static void simos_acme_token(uint64_t index, char *token);
+static void simos_start_reload();
+static int simos_wait_reload(struct epoll_event *events, int max_events);
+
+
+static void simos_spawn(uint32_t slot, uint64_t connect_time);
+static void simos_build_request(struct simos_client *c);
+static void simos_append(char *buf, uint16_t *len, uint16_t capacity,
+			 const char *data, size_t data_len);
+static void simos_append_str(char *buf, uint16_t *len, uint16_t capacity,
+			     const char *str);
+
+static void simos_run_until_now();
+static void simos_send(struct simos_client *c);
+static void simos_check(struct simos_client *c);
+static void simos_fail(struct simos_client *c, const char *why);
+
+static struct simos_client *simos_client_from_fd(int fd);
+
+int simos_init(const struct simos_config *config, struct simos_paths *paths)
+{
+	F_ASSERT(config->concurrency >= 1 &&
+		 config->concurrency <= SIMOS_MAX_CLIENTS);
+
+	simos_config = *config;
+	if (!simos_write_files())
+		return -1;
+	*paths = simos_paths;
+
+	simos_backlog = config->backlog;
+	toolutil_seed(config->seed * 2 + 1);
+	simos_now = 1000000;
+
+	for (int i = 0; i < SIMOS_MAX_FDS; i++)
+		simos_fds[i] = -1;
+
+	for (uint32_t slot = 0; slot < config->concurrency; slot++) {
+		if (simos_spawned == config->clients)
+			break;
+		simos_spawn(slot, simos_now + toolutil_rand_range(0, 10));
+	}
+
+	return SIMOS_LISTEN_FD;
+}
+
+void simos_cleanup()
+{
+	for (uint64_t i = 0; i < SIMOS_ACME_TOKENS; i++) {
+		char token[SIMOS_PATH_MAX];
+		char path[SIMOS_PATH_MAX];
+		simos_acme_token(i, token);
+		if (simos_join(path, simos_paths.acme_dir, token))
+			sysext_unlinkat(AT_FDCWD, path, 0);
+	}
+	sysext_unlinkat(AT_FDCWD, simos_paths.acme_dir, AT_REMOVEDIR);
+	sysext_unlinkat(AT_FDCWD, simos_paths.hosts, 0);
+	sysext_unlinkat(AT_FDCWD, simos_paths.subnets, 0);
+	sysext_unlinkat(AT_FDCWD, simos_config.dir, AT_REMOVEDIR);
+}
+
+bool simos_is_finished()
+{
+	/* The server must also receive its signals, so that the builder of
+	   the host list is never left behind. */
+	return simos_spawned == simos_config.clients && simos_live == 0 &&
+	       simos_signals == 0 && simos_reload != SR_BUILDING;
+}
+
+void simos_get_report(struct simos_report *report)
+{
+	*report = simos_report;
+	report->virtual_time = simos_now - 1000000;
+}
+
+/*
+ * The os module
+ */
+
+int os_epoll_create1(int flags)
+{
+	F_UNUSED(flags);
+	stats_inc(SC_SYSCALLS);
+	return SIMOS_EPOLL_FD;
+}
+
+int os_epoll_ctl(int epoll_fd, int op, int fd, struct epoll_event *event)
+{
+	stats_inc(SC_SYSCALLS);
+	F_ASSERT(epoll_fd == SIMOS_EPOLL_FD);
+
+	if (fd < SIMOS_FD_BASE) {
+		uint32_t i = 0;
+		while (i < simos_real_fd_count && simos_real_fds[i].fd != fd)
+			i++;
+		if (op == EPOLL_CTL_DEL) {
+			F_ASSERT(i < simos_real_fd_count);
+			simos_real_fd_count--;
+			simos_real_fds[i] = simos_real_fds[simos_real_fd_count];
+			return 0;
+		}
+		if (op == EPOLL_CTL_ADD) {
+			F_ASSERT(i == simos_real_fd_count &&
+				 i < SIMOS_MAX_REAL_FDS);
+			simos_real_fd_count++;
+		}
+		simos_real_fds[i].fd = fd;
+		simos_real_fds[i].data = event->data.u64;
+		return 0;
+	}
+
+	if (fd == SIMOS_SIGNAL_FD) {
+		F_ASSERT(op == EPOLL_CTL_ADD && !simos_signal_registered);
+		simos_signal_registered = true;
+		simos_signal_data = event->data.u64;
+		return 0;
+	}
+
+	if (fd == SIMOS_LISTEN_FD) {
+		if (op == EPOLL_CTL_DEL) {
+			F_ASSERT(simos_listen_registered);
+			simos_listen_registered = false;
+		} else {
+			F_ASSERT(op == EPOLL_CTL_ADD &&
+				 !simos_listen_registered);
+			simos_listen_registered = true;
+			simos_listen_data = event->data.u64;
+		}
+		return 0;
+	}
+
+	struct simos_client *c = simos_client_from_fd(fd);
+	switch (op) {
+	case EPOLL_CTL_ADD:
+		F_ASSERT(!c->registered);
+		c->registered = true;
+		/* An edge-triggered FD reports its current state once when it
+		   is added or modified. */
+		__attribute__((fallthrough));
+	case EPOLL_CTL_MOD:
+		F_ASSERT(c->registered);
+		c->events = event->events;
+		c->data = event->data.u64;
+		c->in_edge = c->consumed < c->delivered || c->shut;
+		c->out_edge = c->tx_space > 0;
+		return 0;
+	case EPOLL_CTL_DEL:
+		F_ASSERT(c->registered);
+		c->registered = false;
+		return 0;
+	}
+
+	F_ASSERT_UNREACHABLE();
+}
+
+int os_epoll_wait(int epoll_fd, struct epoll_event *events, int max_events,
+		  int timeout)
+{
+	stats_inc(SC_SYSCALLS);
+	F_ASSERT(epoll_fd == SIMOS_EPOLL_FD && max_events > 0);
+
+	uint64_t deadline =
+	    timeout < 0 ? SIMOS_NEVER : simos_now + (uint64_t)timeout;
+
+	for (;;) {
+		simos_run_until_now();
+
+		/* Give the control back to the driver, which stops. */
+		if (simos_is_finished())
+			return 0;
+
+		int count = 0;
+		if (simos_reload == SR_BUILDING)
+			count = simos_wait_reload(events, max_events);
+
+		if (simos_signal_registered && simos_signals != 0 &&
+		    count < max_events) {
+			events[count].events = EPOLLIN;
+			events[count].data.u64 = simos_signal_data;
+			count++;
+		}
+
+		if (simos_listen_registered && simos_accept_len != 0 &&
+		    count < max_events) {
+			events[count].events = EPOLLIN;
+			events[count].data.u64 = simos_listen_data;
+			count++;
+		}
+
+		for (uint32_t slot = 0; slot < simos_config.concurrency &&
+					count < max_events;
+		     slot++) {
+			struct simos_client *c = &simos_clients[slot];
+			if (c->phase != SP_ACCEPTED || !c->registered)
+				continue;
+
+			uint32_t ready = 0;
+			if (c->in_edge && (c->events & EPOLLIN) != 0)
+				ready |= EPOLLIN;
+			if (c->in_edge && c->shut &&
+			    (c->events & EPOLLRDHUP) != 0)
+				ready |= EPOLLRDHUP;
+			if (c->out_edge && (c->events & EPOLLOUT) != 0)
+				ready |= EPOLLOUT;
+			if (ready == 0)
+				continue;
+
+			/* The edges are consumed by reporting them. */
+			c->in_edge = false;
+			c->out_edge = false;
+			events[count].events = ready;
+			events[count].data.u64 = c->data;
+			count++;
+		}
+
+		if (count != 0 || simos_now >= deadline)
+			return count;
+
+		/* Nothing is ready, so jump to the next thing that will
+		   happen. */
+		uint64_t next = SIMOS_NEVER;
+		for (uint32_t slot = 0; slot < simos_config.concurrency;
+		     slot++) {
+			struct simos_client *c = &simos_clients[slot];
+			if (c->phase == SP_UNUSED)
+				continue;
+			if (c->next_send < next)
+				next = c->next_send;
+			if (c->next_refill < next)
+				next = c->next_refill;
+		}
+
+		if (next == SIMOS_NEVER && deadline == SIMOS_NEVER) {
+			F_PRINT(2, "simulation deadlock: the server waits "
+				   "forever but nothing can happen\n");
+			sys_exit(1);
+		}
+
+		simos_now = next < deadline ? next : deadline;
+	}
+}
+
+int os_signalfd(const uint64_t *mask)
+{
+	F_UNUSED(mask);
+	stats_inc(SC_SYSCALLS);
+	return SIMOS_SIGNAL_FD;
+}
+
+int os_openat(int dir_fd, const char *path, int flags)
+{
+	F_UNUSED(dir_fd);
+	F_UNUSED(flags);
+	stats_inc(SC_SYSCALLS);
+
+	/* Only the counters of the backlog module exist, and only with the
+	   lines that it looks for. */
+	if (strcmp(path, "/proc/net/netstat") != 0)
+		return -ENOENT;
+
+	simos_netstat_len = 0;
+	simos_netstat_read = 0;
+	simos_append_str(simos_netstat, &simos_netstat_len,
+			 sizeof(simos_netstat), "TcpExt: ListenOverflows\n");
+	simos_append_str(simos_netstat, &simos_netstat_len,
+			 sizeof(simos_netstat), "TcpExt: ");
+	char num[FMT_U64_MAX_LEN];
+	simos_append(simos_netstat, &simos_netstat_len, sizeof(simos_netstat),
+		     num, fmt_u64(num, simos_overflows));
+	simos_append_str(simos_netstat, &simos_netstat_len,
+			 sizeof(simos_netstat), "\n");
+	return SIMOS_NETSTAT_FD;
+}
+
+int os_listen(int fd, int backlog)
+{
+	stats_inc(SC_SYSCALLS);
+	F_ASSERT(fd == SIMOS_LISTEN_FD && backlog > 0);
+
+	/* The queue cannot hold more than every client, which plays the role
+	   of somaxconn. */
+	simos_backlog =
+	    backlog < SIMOS_MAX_CLIENTS ? (uint32_t)backlog : SIMOS_MAX_CLIENTS;
+	return 0;
+}
+
+int os_accept4(int fd, struct sockaddr *addr, socklen_t *addr_len, int flags)
+{
+	F_UNUSED(flags);
+	stats_inc(SC_SYSCALLS);
+	F_ASSERT(fd == SIMOS_LISTEN_FD);
+
+	simos_run_until_now();
+	if (simos_accept_len == 0)
+		return -EAGAIN;
+
+	uint32_t slot = simos_accept_queue[simos_accept_head];
+	simos_accept_head = (simos_accept_head + 1) % SIMOS_MAX_CLIENTS;
+	simos_accept_len--;
+
+	/* Use the lowest free FD, like the kernel. */
+	int client_fd = SIMOS_FIRST_CLIENT_FD;
+	while (simos_fds[client_fd - SIMOS_FD_BASE] != -1)
+		client_fd++;
+	F_ASSERT(client_fd - SIMOS_FD_BASE < SIMOS_MAX_FDS);
+	simos_fds[client_fd - SIMOS_FD_BASE] = slot;
+
+	struct simos_client *c = &simos_clients[slot];
+	c->phase = SP_ACCEPTED;
+	c->fd = client_fd;
+	c->accept_time = simos_now;
+
+	/* The socket is dual-stack, so half of the clients connect over
+	   IPv6. */
+	if (addr != NULL && c->id % 2 == 0) {
+		struct sockaddr_in peer;
+		memset(&peer, 0, sizeof(peer));
+		peer.sin_family = AF_INET;
+		/* 10.x.y.z, or 198.51.100.z for the subnet clients, in network
+		   byte order. */
+		peer.sin_addr = c->behavior == SB_SUBNET
+				    ? 198 | 51 << 8 | 100 << 16 |
+					  (uint32_t)(c->id & 0xff) << 24
+				    : 10 | (uint32_t)(c->id & 0xffffff) << 8;
+		F_ASSERT(*addr_len >= sizeof(peer));
+		memcpy(addr, &peer, sizeof(peer));
+		*addr_len = sizeof(peer);
+	} else if (addr != NULL) {
+		struct sysext_sockaddr_in6 peer;
+		memset(&peer, 0, sizeof(peer));
+		peer.sin6_family = AF_INET6;
+		/* fd00::/96, or 2001:db8::/96 for the subnet clients, followed
+		   by the low 32 bits of the ID */
+		if (c->behavior == SB_SUBNET) {
+			peer.sin6_addr[0] = 0x20;
+			peer.sin6_addr[1] = 0x01;
+			peer.sin6_addr[2] = 0x0d;
+			peer.sin6_addr[3] = 0xb8;
+		} else {
+			peer.sin6_addr[0] = 0xfd;
+		}
+		for (int i = 0; i < 4; i++)
+			peer.sin6_addr[15 - i] = c->id >> (8 * i);
+		F_ASSERT(*addr_len >= sizeof(peer));
+		memcpy(addr, &peer, sizeof(peer));
+		*addr_len = sizeof(peer);
+	}
+
+	return client_fd;
+}
+
+ssize_t os_read(int fd, void *buf, size_t len)
+{
+	stats_inc(SC_SYSCALLS);
+
+	if (fd == SIMOS_SIGNAL_FD) {
+		if (simos_signals == 0)
+			return -EAGAIN;
+
+		/* A signalfd_siginfo structure is 128 bytes long and starts
+		   with the signal number. */
+		uint32_t info[32];
+		F_ASSERT(len >= sizeof(info));
+		memset(info, 0, sizeof(info));
+		info[0] = __builtin_ctzll(simos_signals) + 1;
+		simos_signals &= ~SYSEXT_SIGBIT(info[0]);
+		memcpy(buf, info, sizeof(info));
+
+		if (info[0] == SIGHUP)
+			simos_reload = SR_BUILDING;
+		return sizeof(info);
+	}
+
+	if (fd == SIMOS_NETSTAT_FD) {
+		size_t n = simos_netstat_len - simos_netstat_read;
+		if (n > len)
+			n = len;
+		memcpy(buf, simos_netstat + simos_netstat_read, n);
+		simos_netstat_read += n;
+		return n;
+	}
+
+	struct simos_client *c = simos_client_from_fd(fd);
+	if (c->consumed == c->delivered)
+		return c->shut ? 0 : -EAGAIN;
+
+	size_t n = c->delivered - c->consumed;
+	if (n > len)
+		n = len;
+	memcpy(buf, c->request + c->consumed, n);
+	c->consumed += n;
+	return n;
+}
+
+ssize_t os_recvmsg(int fd, struct sysext_msghdr *msg, int flags)
+{
+	F_UNUSED(flags);
+
+	/* The simulated clients have no kernel timestamps to give. */
+	msg->control_len = 0;
+	return os_read(fd, msg->iov->base, msg->iov->len);
+}
+
+ssize_t os_write(int fd, const void *buf, size_t len)
+{
+	stats_inc(SC_SYSCALLS);
+
+	struct simos_client *c = simos_client_from_fd(fd);
+	if (c->tx_space == 0)
+		return -EAGAIN;
+
+	size_t n = len < c->tx_space ? len : c->tx_space;
+	simos_append(c->response, &c->response_len, sizeof(c->response), buf,
+		     n);
+	c->tx_space -= n;
+
+	/* The client's buffer is full, it will read it a bit later. */
+	if (c->tx_space == 0)
+		c->next_refill = simos_now + toolutil_rand_range(0, 3);
+
+	return n;
+}
+
+int os_close(int fd)
+{
+	stats_inc(SC_SYSCALLS);
+
+	if (fd == SIMOS_NETSTAT_FD)
+		return 0;
+
+	struct simos_client *c = simos_client_from_fd(fd);
+	simos_check(c);
+
+	simos_fds[fd - SIMOS_FD_BASE] = -1;
+	c->phase = SP_UNUSED;
+	simos_live--;
+
+	if (simos_spawned < simos_config.clients) {
+		simos_spawn(c - simos_clients,
+			    simos_now + toolutil_rand_range(0, 5));
+	}
+
+	return 0;
+}
+
+int os_shutdown(int fd, int how)
+{
+	F_UNUSED(how);
+	stats_inc(SC_SYSCALLS);
+
+	/* The clients only check the response once the socket is closed. */
+	simos_client_from_fd(fd);
+	return 0;
+}
+
+int os_setsockopt(int fd, int level, int name, const void *value,
+		  uint32_t value_len)
+{
+	F_UNUSED(level);
+	F_UNUSED(name);
+	F_UNUSED(value);
+	F_UNUSED(value_len);
+	stats_inc(SC_SYSCALLS);
+
+	simos_client_from_fd(fd);
+	return 0;
+}
+
+int os_getsockopt(int fd, int level, int name, void *value,
+		  uint32_t *value_len)
+{
+	stats_inc(SC_SYSCALLS);
+
+	if (fd != SIMOS_LISTEN_FD || level != IPPROTO_TCP || name != TCP_INFO)
+		return -ENOPROTOOPT;
+
+	/* Like the kernel, unacked is the length of the accept queue of a
+	   listening socket and sacked its limit. */
+	struct sysext_tcp_info info;
+	memset(&info, 0, sizeof(info));
+	info.state = TCP_LISTEN;
+	info.unacked = simos_accept_len;
+	info.sacked = simos_backlog;
+	if (*value_len > sizeof(info))
+		*value_len = sizeof(info);
+	memcpy(value, &info, *value_len);
+	return 0;
+}
+
+int os_ioctl(int fd, unsigned long request, void *arg)
+{
+	F_UNUSED(fd);
+	F_UNUSED(request);
+	F_UNUSED(arg);
+
+	/* The simulated epoll has no parameters. */
+	stats_inc(SC_SYSCALLS);
+	return -ENOTTY;
+}
+
+int os_sched_yield()
+{
+	/* The other processes run for a tick of the virtual clock. */
+	stats_inc(SC_SYSCALLS);
+	simos_now++;
+	return 0;
+}
+
+int os_clock_gettime(int clock_id, struct timespec *ts)
+{
+	F_UNUSED(clock_id);
+	ts->tv_sec = simos_now / 1000;
+	ts->tv_nsec = (simos_now % 1000) * 1000000;
+	return 0;
+}
+
+/*
+ * The files of the server
+ */
+
+static bool simos_write_files()
+{
+	if (!simos_join(simos_paths.acme_dir, simos_config.dir, "acme") ||
+	    !simos_join(simos_paths.hosts, simos_config.dir, "hosts") ||
+	    !simos_join(simos_paths.subnets, simos_config.dir, "subnets")) {
+		F_PRINT(2, "simulation: the directory path is too long\n");
+		return false;
+	}
+
+	int ret = sysext_mkdirat(AT_FDCWD, simos_config.dir, 0700);
+	if (ret == 0 || ret == -EEXIST)
+		ret = sysext_mkdirat(AT_FDCWD, simos_paths.acme_dir, 0700);
+	if (ret != 0 && ret != -EEXIST) {
+		F_PRINT(2, "simulation: mkdir() failed\n");
+		return false;
+	}
+
+	/* The ACME clients usually end the key authorization with a new
+	   line. */
+	for (uint64_t i = 0; i < SIMOS_ACME_TOKENS; i++) {
+		char token[SIMOS_PATH_MAX];
+		char path[SIMOS_PATH_MAX];
+		char content[SIMOS_PATH_MAX];
+		uint16_t content_len = 0;
+		simos_acme_token(i, token);
+		simos_append_str(content, &content_len, sizeof(content),
+				 token);
+		simos_append_str(content, &content_len, sizeof(content),
+				 ".key\n");
+		content[content_len] = '\0';
+		if (!simos_join(path, simos_paths.acme_dir, token) ||
+		    !simos_write_file(path, content, O_TRUNC))
+			return false;
+	}
+
+	/* The hosts of example.org are added by the reload. */
+	return simos_write_file(simos_paths.hosts, "*.example.com\n",
+				O_TRUNC) &&
+	       simos_write_file(simos_paths.subnets,
+				"198.51.100.0/24 ipv4.example.com\n"
+				"2001:db8::/32 ipv6.example.com\n",
+				O_TRUNC);
+}
+
+static bool simos_join(char *path, const char *dir, const char *name)
+{
+	size_t dir_len = strlen(dir);
+	size_t name_len = strlen(name);
+	if (dir_len + 1 + name_len >= SIMOS_PATH_MAX)
+		return false;
+
+	memcpy(path, dir, dir_len);
+	path[dir_len] = '/';
+	memcpy(path + dir_len + 1, name, name_len + 1);
+	return true;
+}
+
+static bool simos_write_file(const char *path, const char *content,
+			     int flags)
+{
+	int fd = sysext_openat(AT_FDCWD, path,
+			       O_WRONLY | O_CREAT | O_CLOEXEC | flags, 0600);
+	if (fd < 0) {
+		F_PRINT(2, "simulation: open() failed\n");
+		return false;
+	}
+
+	size_t len = strlen(content);
+	bool ok = sys_write(fd, content, len) == (ssize_t)len;
+	sys_close(fd);
+	if (!ok)
+		F_PRINT(2, "simulation: write() failed\n");
+	return ok;
+}
+
+/**
+ * Writes the name of an ACME token, which is as long as the shortest real
+ * ones.
+ */
+static void simos_acme_token(uint64_t index, char *token)
+{
+	const char prefix[] = "sim-challenge-token-";
+	memcpy(token, prefix, sizeof(prefix) - 1);
+	size_t len = sizeof(prefix) - 1;
+	len += fmt_u64(token + len, index);
+	token[len] = '\0';
+}
+
+static void simos_start_reload()
+{
+	if (!simos_write_file(simos_paths.hosts, "*.example.org\n", O_APPEND))
+		sys_exit(1);
+
+	simos_signals |= SYSEXT_SIGBIT(SIGHUP);
+	simos_reload = SR_SIGNALED;
+}
+
+/**
+ * Waits in real time for the builder of the host list to signal the eventfd,
+ * and reports the real FDs that have become readable.
+ */
+static int simos_wait_reload(struct epoll_event *events, int max_events)
+{
+	struct sysext_pollfd fds[SIMOS_MAX_REAL_FDS];
+	for (uint32_t i = 0; i < simos_real_fd_count; i++) {
+		fds[i].fd = simos_real_fds[i].fd;
+		fds[i].events = POLLIN;
+		fds[i].revents = 0;
+	}
+
+	if (sysext_poll(fds, simos_real_fd_count, SIMOS_RELOAD_TIMEOUT) <= 0) {
+		F_PRINT(2, "simulation: the host list was not reloaded\n");
+		sys_exit(1);
+	}
+
+	/* The builder exits right after it has signaled the eventfd, and the
+	   server only reaps it once it has received SIGCHLD. */
+	if (sysext_waitid(P_ALL, 0, WEXITED | WNOWAIT) != 0) {
+		F_PRINT(2, "simulation: waitid() failed\n");
+		sys_exit(1);
+	}
+	simos_signals |= SYSEXT_SIGBIT(SIGCHLD);
+	simos_reload = SR_DONE;
+
+	int count = 0;
+	for (uint32_t i = 0; i < simos_real_fd_count && count < max_events;
+	     i++) {
+		if ((fds[i].revents & POLLIN) == 0)
+			continue;
+		events[count].events = EPOLLIN;
+		events[count].data.u64 = simos_real_fds[i].data;
+		count++;
+	}
+	return count;
+}
+
+/*
+ * The clients
+ */
+
+static void simos_spawn(uint32_t slot, uint64_t connect_time)
+{
+	struct simos_client *c = &simos_clients[slot];
+	memset(c, 0, sizeof(*c));
+
+	/* The host list is reloaded once, in the middle of the
+	   simulation. */
+	if (simos_spawned == simos_config.clients / 2 &&
+	    simos_reload == SR_WAITING)
+		simos_start_reload();
+
+	c->id = simos_spawned++;
+	c->phase = SP_CONNECTING;
+	c->next_send = connect_time;
+	c->next_refill = SIMOS_NEVER;
+	c->fd = -1;
+	simos_live++;
+
+	uint64_t roll = toolutil_rand_range(0, 99);
+	if (roll < 56)
+		c->behavior = SB_NORMAL;
+	else if (roll < 64)
+		c->behavior = SB_ONE_CHUNK;
+	else if (roll < 68)
+		c->behavior = SB_HEALTH;
+	else if (roll < 72)
+		c->behavior = SB_ACME;
+	else if (roll < 75)
+		c->behavior = SB_REJECTED;
+	else if (roll < 77)
+		c->behavior = simos_reload == SR_DONE ? SB_RELOADED
+						      : SB_REJECTED;
+	else if (roll < 80)
+		c->behavior = SB_SUBNET;
+	else if (roll < 85)
+		c->behavior = SB_LONG_PATH;
+	else if (roll < 90)
+		c->behavior = SB_BAD_REQUEST;
+	else if (roll < 94)
+		c->behavior = SB_EARLY_CLOSE;
+	else if (roll < 97)
+		c->behavior = SB_SLOW;
+	else
+		c->behavior = SB_IDLE;
+
+	simos_build_request(c);
+
+	/* Most requests arrive in a single chunk, but some are split in many
+	   small ones. */
+	uint64_t chunking = toolutil_rand_range(0, 9);
+	c->max_chunk = chunking < 6 ? sizeof(c->request)
+				    : (chunking < 9 ? 16 : 1);
+	c->min_delay = 0;
+	c->max_delay = c->max_chunk == 1 ? 3 : 20;
+	if (c->behavior == SB_SLOW) {
+		c->max_chunk = 1;
+		c->min_delay = 100;
+		c->max_delay = 200;
+	}
+
+	/* The early closing clients must stop before the CR that ends the Host
+	   header's value, otherwise the server has a valid request. */
+	c->shutdown_at = c->behavior == SB_EARLY_CLOSE
+			     ? toolutil_rand_range(0, c->request_len - 4)
+			     : UINT16_MAX;
+
+	/* Sometimes the server can only write a few bytes at a time. */
+	c->tx_space =
+	    toolutil_rand_range(0, 4) == 0 ? toolutil_rand_range(1, 64) : 4096;
+}
+
+static void simos_build_request(struct simos_client *c)
+{
+	char path[320];
+	uint16_t path_len = 0;
+	char host[64];
+	uint16_t host_len = 0;
+	char num[FMT_U64_MAX_LEN];
+	size_t num_len = fmt_u64(num, c->id);
+
+	char token[SIMOS_PATH_MAX];
+	simos_acme_token(c->id % SIMOS_ACME_TOKENS, token);
+
+	if (c->behavior == SB_BAD_REQUEST) {
+		simos_append_str(path, &path_len, sizeof(path), "nope");
+	} else if (c->behavior == SB_HEALTH) {
+		simos_append_str(path, &path_len, sizeof(path),
+				 SIMOS_HEALTH_PATH);
+	} else if (c->behavior == SB_ACME) {
+		simos_append_str(path, &path_len, sizeof(path),
+				 "/.well-known/acme-challenge/");
+		simos_append_str(path, &path_len, sizeof(path), token);
+	} else {
+		simos_append_str(path, &path_len, sizeof(path), "/page/");
+		simos_append(path, &path_len, sizeof(path), num, num_len);
+	}
+	if (c->behavior == SB_LONG_PATH) {
+		while (path_len < 300)
+			simos_append_str(path, &path_len, sizeof(path), "/x");
+	}
+
+	simos_append_str(host, &host_len, sizeof(host), "client");
+	simos_append(host, &host_len, sizeof(host), num, num_len);
+	if (c->behavior == SB_REJECTED)
+		simos_append_str(host, &host_len, sizeof(host), ".example.net");
+	else if (c->behavior == SB_RELOADED)
+		simos_append_str(host, &host_len, sizeof(host), ".example.org");
+	else
+		simos_append_str(host, &host_len, sizeof(host), ".example.com");
+
+	const size_t cap = sizeof(c->request);
+	simos_append_str(c->request, &c->request_len, cap, "GET ");
+	simos_append(c->request, &c->request_len, cap, path, path_len);
+	simos_append_str(c->request, &c->request_len, cap,
+			 " HTTP/1.1\r\nUser-Agent: sim\r\nAccept: */*\r\n");
+	/* Headers that start like the Host header. */
+	if (c->behavior == SB_ONE_CHUNK) {
+		simos_append_str(c->request, &c->request_len, cap,
+				 "Hostname: decoy\r\nHost-Id: decoy\r\n");
+	}
+	simos_append_str(c->request, &c->request_len, cap, "Host: ");
+	simos_append(c->request, &c->request_len, cap, host, host_len);
+	simos_append_str(c->request, &c->request_len, cap, "\r\n\r\n");
+
+	const size_t ecap = sizeof(c->expected);
+	switch (c->behavior) {
+	case SB_NORMAL:
+	case SB_ONE_CHUNK:
+	case SB_RELOADED:
+	case SB_SUBNET:
+		simos_append_str(c->expected, &c->expected_len, ecap,
+				 "HTTP/1.1 301 Moved Permanently\r\n"
+				 "Location: https://");
+		/* The IPv4 clients have an even ID. */
+		if (c->behavior == SB_SUBNET) {
+			simos_append_str(c->expected, &c->expected_len, ecap,
+					 c->id % 2 == 0 ? "ipv4.example.com"
+							: "ipv6.example.com");
+		} else {
+			simos_append(c->expected, &c->expected_len, ecap, host,
+				     host_len);
+		}
+		simos_append(c->expected, &c->expected_len, ecap, path,
+			     path_len);
+		simos_append_str(c->expected, &c->expected_len, ecap,
+				 "\r\nContent-Length: 0\r\n"
+				 "Connection: close\r\n\r\n");
+		break;
+	case SB_ACME: {
+		/* The new line that ends the file is not part of the
+		   content. */
+		char content_len[FMT_U64_MAX_LEN];
+		simos_append_str(c->expected, &c->expected_len, ecap,
+				 "HTTP/1.1 200 OK\r\n"
+				 "Content-Type: text/plain\r\n"
+				 "Content-Length: ");
+		simos_append(c->expected, &c->expected_len, ecap, content_len,
+			     fmt_u64(content_len, strlen(token) + 4));
+		simos_append_str(c->expected, &c->expected_len, ecap,
+				 "\r\nConnection: close\r\n\r\n");
+		simos_append_str(c->expected, &c->expected_len, ecap, token);
+		simos_append_str(c->expected, &c->expected_len, ecap, ".key");
+		break;
+	}
+	case SB_REJECTED:
+		simos_append_str(c->expected, &c->expected_len, ecap,
+				 "HTTP/1.1 421 Misdirected Request\r\n"
+				 "Content-Length: 0\r\n"
+				 "Connection: close\r\n\r\n");
+		break;
+	default:
+		break;
+	}
+}
+
+static void simos_append(char *buf, uint16_t *len, uint16_t capacity,
+			 const char *data, size_t data_len)
+{
+	F_ASSERT(*len + data_len <= capacity);
+	memcpy(buf + *len, data, data_len);
+	*len += data_len;
+}
+
+static void simos_append_str(char *buf, uint16_t *len, uint16_t capacity,
+			     const char *str)
+{
+	simos_append(buf, len, capacity, str, strlen(str));
+}
+
+/**
+ * Makes the clients do everything that they had planned to do until the
+ * current virtual time.
+ */
+static void simos_run_until_now()
+{
+	for (uint32_t slot = 0; slot < simos_config.concurrency; slot++) {
+		struct simos_client *c = &simos_clients[slot];
+		if (c->phase == SP_UNUSED)
+			continue;
+
+		while (c->next_send <= simos_now) {
+			if (c->phase != SP_CONNECTING) {
+				simos_send(c);
+				continue;
+			}
+
+			if (simos_accept_len == simos_backlog) {
+				simos_overflows++;
+				c->next_send += SIMOS_SYN_RETRY;
+				continue;
+			}
+
+			simos_accept_queue[(simos_accept_head +
+					    simos_accept_len) %
+					   SIMOS_MAX_CLIENTS] = slot;
+			simos_accept_len++;
+			c->phase = SP_QUEUED;
+			/* The client can start sending as soon as the
+			   connection is established. */
+			if (c->behavior == SB_IDLE)
+				c->next_send = SIMOS_NEVER;
+		}
+
+		if (c->next_refill <= simos_now) {
+			c->next_refill = SIMOS_NEVER;
+			c->tx_space = toolutil_rand_range(1, 4096);
+			c->out_edge = true;
+		}
+	}
+}
+
+static void simos_send(struct simos_client *c)
+{
+	uint16_t end = c->request_len < c->shutdown_at ? c->request_len
+						       : c->shutdown_at;
+	uint16_t n = c->behavior == SB_ONE_CHUNK
+			 ? end
+			 : toolutil_rand_range(1, c->max_chunk);
+	if (n > end - c->delivered)
+		n = end - c->delivered;
+	c->delivered += n;
+
+	if (c->delivered == end) {
+		c->next_send = SIMOS_NEVER;
+		if (end == c->shutdown_at)
+			c->shut = true;
+	} else {
+		c->next_send =
+		    simos_now + toolutil_rand_range(c->min_delay, c->max_delay);
+	}
+
+	c->in_edge = true;
+}
+
+/**
+ * Checks that the server did what the client expected, now that it is closing
+ * the connection.
+ */
+static void simos_check(struct simos_client *c)
+{
+	uint64_t lifetime = simos_now - c->accept_time;
+
+	switch (c->behavior) {
+	case SB_NORMAL:
+	case SB_ONE_CHUNK:
+	case SB_RELOADED:
+	case SB_SUBNET:
+		if (c->response_len != c->expected_len ||
+		    memcmp(c->response, c->expected, c->expected_len) != 0)
+			return simos_fail(c, "wrong redirect");
+		break;
+	case SB_ACME:
+	case SB_REJECTED:
+		if (c->response_len != c->expected_len ||
+		    memcmp(c->response, c->expected, c->expected_len) != 0)
+			return simos_fail(c, "wrong response");
+		break;
+	case SB_HEALTH:
+		/* The server is healthy or not depending on its load. */
+		if (c->response_len < 12 ||
+		    (memcmp(c->response, "HTTP/1.1 200", 12) != 0 &&
+		     memcmp(c->response, "HTTP/1.1 503", 12) != 0))
+			return simos_fail(c, "expected a 200 or a 503");
+		break;
+	case SB_LONG_PATH:
+		if (c->response_len < 12 ||
+		    memcmp(c->response, "HTTP/1.1 414", 12) != 0)
+			return simos_fail(c, "expected a 414");
+		break;
+	case SB_BAD_REQUEST:
+	case SB_EARLY_CLOSE:
+		if (c->response_len != 0)
+			return simos_fail(c, "unexpected response");
+		break;
+	case SB_SLOW:
+	case SB_IDLE:
+		if (c->response_len != 0)
+			return simos_fail(c, "unexpected response");
+		if (lifetime < SIMOS_CONN_TIMEOUT ||
+		    lifetime > SIMOS_CONN_TIMEOUT + SIMOS_TIMEOUT_SLACK)
+			return simos_fail(c, "closed at the wrong time");
+		break;
+	default:
+		F_ASSERT_UNREACHABLE();
+	}
+
+	if (c->behavior != SB_SLOW && c->behavior != SB_IDLE &&
+	    lifetime >= SIMOS_CONN_TIMEOUT)
+		return simos_fail(c, "timed out");
+
+	simos_report.ok[c->behavior]++;
+}
+
+static void simos_fail(struct simos_client *c, const char *why)
+{
+	simos_report.failed[c->behavior]++;
+
+	if (simos_failures_printed == 10)
+		return;
+	simos_failures_printed++;
+
+	char num[FMT_U64_MAX_LEN + 1];
+	num[fmt_u64(num, c->id)] = '\0';
+	F_PRINT(2, "client ");
+	F_PRINT(2, num);
+	F_PRINT(2, " (");
+	F_PRINT(2, simos_behavior_names[c->behavior]);
+	F_PRINT(2, "): ");
+	F_PRINT(2, why);
+	F_PRINT(2, "\n");
+}
+
+static struct simos_client *simos_client_from_fd(int fd)
+{
+	F_ASSERT(fd >= SIMOS_FIRST_CLIENT_FD &&
+		 fd - SIMOS_FD_BASE < SIMOS_MAX_FDS &&
+		 simos_fds[fd - SIMOS_FD_BASE] != -1);
+	return &simos_clients[simos_fds[fd - SIMOS_FD_BASE]];
+}
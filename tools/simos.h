@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP2SD_SIMOS_H
+#define HTTP2SD_SIMOS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * A fake implementation of the os module for the simulation harness. It
+ * simulates a listening socket, client sockets that deliver their requests in
+ * random chunks, accept partial writes and fail with EAGAIN, an epoll instance
+ * and a virtual clock that jumps straight to the next thing that happens. The
+ * clients check the response that they receive when the server closes their
+ * socket. Everything is driven by a seeded random number generator, so a run
+ * can be replayed exactly.
+ *
+ * The host list, the subnet list and the ACME challenges are real files that
+ * are written for the server, and the host list is extended and reloaded once
+ * in the middle of the simulation. The reload runs a real builder process, so
+ * the virtual clock is stopped until the builder has published the new image.
+ */
+
+/**
+ * The path of the health checks, which must be given to the server.
+ */
+#define SIMOS_HEALTH_PATH "/health"
+
+#define SIMOS_PATH_MAX 256
+
+struct simos_config {
+	uint64_t seed;
+
+	/**
+	 * The total amount of clients to simulate.
+	 */
+	uint64_t clients;
+
+	/**
+	 * The maximum amount of clients that are connected at the same time.
+	 */
+	uint32_t concurrency;
+
+	/**
+	 * The size of the listening socket's accept queue.
+	 */
+	uint32_t backlog;
+
+	/**
+	 * The directory in which the files given to the server are written.
+	 * It is created if it does not exist.
+	 */
+	const char *dir;
+};
+
+/**
+ * The paths of the files written by simos_init, which must be given to the
+ * server.
+ */
+struct simos_paths {
+	char acme_dir[SIMOS_PATH_MAX];
+	char hosts[SIMOS_PATH_MAX];
+	char subnets[SIMOS_PATH_MAX];
+};
+
+enum simos_behavior {
+	/**
+	 * Sends a valid request, possibly in many chunks, and expects a
+	 * redirect.
+	 */
+	SB_NORMAL,
+
+	/**
+	 * Sends a valid request with a very long path and expects a 414.
+	 */
+	SB_LONG_PATH,
+
+	/**
+	 * Sends an invalid request and expects the connection to be closed
+	 * without a response.
+	 */
+	SB_BAD_REQUEST,
+
+	/**
+	 * Closes its side of the connection in the middle of the request and
+	 * expects the connection to be closed without a response.
+	 */
+	SB_EARLY_CLOSE,
+
+	/**
+	 * Sends a valid request too slowly and expects the connection to be
+	 * closed without a response when its timeout expires.
+	 */
+	SB_SLOW,
+
+	/**
+	 * Sends nothing and expects the connection to be closed without a
+	 * response when its timeout expires.
+	 */
+	SB_IDLE,
+
+	/**
+	 * Sends a valid request with more headers in a single chunk, which the
+	 * single-shot parser handles, and expects a redirect.
+	 */
+	SB_ONE_CHUNK,
+
+	/**
+	 * Sends a health check and expects a 200 or a 503.
+	 */
+	SB_HEALTH,
+
+	/**
+	 * Requests an ACME challenge and expects its content.
+	 */
+	SB_ACME,
+
+	/**
+	 * Sends a request for a host that is not in the host list and expects
+	 * a 421.
+	 */
+	SB_REJECTED,
+
+	/**
+	 * Sends a request for a host that has been added to the host list by
+	 * the reload, and expects a redirect. These clients only connect once
+	 * the new list has been published.
+	 */
+	SB_RELOADED,
+
+	/**
+	 * Connects from an address of the subnet list and expects a redirect
+	 * to the target of its subnet.
+	 */
+	SB_SUBNET,
+
+	SB_COUNT,
+};
+
+struct simos_report {
+	uint64_t ok[SB_COUNT];
+	uint64_t failed[SB_COUNT];
+
+	/**
+	 * The virtual time that the simulation took, in milliseconds.
+	 */
+	uint64_t virtual_time;
+};
+
+extern const char *const simos_behavior_names[SB_COUNT];
+
+/**
+ * Writes the files of the server and starts a simulation. Returns the FD of
+ * the listening socket that must be given to the event loop, or -1 if the
+ * files could not be written.
+ */
+int simos_init(const struct simos_config *config, struct simos_paths *paths);
+
+/**
+ * Removes the files written by simos_init.
+ */
+void simos_cleanup();
+
+/**
+ * Returns true once every client has been served and checked.
+ */
+bool simos_is_finished();
+
+void simos_get_report(struct simos_report *report);
+
+#endif
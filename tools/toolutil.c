@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <flibc/util.h>
+
+#include "fmt.h"
+#include "toolutil.h"
+
+static uint64_t toolutil_rng = 1;
+
+bool toolutil_parse_args(char **argv, const char *usage,
+			 bool (*on_arg)(const char *flag, const char *value))
+{
+	for (++argv; *argv != NULL; argv += 2) {
+		if (argv[1] == NULL || !on_arg(argv[0], argv[1])) {
+			F_PRINT(2, usage);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool toolutil_parse_num(uint64_t *result, const char *arg)
+{
+	*result = 0;
+	if (*arg == '\0')
+		return false;
+
+	for (; *arg != '\0'; ++arg) {
+		if (*arg < '0' || *arg > '9')
+			return false;
+		*result = *result * 10 + (*arg - '0');
+	}
+
+	return true;
+}
+
+void toolutil_seed(uint64_t seed)
+{
+	/* xorshift64* must not be seeded with 0. */
+	toolutil_rng = seed != 0 ? seed : 1;
+}
+
+uint64_t toolutil_rand()
+{
+	/* xorshift64* */
+	toolutil_rng ^= toolutil_rng >> 12;
+	toolutil_rng ^= toolutil_rng << 25;
+	toolutil_rng ^= toolutil_rng >> 27;
+	return toolutil_rng * 0x2545f4914f6cdd1dULL;
+}
+
+uint64_t toolutil_rand_range(uint64_t min, uint64_t max)
+{
+	return min + toolutil_rand() % (max - min + 1);
+}
+
+void toolutil_print_num(const char *name, uint64_t value)
+{
+	char num[FMT_U64_MAX_LEN + 2];
+	size_t len = fmt_u64(num, value);
+	num[len] = '\n';
+	num[len + 1] = '\0';
+
+	F_PRINT(1, name);
+	F_PRINT(1, " ");
+	F_PRINT(1, num);
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2020 Greg Depoire--Ferrer <greg.depoire@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP2SD_TOOLUTIL_H
+#define HTTP2SD_TOOLUTIL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * The helpers that the tools share: the parsing of their arguments, a seeded
+ * random number generator and the printing of their results as "name value"
+ * lines, like the statistics of the server.
+ */
+
+/**
+ * Goes through the arguments after the name of the program, which are pairs
+ * of a flag and its value, and calls on_arg for every pair. Prints the usage
+ * and returns false if a flag has no value or if on_arg returns false.
+ */
+bool toolutil_parse_args(char **argv, const char *usage,
+			 bool (*on_arg)(const char *flag, const char *value));
+
+/**
+ * Parses a decimal number. Returns false if the argument is empty or contains
+ * anything other than digits.
+ */
+bool toolutil_parse_num(uint64_t *result, const char *arg);
+
+/**
+ * Seeds the random number generator. The same seed always gives the same
+ * sequence, so that a failing run can be replayed.
+ */
+void toolutil_seed(uint64_t seed);
+
+/**
+ * Returns the next random number.
+ */
+uint64_t toolutil_rand();
+
+/**
+ * Returns a random number between min and max, both included.
+ */
+uint64_t toolutil_rand_range(uint64_t min, uint64_t max);
+
+/**
+ * Prints a "name value" line to the standard output.
+ */
+void toolutil_print_num(const char *name, uint64_t value);
+
+#endif